@@ -22,6 +22,10 @@
  * Define NO_ENHANCED_BARRIERS to prevent to use of enhanced barriers even on supported hardware.
  *
  * Define USE_FULLSCREEN_SWAP_CHAIN to use a fullscreen swap chain.
+ *
+ * Define ON_DEMAND_RENDERING to only draw and present when the window contents are invalidated. Between changes the
+ * loop sleeps on window messages with a timeout instead of spinning. Drawn and idle frame counts and the latency from
+ * waking up to presenting are written to the debug output about once a second.
  */
 
 // Uncomment this if you want to opt out of reading vertex buffers as shader resources
@@ -39,6 +43,9 @@
 // Uncomment this if you want to use a fullscreen swap chain
 // #define USE_FULLSCREEN_SWAP_CHAIN
 
+// Uncomment this if you want to render only when the window contents change
+// #define ON_DEMAND_RENDERING
+
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
 #include <d3d12.h>
@@ -46,11 +53,16 @@
 #include <Windows.h>
 #include <wrl/client.h>
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
 #include <exception>
+#include <format>
 #include <limits>
 #include <memory>
+#include <optional>
 #include <type_traits>
 #include <vector>
 
@@ -102,13 +114,47 @@ auto ThrowIfFailed(HRESULT const hr) -> void {
   }
 }
 
+// Set by every message after which the window contents have to be drawn again
+auto frame_invalidated{true};
+
 auto CALLBACK WindowProc(HWND const hwnd, UINT const msg, WPARAM const wparam, LPARAM const lparam) -> LRESULT {
   if (msg == WM_CLOSE) {
     PostQuitMessage(0);
     return 0;
   }
+  if (msg == WM_PAINT || msg == WM_SIZE || msg == WM_DISPLAYCHANGE) {
+    frame_invalidated = true;
+  }
   return DefWindowProcW(hwnd, msg, wparam, lparam);
 }
+
+#ifdef ON_DEMAND_RENDERING
+struct OnDemandStats {
+  std::uint32_t active_frame_count{0};
+  std::uint32_t idle_frame_count{0};
+  // Frames drawn right after the loop woke up from idling, and the time from waking up to presenting them
+  std::uint32_t wakeup_count{0};
+  double total_wakeup_latency_ms{0};
+  double max_wakeup_latency_ms{0};
+  std::chrono::steady_clock::time_point window_start{std::chrono::steady_clock::now()};
+};
+
+// Intervals without drawn frames are merged into the next report, so an idle window stays quiet
+auto ReportOnDemandStats(OnDemandStats& stats) -> void {
+  auto const now{std::chrono::steady_clock::now()};
+
+  if (stats.active_frame_count == 0 || now - stats.window_start < std::chrono::seconds{1}) {
+    return;
+  }
+
+  OutputDebugStringW(std::format(L"{} frames drawn, {} idle frames in {:.1f} s, wakeup latency {:.2f} ms avg, "
+                                 L"{:.2f} ms max.\n", stats.active_frame_count, stats.idle_frame_count,
+                                 std::chrono::duration<double>(now - stats.window_start).count(),
+                                 stats.wakeup_count ? stats.total_wakeup_latency_ms / stats.wakeup_count : 0.0,
+                                 stats.max_wakeup_latency_ms).c_str());
+  stats = {};
+}
+#endif
 }
 
 auto WINAPI wWinMain(_In_ HINSTANCE const hInstance, [[maybe_unused]] _In_opt_ HINSTANCE const hPrevInstance,
@@ -883,6 +929,12 @@ auto WINAPI wWinMain(_In_ HINSTANCE const hInstance, [[maybe_unused]] _In_opt_ H
 
     auto frame_idx{0};
 
+#ifdef ON_DEMAND_RENDERING
+    DWORD constexpr idle_timeout_ms{250};
+    OnDemandStats on_demand_stats;
+    std::optional<std::chrono::steady_clock::time_point> wakeup_time;
+#endif
+
     while (true) {
       MSG msg;
 
@@ -910,9 +962,23 @@ auto WINAPI wWinMain(_In_ HINSTANCE const hInstance, [[maybe_unused]] _In_opt_ H
                                   swap_chain_flags));
       recreate_swap_chain_rtvs();
       is_fullscreen = fullscreen_state;
+      frame_invalidated = true;
     }
 #endif
 
+#ifdef ON_DEMAND_RENDERING
+      // Nothing changed since the last presented frame, sleep until a message arrives
+      if (!frame_invalidated) {
+        MsgWaitForMultipleObjectsEx(0, nullptr, idle_timeout_ms, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+        wakeup_time = std::chrono::steady_clock::now();
+        on_demand_stats.idle_frame_count += 1;
+        ReportOnDemandStats(on_demand_stats);
+        continue;
+      }
+
+      frame_invalidated = false;
+#endif
+
       auto back_buffer_idx{swap_chain->GetCurrentBackBufferIndex()};
 
       ThrowIfFailed(direct_command_allocators[frame_idx]->Reset());
@@ -1011,6 +1077,22 @@ auto WINAPI wWinMain(_In_ HINSTANCE const hInstance, [[maybe_unused]] _In_opt_ H
 
       ThrowIfFailed(swap_chain->Present(0, present_flags));
 
+#ifdef ON_DEMAND_RENDERING
+      on_demand_stats.active_frame_count += 1;
+
+      if (wakeup_time) {
+        auto const latency_ms{
+          std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - *wakeup_time).count()
+        };
+        on_demand_stats.wakeup_count += 1;
+        on_demand_stats.total_wakeup_latency_ms += latency_ms;
+        on_demand_stats.max_wakeup_latency_ms = std::max(on_demand_stats.max_wakeup_latency_ms, latency_ms);
+        wakeup_time.reset();
+      }
+
+      ReportOnDemandStats(on_demand_stats);
+#endif
+
       wait_for_in_flight_frames();
       back_buffer_idx = swap_chain->GetCurrentBackBufferIndex();
       frame_idx = (frame_idx + 1) % max_frames_in_flight;
@@ -0,0 +1,356 @@
+#ifndef DRAW_QUEUE_H
+#define DRAW_QUEUE_H
+
+#include <glad/glad.h>
+
+#include "RingBuffer.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+struct DrawElementsIndirectCommand {
+  GLuint count;
+  GLuint primCount;
+  GLuint firstIndex;
+  GLuint baseVertex;
+  GLuint baseInstance;
+};
+
+// Remembers the last value of the bits of GL state the draw queue touches and
+// skips calls that would not change them
+class GlStateShadow {
+public:
+  // Must be called after GL state was changed without going through the shadow
+  auto Invalidate() -> void {
+    program_ = unknown;
+    vertexArray_ = unknown;
+    drawIndirectBuffer_ = unknown;
+    parameterBuffer_ = unknown;
+    storageRanges_.clear();
+  }
+
+  auto UseProgram(GLuint const program) -> void {
+    if (Update(program_, program)) {
+      glUseProgram(program);
+    }
+  }
+
+  auto BindVertexArray(GLuint const vertexArray) -> void {
+    if (Update(vertexArray_, vertexArray)) {
+      glBindVertexArray(vertexArray);
+    }
+  }
+
+  auto BindDrawIndirectBuffer(GLuint const buffer) -> void {
+    if (Update(drawIndirectBuffer_, buffer)) {
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+    }
+  }
+
+  auto BindParameterBuffer(GLuint const buffer) -> void {
+    if (Update(parameterBuffer_, buffer)) {
+      glBindBuffer(GL_PARAMETER_BUFFER, buffer);
+    }
+  }
+
+  auto BindStorageBufferRange(GLuint const binding, GLuint const buffer, GLintptr const offset,
+                              GLsizeiptr const size) -> void {
+    if (binding >= storageRanges_.size()) {
+      storageRanges_.resize(binding + 1, StorageRange{unknown, 0, 0});
+    }
+
+    auto& range = storageRanges_[binding];
+
+    if (range.buffer == buffer && range.offset == offset && range.size == size) {
+      avoidedCount_ += 1;
+      return;
+    }
+
+    range = StorageRange{buffer, offset, size};
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, offset, size);
+    changeCount_ += 1;
+  }
+
+  [[nodiscard]] auto GetChangeCount() const -> std::size_t {
+    return changeCount_;
+  }
+
+  [[nodiscard]] auto GetAvoidedCount() const -> std::size_t {
+    return avoidedCount_;
+  }
+
+private:
+  struct StorageRange {
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size;
+  };
+
+  static GLuint constexpr unknown{0xFFFFFFFF};
+
+  auto Update(GLuint& current, GLuint const value) -> bool {
+    if (current == value) {
+      avoidedCount_ += 1;
+      return false;
+    }
+
+    current = value;
+    changeCount_ += 1;
+    return true;
+  }
+
+  GLuint program_{unknown};
+  GLuint vertexArray_{unknown};
+  GLuint drawIndirectBuffer_{unknown};
+  GLuint parameterBuffer_{unknown};
+  std::vector<StorageRange> storageRanges_;
+  std::size_t changeCount_{0};
+  std::size_t avoidedCount_{0};
+};
+
+// Collects the draws of a frame, sorts them by a 64 bit key and submits them as
+// few multidraws as possible. From the most significant bits down the key
+// holds the program, the vertex format, the material and the depth, so draws
+// sharing a program and a vertex format end up next to each other and are
+// merged into a single glMultiDrawElementsIndirect. Materials are looked up by
+// gl_DrawID from a per draw material index buffer, so they never split a batch.
+// Draws generated on the GPU are always issued on their own. Their material bits
+// are all ones, so they sort after the mergeable draws sharing their program and
+// vertex format instead of splitting them.
+class DrawQueue {
+public:
+  struct Stats {
+    std::size_t drawCount;
+    std::size_t batchCount;
+    std::size_t stateChangeCount;
+    std::size_t avoidedStateChangeCount;
+  };
+
+  // Draws whose commands, draw count and per draw material indices are written by the GPU
+  struct GpuDrawList {
+    GLuint commandBuffer;
+    GLuint drawCountBuffer;
+    GLintptr drawCountOffset;
+    GLsizei maxDrawCount;
+    GLuint materialIndexBuffer;
+  };
+
+  static int constexpr programBits{12};
+  static int constexpr vertexFormatBits{8};
+  static int constexpr materialBits{20};
+  static int constexpr depthBits{24};
+
+  // The per draw material indices are bound to the given shader storage binding
+  explicit DrawQueue(GLuint const materialIndexBinding) :
+    materialIndexBinding_{materialIndexBinding} {
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment_);
+  }
+
+  // Depth is expected in [0, 1], nearer draws are issued first within a batch.
+  // The largest material index is reserved for draws generated on the GPU.
+  auto Submit(GLuint const program, GLuint const vertexArray, GLenum const indexType, GLuint const materialIdx,
+              float const depth, DrawElementsIndirectCommand const& command) -> void {
+    if (materialIdx >= gpuDrawListMaterial) {
+      throw std::runtime_error{"Draw queue material index is out of range."};
+    }
+
+    auto const key = MakeKey(program, vertexArray, indexType, materialIdx, depth);
+    entries_.push_back(Entry{key, program, vertexArray, indexType, materialIdx, command, std::nullopt});
+  }
+
+  auto Submit(GLuint const program, GLuint const vertexArray, GLenum const indexType, float const depth,
+              GpuDrawList const& drawList) -> void {
+    auto const key = MakeKey(program, vertexArray, indexType, gpuDrawListMaterial, depth);
+    entries_.push_back(Entry{key, program, vertexArray, indexType, gpuDrawListMaterial, {}, drawList});
+  }
+
+  // Issues the submitted draws and clears the queue. Commands and material
+  // indices go through the ring buffer, so it must be called between the ring
+  // buffer's BeginFrame and EndFrame.
+  auto Flush(PersistentRingBuffer& ringBuffer) -> void {
+    // The culling passes and others change state between flushes
+    stateShadow_.Invalidate();
+    auto const stateChangeStart = stateShadow_.GetChangeCount();
+    auto const avoidedStateChangeStart = stateShadow_.GetAvoidedCount();
+
+    Sort();
+
+    for (std::size_t first{0}; first < sorted_.size();) {
+      auto const& firstEntry = entries_[sorted_[first].entryIdx];
+
+      stateShadow_.UseProgram(firstEntry.program);
+      stateShadow_.BindVertexArray(firstEntry.vertexArray);
+
+      if (auto const& drawList = firstEntry.gpuDrawList) {
+        stateShadow_.BindDrawIndirectBuffer(drawList->commandBuffer);
+        stateShadow_.BindParameterBuffer(drawList->drawCountBuffer);
+        stateShadow_.BindStorageBufferRange(materialIndexBinding_, drawList->materialIndexBuffer, 0,
+                                           drawList->maxDrawCount * sizeof(GLuint));
+        glMultiDrawElementsIndirectCount(GL_TRIANGLES, firstEntry.indexType, nullptr, drawList->drawCountOffset,
+                                         drawList->maxDrawCount, 0);
+        stats_.batchCount += 1;
+        first += 1;
+        continue;
+      }
+
+      auto last = first + 1;
+
+      while (last < sorted_.size() && CanMerge(firstEntry, entries_[sorted_[last].entryIdx])) {
+        last += 1;
+      }
+
+      auto const drawCount = static_cast<GLsizei>(last - first);
+      auto const commandAlloc = ringBuffer.Allocate(drawCount * sizeof(DrawElementsIndirectCommand), sizeof(GLuint));
+      auto const materialAlloc = ringBuffer.Allocate(drawCount * sizeof(GLuint), storageAlignment_);
+      auto* const commands = reinterpret_cast<DrawElementsIndirectCommand*>(commandAlloc.ptr);
+      auto* const materialIndices = reinterpret_cast<GLuint*>(materialAlloc.ptr);
+
+      for (auto i = first; i < last; i++) {
+        auto const& entry = entries_[sorted_[i].entryIdx];
+        commands[i - first] = entry.command;
+        materialIndices[i - first] = entry.materialIdx;
+      }
+
+      stateShadow_.BindDrawIndirectBuffer(ringBuffer.GetBuffer());
+      stateShadow_.BindStorageBufferRange(materialIndexBinding_, ringBuffer.GetBuffer(), materialAlloc.offset,
+                                         materialAlloc.size);
+      glMultiDrawElementsIndirect(GL_TRIANGLES, firstEntry.indexType,
+                                  reinterpret_cast<void const*>(commandAlloc.offset), drawCount, 0);
+      stats_.batchCount += 1;
+      first = last;
+    }
+
+    stats_.drawCount += entries_.size();
+    stats_.stateChangeCount += stateShadow_.GetChangeCount() - stateChangeStart;
+    stats_.avoidedStateChangeCount += stateShadow_.GetAvoidedCount() - avoidedStateChangeStart;
+    entries_.clear();
+    programs_.clear();
+    vertexFormats_.clear();
+  }
+
+  // Totals since the last call
+  [[nodiscard]] auto ConsumeStats() -> Stats {
+    auto const stats = stats_;
+    stats_ = {};
+    return stats;
+  }
+
+private:
+  struct Entry {
+    std::uint64_t key;
+    GLuint program;
+    GLuint vertexArray;
+    GLenum indexType;
+    GLuint materialIdx;
+    DrawElementsIndirectCommand command;
+    std::optional<GpuDrawList> gpuDrawList;
+  };
+
+  struct SortItem {
+    std::uint64_t key;
+    std::uint32_t entryIdx;
+  };
+
+  struct VertexFormat {
+    GLuint vertexArray;
+    GLenum indexType;
+  };
+
+  static GLuint constexpr gpuDrawListMaterial{(1u << materialBits) - 1};
+
+  [[nodiscard]] static auto CanMerge(Entry const& first, Entry const& other) -> bool {
+    return !other.gpuDrawList && first.program == other.program && first.vertexArray == other.vertexArray &&
+      first.indexType == other.indexType;
+  }
+
+  // Programs and vertex formats are numbered in the order they are first seen
+  // within a frame, so deleted or relinked programs do not use up key space
+  [[nodiscard]] auto MakeKey(GLuint const program, GLuint const vertexArray, GLenum const indexType,
+                             GLuint const materialIdx, float const depth) -> std::uint64_t {
+    auto const programIt = std::ranges::find(programs_, program);
+    auto const programIdx = static_cast<std::uint64_t>(programIt - programs_.begin());
+
+    if (programIt == programs_.end()) {
+      if (programs_.size() == std::size_t{1} << programBits) {
+        throw std::runtime_error{"Draw queue ran out of program key bits."};
+      }
+
+      programs_.push_back(program);
+    }
+
+    auto const formatIt = std::ranges::find_if(vertexFormats_, [&](VertexFormat const& format) {
+      return format.vertexArray == vertexArray && format.indexType == indexType;
+    });
+    auto const formatIdx = static_cast<std::uint64_t>(formatIt - vertexFormats_.begin());
+
+    if (formatIt == vertexFormats_.end()) {
+      if (vertexFormats_.size() == std::size_t{1} << vertexFormatBits) {
+        throw std::runtime_error{"Draw queue ran out of vertex format key bits."};
+      }
+
+      vertexFormats_.push_back(VertexFormat{vertexArray, indexType});
+    }
+
+    auto constexpr maxDepth = (std::uint64_t{1} << depthBits) - 1;
+    auto const depthKey = static_cast<std::uint64_t>(std::lround(std::clamp(depth, 0.f, 1.f) * maxDepth));
+
+    return programIdx << (vertexFormatBits + materialBits + depthBits) |
+      formatIdx << (materialBits + depthBits) |
+      static_cast<std::uint64_t>(materialIdx) << depthBits |
+      depthKey;
+  }
+
+  // Least significant digit first radix sort over 8 bit digits, digits that
+  // are the same for every key are skipped
+  auto Sort() -> void {
+    sorted_.resize(entries_.size());
+    scratch_.resize(entries_.size());
+
+    for (std::size_t i{0}; i < entries_.size(); i++) {
+      sorted_[i] = SortItem{entries_[i].key, static_cast<std::uint32_t>(i)};
+    }
+
+    for (auto shift = 0; shift < 64; shift += 8) {
+      std::array<std::size_t, 256> offsets{};
+
+      for (auto const& item : sorted_) {
+        offsets[item.key >> shift & 0xFF] += 1;
+      }
+
+      if (sorted_.empty() || offsets[sorted_.front().key >> shift & 0xFF] == sorted_.size()) {
+        continue;
+      }
+
+      std::size_t offset{0};
+
+      for (auto& count : offsets) {
+        offset += std::exchange(count, offset);
+      }
+
+      for (auto const& item : sorted_) {
+        scratch_[offsets[item.key >> shift & 0xFF]++] = item;
+      }
+
+      std::swap(sorted_, scratch_);
+    }
+  }
+
+  GLuint materialIndexBinding_;
+  GLint storageAlignment_{1};
+  std::vector<Entry> entries_;
+  std::vector<SortItem> sorted_;
+  std::vector<SortItem> scratch_;
+  std::vector<GLuint> programs_;
+  std::vector<VertexFormat> vertexFormats_;
+  GlStateShadow stateShadow_;
+  Stats stats_{};
+};
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Measures named scopes of GPU work with GL_TIMESTAMP queries. The queries of
+// every frame have their own slot and are only read back when the slot comes
+// around again frameCount frames later, so reading them never stalls. Results
+// that are still not available by then are dropped instead of waited for.
+// Resolved scopes are collected into per scope statistics, and the scopes of
+// the first traceFrameLimit resolved frames are written to a trace file in the
+// Chrome trace event format.
+class GpuProfiler {
+public:
+  struct ScopeStats {
+    std::string_view name;
+    std::size_t sampleCount;
+    double totalMs;
+    double minMs;
+    double maxMs;
+  };
+
+  // Ends the scope when it goes out of scope
+  class ScopeGuard {
+  public:
+    explicit ScopeGuard(GpuProfiler& profiler) :
+      profiler_{profiler} {}
+
+    ScopeGuard(ScopeGuard const& other) = delete;
+    ScopeGuard(ScopeGuard&& other) = delete;
+
+    ~ScopeGuard() {
+      profiler_.EndScope();
+    }
+
+    auto operator=(ScopeGuard const& other) -> void = delete;
+    auto operator=(ScopeGuard&& other) -> void = delete;
+
+  private:
+    GpuProfiler& profiler_;
+  };
+
+  GpuProfiler(std::size_t const frameCount, std::filesystem::path const& tracePath,
+              std::size_t const traceFrameLimit) :
+    frames_(frameCount),
+    trace_{tracePath},
+    traceFrameLimit_{traceFrameLimit} {
+    trace_ << "[\n";
+  }
+
+  GpuProfiler(GpuProfiler const& other) = delete;
+  GpuProfiler(GpuProfiler&& other) = delete;
+
+  ~GpuProfiler() {
+    for (auto const& frame : frames_) {
+      if (!frame.queries.empty()) {
+        glDeleteQueries(static_cast<GLsizei>(frame.queries.size()), frame.queries.data());
+      }
+    }
+
+    trace_ << "\n]\n";
+  }
+
+  auto operator=(GpuProfiler const& other) -> void = delete;
+  auto operator=(GpuProfiler&& other) -> void = delete;
+
+  // Moves on to the next slot, resolving the scopes recorded into it the last time around
+  auto BeginFrame() -> void {
+    frameIdx_ = (frameIdx_ + 1) % frames_.size();
+    auto& frame = frames_[frameIdx_];
+
+    if (!frame.scopes.empty()) {
+      Resolve(frame);
+    }
+
+    frame.scopes.clear();
+    frame.usedQueryCount = 0;
+  }
+
+  // Scope names must outlive the profiler
+  [[nodiscard]] auto Scope(std::string_view const name) -> ScopeGuard {
+    BeginScope(name);
+    return ScopeGuard{*this};
+  }
+
+  auto BeginScope(std::string_view const name) -> void {
+    auto& frame = frames_[frameIdx_];
+    auto const query = NextQuery(frame);
+    glQueryCounter(query, GL_TIMESTAMP);
+    frame.scopes.push_back(RecordedScope{name, query, 0});
+    openScopes_.push_back(frame.scopes.size() - 1);
+  }
+
+  auto EndScope() -> void {
+    auto& frame = frames_[frameIdx_];
+    auto const query = NextQuery(frame);
+    glQueryCounter(query, GL_TIMESTAMP);
+    frame.scopes[openScopes_.back()].endQuery = query;
+    openScopes_.pop_back();
+  }
+
+  // Statistics of the scopes resolved since the last call
+  [[nodiscard]] auto ConsumeStats() -> std::vector<ScopeStats> {
+    return std::exchange(stats_, {});
+  }
+
+  [[nodiscard]] auto ConsumeDroppedFrameCount() -> std::size_t {
+    return std::exchange(droppedFrameCount_, 0);
+  }
+
+private:
+  struct RecordedScope {
+    std::string_view name;
+    GLuint beginQuery;
+    GLuint endQuery;
+  };
+
+  struct Frame {
+    std::vector<GLuint> queries;
+    std::size_t usedQueryCount{0};
+    std::vector<RecordedScope> scopes;
+  };
+
+  // Names may hold any characters, they are escaped as JSON strings
+  [[nodiscard]] static auto EscapeJson(std::string_view const str) -> std::string {
+    std::string escaped;
+    escaped.reserve(str.size());
+
+    for (auto const c : str) {
+      if (c == '"' || c == '\\') {
+        escaped += '\\';
+        escaped += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        escaped += "\\u00";
+        escaped += "0123456789abcdef"[c >> 4];
+        escaped += "0123456789abcdef"[c & 0xF];
+      } else {
+        escaped += c;
+      }
+    }
+
+    return escaped;
+  }
+
+  [[nodiscard]] static auto NextQuery(Frame& frame) -> GLuint {
+    if (frame.usedQueryCount == frame.queries.size()) {
+      auto& query = frame.queries.emplace_back();
+      glCreateQueries(GL_TIMESTAMP, 1, &query);
+    }
+
+    return frame.queries[frame.usedQueryCount++];
+  }
+
+  auto Resolve(Frame const& frame) -> void {
+    // Timestamps are written in order, so the last one being available means all of them are
+    GLint available;
+    glGetQueryObjectiv(frame.queries[frame.usedQueryCount - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+
+    if (available != GL_TRUE) {
+      droppedFrameCount_ += 1;
+      return;
+    }
+
+    auto const traced = tracedFrameCount_ < traceFrameLimit_;
+    tracedFrameCount_ += traced;
+
+    for (auto const& [name, beginQuery, endQuery] : frame.scopes) {
+      GLuint64 begin, end;
+      glGetQueryObjectui64v(beginQuery, GL_QUERY_RESULT, &begin);
+      glGetQueryObjectui64v(endQuery, GL_QUERY_RESULT, &end);
+
+      auto const ms = static_cast<double>(end - begin) / 1e6;
+
+      auto it = std::ranges::find(stats_, name, &ScopeStats::name);
+
+      if (it == stats_.end()) {
+        it = stats_.insert(it, ScopeStats{name, 0, 0, ms, ms});
+      }
+
+      it->sampleCount += 1;
+      it->totalMs += ms;
+      it->minMs = std::min(it->minMs, ms);
+      it->maxMs = std::max(it->maxMs, ms);
+
+      if (!traced) {
+        continue;
+      }
+
+      if (traceOrigin_ == 0) {
+        traceOrigin_ = begin;
+      }
+
+      // Complete events with microsecond timestamps relative to the first resolved scope
+      trace_ << (traceEventWritten_ ? ",\n" : "") << R"({"name":")" << EscapeJson(name) <<
+        R"(","ph":"X","pid":0,"tid":0,"ts":)" << std::fixed << std::setprecision(3) <<
+        static_cast<double>(begin - traceOrigin_) / 1e3 << R"(,"dur":)" << static_cast<double>(end - begin) / 1e3 << '}';
+      traceEventWritten_ = true;
+    }
+  }
+
+  std::vector<Frame> frames_;
+  std::size_t frameIdx_{0};
+  std::vector<std::size_t> openScopes_;
+  std::vector<ScopeStats> stats_;
+  std::size_t droppedFrameCount_{0};
+  std::ofstream trace_;
+  std::size_t traceFrameLimit_;
+  std::size_t tracedFrameCount_{0};
+  GLuint64 traceOrigin_{0};
+  bool traceEventWritten_{false};
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef INSTANCE_TRANSFORMS_H
+#define INSTANCE_TRANSFORMS_H
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Rows of an affine world matrix with the translation in the last column. The
+// implicit fourth row saves a quarter of the size of a full 4x4 matrix.
+struct PackedTransform {
+  float rows[3][4];
+};
+
+// Position, rotation and scale of every instance in structure of arrays layout,
+// composed into packed world matrices 8 instances at a time. Only batches that
+// changed since the last update are composed again and reported as dirty, so
+// only those have to be streamed to the GPU.
+class InstanceTransforms {
+public:
+  struct Range {
+    std::size_t first;
+    std::size_t count;
+  };
+
+  static std::size_t constexpr batchSize{8};
+
+  explicit InstanceTransforms(std::size_t const count) :
+    count_{count} {
+    // Padding to whole batches lets the composition ignore the tail
+    auto const paddedCount = (count + batchSize - 1) / batchSize * batchSize;
+
+    for (auto* const component : {&posX_, &posY_, &posZ_, &rotX_, &rotY_, &rotZ_}) {
+      component->resize(paddedCount, 0.0f);
+    }
+
+    for (auto* const component : {&rotW_, &scaleX_, &scaleY_, &scaleZ_}) {
+      component->resize(paddedCount, 1.0f);
+    }
+
+    transforms_.resize(paddedCount);
+    dirtyWords_.resize((paddedCount / batchSize + 63) / 64, 0);
+    Invalidate();
+  }
+
+  auto SetPosition(std::size_t const idx, float const x, float const y, float const z) -> void {
+    posX_[idx] = x;
+    posY_[idx] = y;
+    posZ_[idx] = z;
+    MarkDirty(idx);
+  }
+
+  // Expects a unit quaternion
+  auto SetRotation(std::size_t const idx, float const x, float const y, float const z, float const w) -> void {
+    rotX_[idx] = x;
+    rotY_[idx] = y;
+    rotZ_[idx] = z;
+    rotW_[idx] = w;
+    MarkDirty(idx);
+  }
+
+  auto SetScale(std::size_t const idx, float const x, float const y, float const z) -> void {
+    scaleX_[idx] = x;
+    scaleY_[idx] = y;
+    scaleZ_[idx] = z;
+    MarkDirty(idx);
+  }
+
+  // Marks every instance dirty
+  auto Invalidate() -> void {
+    for (std::size_t idx{0}; idx < count_; idx += batchSize) {
+      MarkDirty(idx);
+    }
+  }
+
+  // Composes the dirty batches and returns the ranges of instances whose
+  // matrices changed, valid until the next call
+  auto Update() -> std::span<Range const> {
+    dirtyRanges_.clear();
+
+    for (std::size_t wordIdx{0}; wordIdx < dirtyWords_.size(); wordIdx++) {
+      for (auto word = std::exchange(dirtyWords_[wordIdx], 0); word; word &= word - 1) {
+        auto const batchIdx = wordIdx * 64 + static_cast<std::size_t>(std::countr_zero(word));
+        auto const first = batchIdx * batchSize;
+
+        ComposeBatch(first);
+
+        if (!dirtyRanges_.empty() && dirtyRanges_.back().first + dirtyRanges_.back().count == first) {
+          dirtyRanges_.back().count += batchSize;
+        } else {
+          dirtyRanges_.push_back(Range{first, batchSize});
+        }
+      }
+    }
+
+    // The last batch may reach into the padding
+    if (!dirtyRanges_.empty()) {
+      auto& last = dirtyRanges_.back();
+      last.count = std::min(last.count, count_ - last.first);
+    }
+
+    return dirtyRanges_;
+  }
+
+  [[nodiscard]] auto GetTransforms() const -> std::span<PackedTransform const> {
+    return std::span{transforms_}.first(count_);
+  }
+
+  [[nodiscard]] auto GetCount() const -> std::size_t {
+    return count_;
+  }
+
+private:
+  auto MarkDirty(std::size_t const idx) -> void {
+    auto const batchIdx = idx / batchSize;
+    dirtyWords_[batchIdx / 64] |= std::uint64_t{1} << (batchIdx % 64);
+  }
+
+#ifdef __AVX2__
+  auto ComposeBatch(std::size_t const first) -> void {
+    auto const x = _mm256_loadu_ps(&rotX_[first]);
+    auto const y = _mm256_loadu_ps(&rotY_[first]);
+    auto const z = _mm256_loadu_ps(&rotZ_[first]);
+    auto const w = _mm256_loadu_ps(&rotW_[first]);
+    auto const sx = _mm256_loadu_ps(&scaleX_[first]);
+    auto const sy = _mm256_loadu_ps(&scaleY_[first]);
+    auto const sz = _mm256_loadu_ps(&scaleZ_[first]);
+
+    auto const one = _mm256_set1_ps(1.0f);
+    auto const two = _mm256_set1_ps(2.0f);
+
+    auto const xx = _mm256_mul_ps(x, x);
+    auto const yy = _mm256_mul_ps(y, y);
+    auto const zz = _mm256_mul_ps(z, z);
+    auto const xy = _mm256_mul_ps(x, y);
+    auto const xz = _mm256_mul_ps(x, z);
+    auto const yz = _mm256_mul_ps(y, z);
+    auto const wx = _mm256_mul_ps(w, x);
+    auto const wy = _mm256_mul_ps(w, y);
+    auto const wz = _mm256_mul_ps(w, z);
+
+    // Rotation matrix columns scaled by the scale, one register per element
+    alignas(32) float elements[12][batchSize];
+    _mm256_store_ps(elements[0], _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz))), sx));
+    _mm256_store_ps(elements[1], _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), sy));
+    _mm256_store_ps(elements[2], _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), sz));
+    _mm256_store_ps(elements[3], _mm256_loadu_ps(&posX_[first]));
+    _mm256_store_ps(elements[4], _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), sx));
+    _mm256_store_ps(elements[5], _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz))), sy));
+    _mm256_store_ps(elements[6], _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), sz));
+    _mm256_store_ps(elements[7], _mm256_loadu_ps(&posY_[first]));
+    _mm256_store_ps(elements[8], _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), sx));
+    _mm256_store_ps(elements[9], _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), sy));
+    _mm256_store_ps(elements[10], _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy))), sz));
+    _mm256_store_ps(elements[11], _mm256_loadu_ps(&posZ_[first]));
+
+    // Interleaving into the per instance layout the GPU reads
+    for (std::size_t lane{0}; lane < batchSize; lane++) {
+      auto& rows = transforms_[first + lane].rows;
+
+      for (std::size_t i{0}; i < 12; i++) {
+        rows[i / 4][i % 4] = elements[i][lane];
+      }
+    }
+  }
+#else
+  auto ComposeBatch(std::size_t const first) -> void {
+    for (auto idx = first; idx < first + batchSize; idx++) {
+      auto const x = rotX_[idx];
+      auto const y = rotY_[idx];
+      auto const z = rotZ_[idx];
+      auto const w = rotW_[idx];
+      auto const sx = scaleX_[idx];
+      auto const sy = scaleY_[idx];
+      auto const sz = scaleZ_[idx];
+
+      transforms_[idx] = PackedTransform{
+        {
+          {(1 - 2 * (y * y + z * z)) * sx, 2 * (x * y - w * z) * sy, 2 * (x * z + w * y) * sz, posX_[idx]},
+          {2 * (x * y + w * z) * sx, (1 - 2 * (x * x + z * z)) * sy, 2 * (y * z - w * x) * sz, posY_[idx]},
+          {2 * (x * z - w * y) * sx, 2 * (y * z + w * x) * sy, (1 - 2 * (x * x + y * y)) * sz, posZ_[idx]}
+        }
+      };
+    }
+  }
+#endif
+
+  std::size_t count_;
+
+  std::vector<float> posX_;
+  std::vector<float> posY_;
+  std::vector<float> posZ_;
+  std::vector<float> rotX_;
+  std::vector<float> rotY_;
+  std::vector<float> rotZ_;
+  std::vector<float> rotW_;
+  std::vector<float> scaleX_;
+  std::vector<float> scaleY_;
+  std::vector<float> scaleZ_;
+
+  std::vector<PackedTransform> transforms_;
+
+  // One bit per batch
+  std::vector<std::uint64_t> dirtyWords_;
+  std::vector<Range> dirtyRanges_;
+};
+
+#endif
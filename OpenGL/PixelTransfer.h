@@ -0,0 +1,413 @@
+#ifndef PIXEL_TRANSFER_H
+#define PIXEL_TRANSFER_H
+
+#include <glad/glad.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// 1D textures use a height of 1
+struct TextureRegion {
+  GLuint texture;
+  GLint level;
+  GLint x;
+  GLint y;
+  GLsizei width;
+  GLsizei height;
+  GLenum format;
+  GLenum type;
+};
+
+// Uploads texels through a ring of slots in a persistently mapped pixel unpack
+// buffer. Worker threads write the texels into the mapped slots, and the render
+// thread issues the transfers once they are written. A slot is reused after
+// the fence placed behind its transfer passed. The render thread only ever
+// polls the fences, so uploads never block it on the driver.
+class PixelUploadStream {
+public:
+  // Receives the mapped slot on a worker thread, texels have to be tightly packed
+  using FillFunction = std::function<void(std::span<std::byte>)>;
+
+  PixelUploadStream(GLsizeiptr const slotSize, std::size_t const slotCount, std::size_t const workerCount) :
+    slotSize_{slotSize}, slots_(slotCount) {
+    GLbitfield constexpr mapFlags{GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT};
+
+    glCreateBuffers(1, &buffer_);
+    glNamedBufferStorage(buffer_, slotSize_ * static_cast<GLsizeiptr>(slotCount), nullptr, mapFlags);
+    mapped_ = static_cast<std::byte*>(glMapNamedBufferRange(buffer_, 0, slotSize_ * static_cast<GLsizeiptr>(slotCount),
+                                                            mapFlags));
+
+    for (std::size_t i{0}; i < workerCount; i++) {
+      workers_.emplace_back([this] {
+        RunWorker();
+      });
+    }
+  }
+
+  PixelUploadStream(PixelUploadStream const& other) = delete;
+  PixelUploadStream(PixelUploadStream&& other) = delete;
+
+  ~PixelUploadStream() {
+    {
+      std::scoped_lock const lock{mutex_};
+      stopping_ = true;
+    }
+
+    jobAvailable_.notify_all();
+
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+
+    for (auto const& slot : slots_) {
+      if (slot.fence) {
+        glDeleteSync(slot.fence);
+      }
+    }
+
+    glUnmapNamedBuffer(buffer_);
+    glDeleteBuffers(1, &buffer_);
+  }
+
+  auto operator=(PixelUploadStream const& other) -> void = delete;
+  auto operator=(PixelUploadStream&& other) -> void = delete;
+
+  // The size must fit into a slot. The texture contents are undefined until the
+  // transfer is issued by a later Pump.
+  auto Enqueue(TextureRegion const& region, GLsizeiptr const size, FillFunction fill) -> void {
+    pending_.push_back(Request{region, size, std::move(fill)});
+  }
+
+  // Retires finished transfers, issues the ones the workers finished writing and
+  // hands pending requests to free slots. Must be called regularly on the render
+  // thread.
+  auto Pump() -> void {
+    std::scoped_lock const lock{mutex_};
+
+    for (std::size_t slotIdx{0}; slotIdx < slots_.size(); slotIdx++) {
+      auto& slot = slots_[slotIdx];
+
+      if (slot.state == SlotState::kInFlight && IsSignaled(slot.fence)) {
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+        slot.state = SlotState::kFree;
+      }
+
+      if (slot.state == SlotState::kWritten) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer_);
+        IssueUpload(slot.request.region, reinterpret_cast<void const*>(slotIdx * slotSize_));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.state = SlotState::kInFlight;
+        uploadedSize_ += slot.request.size;
+      }
+
+      if (slot.state == SlotState::kFree && !pending_.empty()) {
+        slot.request = std::move(pending_.front());
+        pending_.pop_front();
+        slot.state = SlotState::kWriting;
+        jobs_.push_back(slotIdx);
+        jobAvailable_.notify_one();
+      }
+    }
+  }
+
+  // Requests not issued yet
+  [[nodiscard]] auto GetPendingCount() const -> std::size_t {
+    std::scoped_lock const lock{mutex_};
+    auto count = pending_.size();
+
+    for (auto const& slot : slots_) {
+      count += slot.state == SlotState::kWriting || slot.state == SlotState::kWritten;
+    }
+
+    return count;
+  }
+
+  // Bytes issued since the last call
+  [[nodiscard]] auto ConsumeUploadedSize() -> GLsizeiptr {
+    std::scoped_lock const lock{mutex_};
+    return std::exchange(uploadedSize_, 0);
+  }
+
+private:
+  enum class SlotState {
+    kFree,
+    kWriting,
+    kWritten,
+    kInFlight
+  };
+
+  struct Request {
+    TextureRegion region;
+    GLsizeiptr size;
+    FillFunction fill;
+  };
+
+  struct Slot {
+    SlotState state{SlotState::kFree};
+    Request request{};
+    GLsync fence{nullptr};
+  };
+
+  [[nodiscard]] static auto IsSignaled(GLsync const fence) -> bool {
+    auto const status = glClientWaitSync(fence, 0, 0);
+    return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+  }
+
+  static auto IssueUpload(TextureRegion const& region, void const* const offset) -> void {
+    GLint target;
+    glGetTextureParameteriv(region.texture, GL_TEXTURE_TARGET, &target);
+
+    if (target == GL_TEXTURE_1D) {
+      glTextureSubImage1D(region.texture, region.level, region.x, region.width, region.format, region.type, offset);
+    } else {
+      glTextureSubImage2D(region.texture, region.level, region.x, region.y, region.width, region.height, region.format,
+                          region.type, offset);
+    }
+  }
+
+  auto RunWorker() -> void {
+    std::unique_lock lock{mutex_};
+
+    while (true) {
+      jobAvailable_.wait(lock, [this] {
+        return stopping_ || !jobs_.empty();
+      });
+
+      if (stopping_) {
+        return;
+      }
+
+      auto const slotIdx = jobs_.front();
+      jobs_.pop_front();
+      auto& slot = slots_[slotIdx];
+
+      // Only this worker touches the slot until it is marked written
+      lock.unlock();
+      slot.request.fill(std::span{mapped_ + slotIdx * slotSize_, static_cast<std::size_t>(slot.request.size)});
+      lock.lock();
+
+      slot.state = SlotState::kWritten;
+    }
+  }
+
+  GLuint buffer_{0};
+  std::byte* mapped_{nullptr};
+  GLsizeiptr slotSize_;
+  std::vector<Slot> slots_;
+  std::deque<Request> pending_;
+  GLsizeiptr uploadedSize_{0};
+
+  mutable std::mutex mutex_;
+  std::condition_variable jobAvailable_;
+  std::deque<std::size_t> jobs_;
+  bool stopping_{false};
+  std::vector<std::thread> workers_;
+};
+
+// Reads texels back through a ring of slots in a persistently mapped pixel pack
+// buffer. Every transfer is followed by a fence, and its consumer is called
+// from a later Pump once the fence passed, usually a few frames later. Reads
+// that find every slot busy are dropped, so readbacks never block the render
+// thread on the driver either.
+class PixelReadbackStream {
+public:
+  // Receives the tightly packed texels on the render thread
+  using ConsumeFunction = std::function<void(std::span<std::byte const>)>;
+
+  PixelReadbackStream(GLsizeiptr const slotSize, std::size_t const slotCount) :
+    slotSize_{slotSize}, slots_(slotCount) {
+    GLbitfield constexpr mapFlags{GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT};
+
+    glCreateBuffers(1, &buffer_);
+    glNamedBufferStorage(buffer_, slotSize_ * static_cast<GLsizeiptr>(slotCount), nullptr,
+                         mapFlags | GL_CLIENT_STORAGE_BIT);
+    mapped_ = static_cast<std::byte const*>(glMapNamedBufferRange(buffer_, 0,
+                                                                  slotSize_ * static_cast<GLsizeiptr>(slotCount),
+                                                                  mapFlags));
+  }
+
+  PixelReadbackStream(PixelReadbackStream const& other) = delete;
+  PixelReadbackStream(PixelReadbackStream&& other) = delete;
+
+  ~PixelReadbackStream() {
+    for (auto const& slot : slots_) {
+      if (slot.fence) {
+        glDeleteSync(slot.fence);
+      }
+    }
+
+    glUnmapNamedBuffer(buffer_);
+    glDeleteBuffers(1, &buffer_);
+  }
+
+  auto operator=(PixelReadbackStream const& other) -> void = delete;
+  auto operator=(PixelReadbackStream&& other) -> void = delete;
+
+  // The size must fit into a slot. Returns false if the read was dropped
+  // because every slot is still in use.
+  auto Read(TextureRegion const& region, GLsizeiptr const size, ConsumeFunction consume) -> bool {
+    for (std::size_t slotIdx{0}; slotIdx < slots_.size(); slotIdx++) {
+      auto& slot = slots_[slotIdx];
+
+      if (slot.fence) {
+        continue;
+      }
+
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer_);
+      glGetTextureSubImage(region.texture, region.level, region.x, region.y, 0, region.width, region.height, 1,
+                           region.format, region.type, static_cast<GLsizei>(size),
+                           reinterpret_cast<void*>(slotIdx * slotSize_));
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+      slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      slot.size = size;
+      slot.consume = std::move(consume);
+      return true;
+    }
+
+    droppedCount_ += 1;
+    return false;
+  }
+
+  // Hands the finished reads to their consumers
+  auto Pump() -> void {
+    for (std::size_t slotIdx{0}; slotIdx < slots_.size(); slotIdx++) {
+      auto& slot = slots_[slotIdx];
+
+      if (!slot.fence) {
+        continue;
+      }
+
+      if (auto const status = glClientWaitSync(slot.fence, 0, 0);
+        status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+        continue;
+      }
+
+      glDeleteSync(slot.fence);
+      slot.fence = nullptr;
+      std::exchange(slot.consume, {})(std::span{mapped_ + slotIdx * slotSize_, static_cast<std::size_t>(slot.size)});
+    }
+  }
+
+  // Reads dropped since the last call
+  [[nodiscard]] auto ConsumeDroppedCount() -> std::size_t {
+    return std::exchange(droppedCount_, 0);
+  }
+
+private:
+  struct Slot {
+    GLsync fence{nullptr};
+    GLsizeiptr size{0};
+    ConsumeFunction consume;
+  };
+
+  GLuint buffer_{0};
+  std::byte const* mapped_{nullptr};
+  GLsizeiptr slotSize_;
+  std::vector<Slot> slots_;
+  std::size_t droppedCount_{0};
+};
+
+// Writes read back RGB8 images to PPM files on a worker thread, so the render
+// thread only copies the texels out of the readback slot. Images still queued
+// on destruction are written before it returns.
+class PpmWriter {
+public:
+  PpmWriter() :
+    worker_{[this] {
+      RunWorker();
+    }} {}
+
+  PpmWriter(PpmWriter const& other) = delete;
+  PpmWriter(PpmWriter&& other) = delete;
+
+  ~PpmWriter() {
+    {
+      std::scoped_lock const lock{mutex_};
+      stopping_ = true;
+    }
+
+    jobAvailable_.notify_all();
+    worker_.join();
+  }
+
+  auto operator=(PpmWriter const& other) -> void = delete;
+  auto operator=(PpmWriter&& other) -> void = delete;
+
+  // Texels are tightly packed with the rows stored bottom up, as GL returns them
+  auto Write(std::filesystem::path path, GLsizei const width, GLsizei const height,
+             std::span<std::byte const> const texels) -> void {
+    {
+      std::scoped_lock const lock{mutex_};
+      jobs_.push_back(Job{std::move(path), width, height, {texels.begin(), texels.end()}});
+    }
+
+    jobAvailable_.notify_one();
+  }
+
+  // Images not written yet
+  [[nodiscard]] auto GetPendingCount() const -> std::size_t {
+    std::scoped_lock const lock{mutex_};
+    return jobs_.size() + writing_;
+  }
+
+private:
+  struct Job {
+    std::filesystem::path path;
+    GLsizei width;
+    GLsizei height;
+    std::vector<std::byte> texels;
+  };
+
+  auto RunWorker() -> void {
+    std::unique_lock lock{mutex_};
+
+    while (true) {
+      jobAvailable_.wait(lock, [this] {
+        return stopping_ || !jobs_.empty();
+      });
+
+      if (jobs_.empty()) {
+        return;
+      }
+
+      auto const job = std::move(jobs_.front());
+      jobs_.pop_front();
+      writing_ = true;
+
+      lock.unlock();
+
+      std::ofstream file{job.path, std::ios::binary};
+      file << "P6\n" << job.width << ' ' << job.height << "\n255\n";
+
+      for (auto row = job.height - 1; row >= 0; row--) {
+        file.write(reinterpret_cast<char const*>(job.texels.data()) + row * job.width * 3, job.width * 3);
+      }
+
+      lock.lock();
+      writing_ = false;
+    }
+  }
+
+  mutable std::mutex mutex_;
+  std::condition_variable jobAvailable_;
+  std::deque<Job> jobs_;
+  bool writing_{false};
+  bool stopping_{false};
+  // Started last, once the members it uses are initialized
+  std::thread worker_;
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+// On disk cache of linked program binaries. Binaries are only valid for the
+// driver that produced them, so the key covers the renderer and version
+// strings besides the shader sources. Loaded binaries the driver rejects are
+// removed and the caller compiles from source instead.
+class ProgramBinaryCache {
+public:
+  explicit ProgramBinaryCache(std::filesystem::path dir) :
+    dir_{std::move(dir)} {
+    GLint formatCount;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    enabled_ = formatCount > 0;
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+    enabled_ = enabled_ && !ec;
+
+    hashSeed_ = Hash(reinterpret_cast<char const*>(glGetString(GL_RENDERER)), fnvOffsetBasis);
+    hashSeed_ = Hash(reinterpret_cast<char const*>(glGetString(GL_VERSION)), hashSeed_);
+  }
+
+  // Chain calls with the stage types and sources of a program, starting from
+  // GetKeySeed
+  [[nodiscard]] static auto HashStage(GLenum const type, std::string_view const src,
+                                      std::uint64_t const hash) -> std::uint64_t {
+    return Hash(src, Hash(std::string_view{reinterpret_cast<char const*>(&type), sizeof type}, hash));
+  }
+
+  [[nodiscard]] auto GetKeySeed() const -> std::uint64_t {
+    return hashSeed_;
+  }
+
+  // Returns 0 if there is no valid binary for the key
+  [[nodiscard]] auto Load(std::uint64_t const key) const -> GLuint {
+    if (!enabled_) {
+      return 0;
+    }
+
+    std::ifstream file{GetPath(key), std::ios::binary};
+
+    if (!file) {
+      return 0;
+    }
+
+    // Truncated files from interrupted writes are misses
+    GLenum format;
+
+    if (!file.read(reinterpret_cast<char*>(&format), sizeof format)) {
+      file.close();
+      Remove(key);
+      return 0;
+    }
+
+    std::vector<char> const binary{std::istreambuf_iterator{file}, std::istreambuf_iterator<char>{}};
+    file.close();
+
+    if (binary.empty()) {
+      Remove(key);
+      return 0;
+    }
+
+    auto const program = glCreateProgram();
+    glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+
+    // Driver updates invalidate binaries without changing the key in rare cases
+    GLint result;
+    glGetProgramiv(program, GL_LINK_STATUS, &result);
+
+    if (result != GL_TRUE) {
+      glDeleteProgram(program);
+      Remove(key);
+      return 0;
+    }
+
+    return program;
+  }
+
+  // The program must have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+  auto Store(std::uint64_t const key, GLuint const program) const -> void {
+    if (!enabled_) {
+      return;
+    }
+
+    GLint length;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+    if (length <= 0) {
+      return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    std::ofstream file{GetPath(key), std::ios::binary};
+    file.write(reinterpret_cast<char const*>(&format), sizeof format);
+    file.write(binary.data(), length);
+  }
+
+private:
+  static std::uint64_t constexpr fnvOffsetBasis{0xcbf29ce484222325};
+  static std::uint64_t constexpr fnvPrime{0x100000001b3};
+
+  // FNV-1a
+  [[nodiscard]] static auto Hash(std::string_view const data, std::uint64_t hash) -> std::uint64_t {
+    for (auto const c : data) {
+      hash = (hash ^ static_cast<unsigned char>(c)) * fnvPrime;
+    }
+
+    return hash;
+  }
+
+  auto Remove(std::uint64_t const key) const -> void {
+    std::error_code ec;
+    std::filesystem::remove(GetPath(key), ec);
+  }
+
+  [[nodiscard]] auto GetPath(std::uint64_t const key) const -> std::filesystem::path {
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+    return dir_ / name.str();
+  }
+
+  std::filesystem::path dir_;
+  std::uint64_t hashSeed_;
+  bool enabled_;
+};
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef PROGRAM_MANAGER_H
+#define PROGRAM_MANAGER_H
+
+#include <glad/glad.h>
+
+#include "ProgramCache.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <span>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct ShaderStage {
+  GLenum type;
+  std::filesystem::path srcPath;
+};
+
+// Builds programs alongside the rest of the startup and the frame loop. All
+// compiles and links are issued up front on submission, and only the
+// completion of the link is polled through GL_KHR_parallel_shader_compile, so
+// the driver can work on them on its own threads. The compile status is only
+// checked once a link failed. Until a program is ready, its fallback is handed
+// out. Without the extension the status queries block and programs build
+// serially.
+class ProgramManager {
+public:
+  using Handle = std::size_t;
+
+  static Handle constexpr noFallback{std::numeric_limits<Handle>::max()};
+
+  ProgramManager(ProgramBinaryCache const& cache, std::filesystem::path srcDir) :
+    cache_{cache}, srcDir_{std::move(srcDir)}, parallelCompileSupported_{GLAD_GL_KHR_parallel_shader_compile != 0} {
+    if (parallelCompileSupported_) {
+      // Lets the driver pick the number of compiler threads
+      glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    }
+  }
+
+  ProgramManager(ProgramManager const& other) = delete;
+  ProgramManager(ProgramManager&& other) = delete;
+
+  ~ProgramManager() {
+    for (auto const& entry : entries_) {
+      for (auto const shader : entry.shaders) {
+        glDeleteShader(shader);
+      }
+
+      if (entry.program) {
+        glDeleteProgram(entry.program);
+      }
+    }
+  }
+
+  auto operator=(ProgramManager const& other) -> void = delete;
+  auto operator=(ProgramManager&& other) -> void = delete;
+
+  // Programs in the binary cache are ready right away, the others start compiling
+  [[nodiscard]] auto Submit(std::span<ShaderStage const> const stages, Handle const fallback = noFallback) -> Handle {
+    auto& entry = entries_.emplace_back();
+    entry.fallback = fallback;
+
+    std::vector<std::string> sources;
+    auto key = cache_.GetKeySeed();
+
+    for (auto const& [type, srcPath] : stages) {
+      auto const& src = sources.emplace_back(LoadFileText(srcDir_ / srcPath));
+      key = ProgramBinaryCache::HashStage(type, src, key);
+      entry.srcPaths.push_back(srcPath);
+    }
+
+    entry.key = key;
+
+    if (auto const program = cache_.Load(key)) {
+      entry.program = program;
+      entry.state = State::kReady;
+      cachedCount_ += 1;
+      return entries_.size() - 1;
+    }
+
+    entry.program = glCreateProgram();
+
+    for (std::size_t i{0}; i < stages.size(); i++) {
+      auto const srcP = sources[i].data();
+      auto const shader = glCreateShader(stages[i].type);
+      glShaderSource(shader, 1, &srcP, nullptr);
+      glCompileShader(shader);
+      glAttachShader(entry.program, shader);
+      entry.shaders.push_back(shader);
+    }
+
+    // Linking waits for the compiles on the driver's side, not here
+    glProgramParameteri(entry.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(entry.program);
+    entry.state = State::kLinking;
+    return entries_.size() - 1;
+  }
+
+  // Publishes the programs that finished building without waiting for the
+  // others, returns the number of programs still building. Failed programs
+  // are not counted, see GetFailedCount.
+  auto Poll() -> std::size_t {
+    std::size_t pendingCount{0};
+
+    for (auto& entry : entries_) {
+      pendingCount += Advance(entry, false);
+    }
+
+    return pendingCount;
+  }
+
+  // Blocks until the program finished building
+  auto Wait(Handle const handle) -> void {
+    while (Advance(entries_[handle], true)) {}
+  }
+
+  // The program if it is ready, otherwise its fallback or 0 if there is none
+  [[nodiscard]] auto GetProgram(Handle const handle) const -> GLuint {
+    auto const& entry = entries_[handle];
+
+    if (entry.state == State::kReady) {
+      return entry.program;
+    }
+
+    return entry.fallback == noFallback ? 0 : GetProgram(entry.fallback);
+  }
+
+  [[nodiscard]] auto IsReady(Handle const handle) const -> bool {
+    return entries_[handle].state == State::kReady;
+  }
+
+  [[nodiscard]] auto IsFailed(Handle const handle) const -> bool {
+    return entries_[handle].state == State::kFailed;
+  }
+
+  [[nodiscard]] auto GetFailedCount() const -> std::size_t {
+    return static_cast<std::size_t>(std::ranges::count(entries_, State::kFailed, &Entry::state));
+  }
+
+  [[nodiscard]] auto GetProgramCount() const -> std::size_t {
+    return entries_.size();
+  }
+
+  [[nodiscard]] auto GetCachedCount() const -> std::size_t {
+    return cachedCount_;
+  }
+
+  [[nodiscard]] auto IsParallelCompileSupported() const -> bool {
+    return parallelCompileSupported_;
+  }
+
+private:
+  enum class State {
+    kLinking,
+    kReady,
+    kFailed
+  };
+
+  struct Entry {
+    std::vector<std::filesystem::path> srcPaths;
+    std::uint64_t key{0};
+    std::vector<GLuint> shaders;
+    GLuint program{0};
+    State state{State::kLinking};
+    Handle fallback{noFallback};
+  };
+
+  [[nodiscard]] static auto LoadFileText(std::filesystem::path const& srcPathAbs) -> std::string {
+    std::ifstream const input{srcPathAbs};
+    std::stringstream ss;
+    ss << input.rdbuf();
+    return ss.str();
+  }
+
+  [[nodiscard]] static auto GetShaderInfoLog(GLuint const shader) -> std::string {
+    GLint logLength;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+    std::string infoLog(logLength, ' ');
+    glGetShaderInfoLog(shader, static_cast<GLsizei>(infoLog.size()), &logLength, infoLog.data());
+    return infoLog;
+  }
+
+  [[nodiscard]] auto IsProgramComplete(GLuint const program) const -> bool {
+    if (!parallelCompileSupported_) {
+      return true;
+    }
+
+    GLint complete;
+    glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete);
+    return complete == GL_TRUE;
+  }
+
+  // Moves the entry on as far as the finished work allows, returns whether it
+  // is still building
+  auto Advance(Entry& entry, bool const block) -> bool {
+    if (entry.state == State::kLinking) {
+      if (!block && !IsProgramComplete(entry.program)) {
+        return true;
+      }
+
+      GLint result;
+      glGetProgramiv(entry.program, GL_LINK_STATUS, &result);
+      if (result != GL_TRUE) {
+        // A stage that failed to compile fails the link too
+        for (std::size_t i{0}; i < entry.shaders.size(); i++) {
+          glGetShaderiv(entry.shaders[i], GL_COMPILE_STATUS, &result);
+          if (result != GL_TRUE) {
+            std::cerr << "Failed to compile shader " << entry.srcPaths[i] << ": " << GetShaderInfoLog(entry.shaders[i])
+              << "\n\n";
+            Fail(entry);
+            return false;
+          }
+        }
+
+        GLint logLngth;
+        glGetProgramiv(entry.program, GL_INFO_LOG_LENGTH, &logLngth);
+        std::string infoLog(logLngth, ' ');
+        glGetProgramInfoLog(entry.program, static_cast<GLsizei>(infoLog.size()), &logLngth, infoLog.data());
+        std::cerr << "Failed to link shader program: " << infoLog << "\n\n";
+        Fail(entry);
+        return false;
+      }
+
+      for (auto const shader : entry.shaders) {
+        glDeleteShader(shader);
+      }
+
+      entry.shaders.clear();
+      cache_.Store(entry.key, entry.program);
+      entry.state = State::kReady;
+    }
+
+    return false;
+  }
+
+  // Failed programs keep handing out their fallback
+  static auto Fail(Entry& entry) -> void {
+    for (auto const shader : entry.shaders) {
+      glDeleteShader(shader);
+    }
+
+    entry.shaders.clear();
+
+    if (entry.program) {
+      glDeleteProgram(entry.program);
+      entry.program = 0;
+    }
+
+    entry.state = State::kFailed;
+  }
+
+  ProgramBinaryCache const& cache_;
+  std::filesystem::path srcDir_;
+  bool parallelCompileSupported_;
+  std::vector<Entry> entries_;
+  std::size_t cachedCount_{0};
+};
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// Persistently and coherently mapped buffer for data written every frame. It is
+// split into one region per frame in flight and every region is guarded by a
+// fence, so a region is only written again once the GPU finished reading what
+// was written into it the last time around. Allocations are bound through
+// offsets into the single buffer object.
+class PersistentRingBuffer {
+public:
+  struct Allocation {
+    std::byte* ptr;
+    GLintptr offset;
+    GLsizeiptr size;
+  };
+
+  PersistentRingBuffer(GLsizeiptr const regionSize, GLsizei const regionCount) :
+    fences_(regionCount, nullptr) {
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment_);
+
+    // Keeps the start of every region aligned for any kind of binding
+    regionSize_ = AlignUp(regionSize, uniformAlignment_);
+
+    GLbitfield constexpr mapFlags{GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT};
+
+    glCreateBuffers(1, &buffer_);
+    glNamedBufferStorage(buffer_, regionSize_ * regionCount, nullptr, mapFlags);
+    mapped_ = static_cast<std::byte*>(glMapNamedBufferRange(buffer_, 0, regionSize_ * regionCount, mapFlags));
+  }
+
+  PersistentRingBuffer(PersistentRingBuffer const& other) = delete;
+  PersistentRingBuffer(PersistentRingBuffer&& other) = delete;
+
+  ~PersistentRingBuffer() {
+    for (auto const fence : fences_) {
+      if (fence) {
+        glDeleteSync(fence);
+      }
+    }
+
+    glUnmapNamedBuffer(buffer_);
+    glDeleteBuffers(1, &buffer_);
+  }
+
+  auto operator=(PersistentRingBuffer const& other) -> void = delete;
+  auto operator=(PersistentRingBuffer&& other) -> void = delete;
+
+  // Moves on to the next region, waiting for the GPU if it still reads from it
+  auto BeginFrame() -> void {
+    regionIdx_ = (regionIdx_ + 1) % static_cast<GLsizei>(fences_.size());
+    regionOffset_ = 0;
+
+    auto& fence = fences_[regionIdx_];
+
+    if (!fence) {
+      return;
+    }
+
+    auto const waitStart = std::chrono::steady_clock::now();
+
+    // The first wait flushes so the fence is guaranteed to reach the GPU
+    for (GLbitfield flags{GL_SYNC_FLUSH_COMMANDS_BIT};; flags = 0) {
+      auto const status = glClientWaitSync(fence, flags, 1'000'000'000);
+
+      if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+        break;
+      }
+
+      if (status == GL_WAIT_FAILED) {
+        throw std::runtime_error{"Failed to wait for ring buffer fence."};
+      }
+    }
+
+    waitSeconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+
+  // Must follow the last command reading from the current region
+  auto EndFrame() -> void {
+    fences_[regionIdx_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+
+  // Empty if the current region has no room left for the allocation
+  [[nodiscard]] auto TryAllocate(GLsizeiptr const size, GLsizeiptr const alignment) -> std::optional<Allocation> {
+    auto const alignedOffset = AlignUp(regionOffset_, alignment);
+
+    if (alignedOffset + size > regionSize_) {
+      return std::nullopt;
+    }
+
+    regionOffset_ = alignedOffset + size;
+
+    auto const offset = regionIdx_ * regionSize_ + alignedOffset;
+    return Allocation{mapped_ + offset, offset, size};
+  }
+
+  [[nodiscard]] auto Allocate(GLsizeiptr const size, GLsizeiptr const alignment) -> Allocation {
+    if (auto const allocation = TryAllocate(size, alignment)) {
+      return *allocation;
+    }
+
+    throw std::runtime_error{"Ring buffer region is out of space."};
+  }
+
+  template<typename T, std::size_t Extent> requires std::is_trivially_copyable_v<T>
+  auto Write(std::span<T const, Extent> const data, GLsizeiptr const alignment) -> Allocation {
+    auto const allocation = Allocate(static_cast<GLsizeiptr>(data.size_bytes()), alignment);
+    std::memcpy(allocation.ptr, data.data(), data.size_bytes());
+    return allocation;
+  }
+
+  template<typename T> requires std::is_trivially_copyable_v<T>
+  auto WriteUniform(T const& value) -> Allocation {
+    return Write(std::span<T const, 1>{&value, 1}, uniformAlignment_);
+  }
+
+  [[nodiscard]] auto GetBuffer() const -> GLuint {
+    return buffer_;
+  }
+
+  [[nodiscard]] auto GetUniformAlignment() const -> GLint {
+    return uniformAlignment_;
+  }
+
+  // Time spent waiting for the GPU to release regions since the last call
+  [[nodiscard]] auto ConsumeWaitSeconds() -> double {
+    auto const seconds = waitSeconds_;
+    waitSeconds_ = 0;
+    return seconds;
+  }
+
+private:
+  [[nodiscard]] static auto AlignUp(GLsizeiptr const value, GLsizeiptr const alignment) -> GLsizeiptr {
+    return (value + alignment - 1) / alignment * alignment;
+  }
+
+  GLuint buffer_{0};
+  std::byte* mapped_{nullptr};
+  GLint uniformAlignment_{1};
+  GLsizeiptr regionSize_{0};
+  GLsizei regionIdx_{0};
+  GLsizeiptr regionOffset_{0};
+  std::vector<GLsync> fences_;
+  double waitSeconds_{0};
+};
+
+#endif
@@ -1,12 +1,47 @@
-#define GLFW_INCLUDE_NONE
+/* OpenGL test project
+ * Define INSTANCE_TRANSFORM_BENCHMARK to time the composition of instance transforms for 1k to 1M instances at startup.
+ * Define HEADLESS to create the context through EGL without a window and render a fixed number of frames into the
+ * offscreen framebuffer only. It prefers the Mesa surfaceless platform and falls back to a pbuffer on the default
+ * display, so it runs without a display server, for example on llvmpipe. The context falls back to 4.5 when 4.6 is not
+ * available. The CMake build defines it by default on Linux.
+ */
+
+// Uncomment this if you want to benchmark the instance transform composition
+// #define INSTANCE_TRANSFORM_BENCHMARK
+
+// Uncomment this if you want to run without a window
+// #define HEADLESS
+
 #include <glad/glad.h>
+
+#ifdef HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#else
+#define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
+#endif
 
+#include "DrawQueue.h"
+#include "GpuProfiler.h"
+#include "InstanceTransforms.h"
+#include "PixelTransfer.h"
+#include "ProgramCache.h"
+#include "ProgramManager.h"
+#include "RingBuffer.h"
+#include "TextureResidency.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
-#include <sstream>
-#include <string>
+#include <optional>
+#include <random>
+#include <span>
+#include <string_view>
+#include <vector>
 
 auto constexpr WIDTH = 800;
 auto constexpr HEIGHT = 600;
@@ -14,12 +49,148 @@ GLfloat constexpr CLEAR_COLOR[]{0.f, 0.f, 0.f, 1.f};
 GLfloat constexpr CLEAR_DEPTH{1.f};
 GLint constexpr CLEAR_STENCIL{0};
 GLfloat constexpr GAMMA{2.2f};
+// Per frame data is written into a ring of this many regions so the CPU can run ahead of the GPU
+GLsizei constexpr FRAMES_IN_FLIGHT{3};
+GLsizeiptr constexpr RING_BUFFER_REGION_SIZE{64 * 1024};
+// Instances scattered around the hand placed ones, partly outside the view, to give the culling pass work
+GLuint constexpr GENERATED_INSTANCE_COUNT{10'000};
+GLuint constexpr CULLING_GROUP_SIZE{64};
+// Every generated instance picks one of this many materials, each with its own texture
+GLuint constexpr MATERIAL_COUNT{1024};
+GLsizei constexpr MATERIAL_TEXTURE_WIDTH{256};
+// Bytes of material textures kept resident, visible materials beyond it are drawn with the fallback texture
+GLsizeiptr constexpr TEXTURE_RESIDENCY_BUDGET{768 * 1024};
+// Texture uploads are written by worker threads into slots of a ring of pixel unpack buffers
+GLsizeiptr constexpr PIXEL_UPLOAD_SLOT_SIZE{16 * 1024};
+std::size_t constexpr PIXEL_UPLOAD_SLOT_COUNT{64};
+std::size_t constexpr PIXEL_UPLOAD_WORKER_COUNT{2};
+// The rendered frame is read back through a pixel pack buffer and written to the capture file this often
+auto constexpr CAPTURE_INTERVAL = 300;
+// Frames whose GPU scopes are written to the trace file, later frames only feed the printed statistics
+std::size_t constexpr GPU_TRACE_FRAME_LIMIT{1000};
+// Angular speed of the spinning instances in radians per second
+GLfloat constexpr SPIN_SPEED{1.f};
+#ifdef HEADLESS
+// Frames rendered before a headless run exits
+auto constexpr HEADLESS_FRAME_COUNT = 1000;
+#endif
+GLfloat constexpr IDENTITY_MATRIX[]
+{
+  1.0f, 0.0f, 0.0f, 0.0f,
+  0.0f, 1.0f, 0.0f, 0.0f,
+  0.0f, 0.0f, 1.0f, 0.0f,
+  0.0f, 0.0f, 0.0f, 1.0f
+};
 
 std::filesystem::path const shaderSourceDir{"shaders"};
+std::filesystem::path const programCacheDir{"program_cache"};
+std::filesystem::path const gpuTracePath{"gpu_trace.json"};
+std::filesystem::path const capturePath{"capture.ppm"};
+
+#ifdef HEADLESS
+struct HeadlessContext {
+  EGLDisplay display;
+  EGLSurface surface;
+  EGLContext context;
+};
+
+auto DestroyHeadlessContext(HeadlessContext const& headless) -> void {
+  eglMakeCurrent(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+  if (headless.context != EGL_NO_CONTEXT) {
+    eglDestroyContext(headless.display, headless.context);
+  }
+
+  if (headless.surface != EGL_NO_SURFACE) {
+    eglDestroySurface(headless.display, headless.surface);
+  }
+
+  eglTerminate(headless.display);
+}
+
+// Nothing is presented, so the surface only has to make the context current
+auto CreateHeadlessContext() -> std::optional<HeadlessContext> {
+  std::string_view const clientExtensions{eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS)};
+  auto const getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+    eglGetProcAddress("eglGetPlatformDisplayEXT"));
+  auto const surfaceless = getPlatformDisplay && clientExtensions.find("EGL_MESA_platform_surfaceless") !=
+    std::string_view::npos;
+
+  HeadlessContext headless{
+    surfaceless
+      ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr)
+      : eglGetDisplay(EGL_DEFAULT_DISPLAY),
+    EGL_NO_SURFACE, EGL_NO_CONTEXT
+  };
+
+  EGLint majorVersion, minorVersion;
+
+  if (headless.display == EGL_NO_DISPLAY || !eglInitialize(headless.display, &majorVersion, &minorVersion)) {
+    std::cerr << "Failed to initialize EGL, error: 0x" << std::hex << eglGetError() << std::dec << ".\n";
+    return std::nullopt;
+  }
+
+  std::cout << "EGL " << majorVersion << '.' << minorVersion << " on the " << (surfaceless
+                                                                              ? "surfaceless"
+                                                                              : "default") << " platform\n\n";
+
+  EGLint const configAttribs[]
+  {
+    EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_NONE
+  };
+
+  EGLConfig config;
+  EGLint configCount;
+
+  if (!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(headless.display, configAttribs, &config, 1, &configCount) ||
+      configCount == 0) {
+    std::cerr << "Failed to find an EGL config for desktop OpenGL.\n";
+    DestroyHeadlessContext(headless);
+    return std::nullopt;
+  }
+
+  if (!surfaceless) {
+    EGLint constexpr pbufferAttribs[]{EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+    headless.surface = eglCreatePbufferSurface(headless.display, config, pbufferAttribs);
+  }
 
+  // Software rasterizers like llvmpipe stop at 4.5, where the 4.6 features used are available as extensions
+  for (auto const minorVersion : {6, 5}) {
+    EGLint const contextAttribs[]
+    {
+      EGL_CONTEXT_MAJOR_VERSION, 4,
+      EGL_CONTEXT_MINOR_VERSION, minorVersion,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+#ifndef NDEBUG
+      EGL_CONTEXT_OPENGL_DEBUG, EGL_TRUE,
+#endif
+      EGL_NONE
+    };
+
+    headless.context = eglCreateContext(headless.display, config, EGL_NO_CONTEXT, contextAttribs);
+
+    if (headless.context != EGL_NO_CONTEXT) {
+      break;
+    }
+  }
+
+  if (headless.context == EGL_NO_CONTEXT || (!surfaceless && headless.surface == EGL_NO_SURFACE) ||
+      !eglMakeCurrent(headless.display, headless.surface, headless.surface, headless.context)) {
+    std::cerr << "Failed to create a headless OpenGL 4.5 or 4.6 context, error: 0x" << std::hex << eglGetError() <<
+      std::dec << ".\n";
+    DestroyHeadlessContext(headless);
+    return std::nullopt;
+  }
+
+  return headless;
+}
+#else
 auto GlfwErrorCallback(int const errorCode, char const* const desc) -> void {
   std::cerr << "GLFW error, code: " << errorCode << ", description: " << desc << "\n\n";
 }
+#endif
 
 auto APIENTRY GlDebugMessageCallback(GLenum const source, GLenum const type, GLuint const id, GLenum const severity,
                                      GLsizei const length,
@@ -82,15 +253,102 @@ auto PrintFramebufferAttachmentInfo(GLuint const framebuffer, GLenum const attac
   std::cout << '\n';
 }
 
-[[nodiscard]] auto LoadFileText(std::filesystem::path const& srcPathAbs) -> std::string {
-  std::ifstream const input{srcPathAbs};
-  std::stringstream ss;
-  ss << input.rdbuf();
-  return ss.str();
+// Copies the ranges of instances whose transforms changed since the last call into the transform buffer
+auto StreamDirtyTransforms(InstanceTransforms& transforms, PersistentRingBuffer& ringBuffer,
+                           GLuint const transformBuf) -> GLsizeiptr {
+  auto const allTransforms = transforms.GetTransforms();
+  GLsizeiptr streamedSize{0};
+
+  for (auto const [first, count] : transforms.Update()) {
+    auto const data = allTransforms.subspan(first, count);
+    auto const size = static_cast<GLsizeiptr>(data.size_bytes());
+    auto const dstOffset = static_cast<GLintptr>(first * sizeof(PackedTransform));
+
+    // Ranges not fitting into the current region anymore are handed to the driver instead
+    if (auto const alloc = ringBuffer.TryAllocate(size, 4 * sizeof(GLfloat))) {
+      std::memcpy(alloc->ptr, data.data(), data.size_bytes());
+      glCopyNamedBufferSubData(ringBuffer.GetBuffer(), transformBuf, alloc->offset, dstOffset, size);
+    } else {
+      glNamedBufferSubData(transformBuf, dstOffset, size, data.data());
+    }
+
+    streamedSize += size;
+  }
+
+  return streamedSize;
 }
 
+#ifdef INSTANCE_TRANSFORM_BENCHMARK
+auto RunInstanceTransformBenchmark() -> void {
+#ifdef __AVX2__
+  std::cout << "Instance transform composition using AVX2:\n";
+#else
+  std::cout << "Instance transform composition using scalar code:\n";
+#endif
+
+  std::mt19937 rng{0};
+  std::uniform_real_distribution dist{-1.f, 1.f};
+
+  for (std::size_t const count : {1'000, 10'000, 100'000, 1'000'000}) {
+    InstanceTransforms transforms{count};
+
+    for (std::size_t i{0}; i < count; i++) {
+      auto const halfAngle = dist(rng);
+      transforms.SetPosition(i, dist(rng), dist(rng), dist(rng));
+      transforms.SetRotation(i, 0, 0, std::sin(halfAngle), std::cos(halfAngle));
+      transforms.SetScale(i, 1, 1, 1);
+    }
+
+    auto constexpr iterationCount = 10;
+    auto fullSeconds = 0.0;
+    auto partialSeconds = 0.0;
+    std::size_t partialRangeCount{0};
+
+    for (auto iteration = 0; iteration < iterationCount; iteration++) {
+      transforms.Invalidate();
+      auto const fullStart = std::chrono::steady_clock::now();
+      transforms.Update();
+      fullSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - fullStart).count();
+
+      // Every hundredth instance moves, so the dirty ranges are as fragmented as they get at 1%
+      for (std::size_t i{0}; i < count; i += 100) {
+        transforms.SetPosition(i, dist(rng), dist(rng), dist(rng));
+      }
+
+      auto const partialStart = std::chrono::steady_clock::now();
+      partialRangeCount = transforms.Update().size();
+      partialSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - partialStart).count();
+    }
+
+    std::cout << '\t' << count << " instances: full update " << fullSeconds * 1000.0 / iterationCount << " ms (" <<
+      fullSeconds * 1e9 / (iterationCount * count) << " ns/instance), 1% dirty update " << partialSeconds * 1000.0 /
+      iterationCount << " ms in " << partialRangeCount << " ranges, " << count * sizeof(PackedTransform) / 1024 <<
+      " KiB packed instead of " << count * 16 * sizeof(GLfloat) / 1024 << " KiB\n";
+  }
+
+  std::cout << '\n';
+}
+#endif
+
 
 auto main() -> int {
+#ifdef INSTANCE_TRANSFORM_BENCHMARK
+  RunInstanceTransformBenchmark();
+#endif
+
+#ifdef HEADLESS
+  auto const headless = CreateHeadlessContext();
+
+  if (!headless) {
+    return -1;
+  }
+
+  if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(eglGetProcAddress))) {
+    std::cerr << "Failed to init GLAD.\n";
+    DestroyHeadlessContext(*headless);
+    return -1;
+  }
+#else
 #ifndef NDEBUG
   glfwSetErrorCallback(GlfwErrorCallback);
 #endif
@@ -124,6 +382,7 @@ auto main() -> int {
     glfwTerminate();
     return -1;
   }
+#endif
 
 #ifndef NDEBUG
   glEnable(GL_DEBUG_OUTPUT);
@@ -142,9 +401,76 @@ auto main() -> int {
 
   std::cout << "Renderer: " << reinterpret_cast<char const*>(glGetString(GL_RENDERER)) << "\n\n";
 
-  std::cout << "Bindless textures " << (GLAD_GL_ARB_bindless_texture ? "" : "not ") << "supported.\n\n";
+  // The shaders take the draw parameters from ARB_shader_draw_parameters, so they compile on 4.5 contexts too
+  if (!GLAD_GL_ARB_shader_draw_parameters || (!GLAD_GL_VERSION_4_6 && !GLAD_GL_ARB_indirect_parameters)) {
+    std::cerr << "ARB_shader_draw_parameters and either OpenGL 4.6 or ARB_indirect_parameters are required.\n";
+#ifdef HEADLESS
+    DestroyHeadlessContext(*headless);
+#else
+    glfwDestroyWindow(window);
+    glfwTerminate();
+#endif
+    return -1;
+  }
+
+  // The indirect count draw is core in 4.6 and has the same signature as the extension's
+  if (!GLAD_GL_VERSION_4_6) {
+    glad_glMultiDrawElementsIndirectCount = glad_glMultiDrawElementsIndirectCountARB;
+  }
+
+  // Without bindless textures the materials are layers of an array texture that is always resident
+  auto const bindless = GLAD_GL_ARB_bindless_texture != 0;
+  std::cout << "Bindless textures " << (bindless ? "" : "not ") << "supported, materials use " <<
+    (bindless ? "bindless handles" : "a texture array") << ".\n\n";
 
+#ifndef HEADLESS
   PrintFramebufferAttachmentInfo(0, GL_BACK_LEFT);
+#endif
+
+  // Shader setup
+
+  // The programs build while the rest of the resources are set up and the first frames run
+  ProgramBinaryCache const programCache{programCacheDir};
+  std::optional<ProgramManager> programs;
+  programs.emplace(programCache, shaderSourceDir);
+
+  std::cout << "Parallel shader compilation " << (programs->IsParallelCompileSupported() ? "" : "not ") <<
+    "supported.\n\n";
+
+  auto const programSetupStart = std::chrono::steady_clock::now();
+
+  // The fallback only skips the texture fetch and the gamma correction, so it is cheap to build and waited for
+  ShaderStage const fallbackStages[]{{GL_VERTEX_SHADER, "fallback.vert"}, {GL_FRAGMENT_SHADER, "fallback.frag"}};
+  auto const fallbackProgram = programs->Submit(fallbackStages);
+  programs->Wait(fallbackProgram);
+
+  // Every draw uses it until the scene program is ready
+  if (!programs->IsReady(fallbackProgram)) {
+    std::cerr << "Failed to build the fallback program.\n";
+    programs.reset();
+#ifdef HEADLESS
+    DestroyHeadlessContext(*headless);
+#else
+    glfwDestroyWindow(window);
+    glfwTerminate();
+#endif
+    return -1;
+  }
+
+  ShaderStage const sceneStages[]
+  {
+    {GL_VERTEX_SHADER, bindless ? "shader.vert" : "shader_texture_array.vert"},
+    {GL_FRAGMENT_SHADER, "shader.frag"}
+  };
+  auto const sceneProgram = programs->Submit(sceneStages, fallbackProgram);
+
+  ShaderStage const cullStages[]{{GL_COMPUTE_SHADER, "cull_instances.comp"}};
+  auto const cullProgram = programs->Submit(cullStages);
+
+  ShaderStage const buildDrawsStages[]{{GL_COMPUTE_SHADER, "build_draws.comp"}};
+  auto const buildDrawsProgram = programs->Submit(buildDrawsStages);
+
+  auto programsBuilt = false;
 
   // Framebuffer setup
 
@@ -163,6 +489,11 @@ auto main() -> int {
   glNamedFramebufferDrawBuffer(framebuffer, GL_COLOR_ATTACHMENT0);
   glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
 
+#ifdef HEADLESS
+  // The viewport starts out at the size of the surface, which is empty or a single pixel here
+  glViewport(0, 0, WIDTH, HEIGHT);
+#endif
+
   PrintFramebufferAttachmentInfo(framebuffer, GL_COLOR_ATTACHMENT0);
 
   // Draw data setup
@@ -193,32 +524,20 @@ auto main() -> int {
     0, 1, 2, 2, 1, 3
   };
 
-  GLfloat constexpr modelMatrices[]
+  struct PlacedInstance {
+    GLfloat position[2];
+    GLfloat scale;
+    GLuint meshIdx;
+    bool spins;
+  };
+
+  PlacedInstance constexpr placedInstances[]
   {
-    0.5f, 0.0f, 0.0f, 0.0f,
-    0.0f, 0.5f, 0.0f, 0.0f,
-    0.0f, 0.0f, 0.5f, 0.0f,
-    0.0f, 0.0f, 0.0f, 1.0f,
-
-    0.1f, 0.0f, 0.0f, 0.0f,
-    0.0f, 0.1f, 0.0f, 0.0f,
-    0.0f, 0.0f, 0.1f, 0.0f,
-    -0.5f, -0.5f, 0.0f, 1.0f,
-
-    0.1f, 0.0f, 0.0f, 0.0f,
-    0.0f, 0.1f, 0.0f, 0.0f,
-    0.0f, 0.0f, 0.1f, 0.0f,
-    -0.5f, 0.5f, 0.0f, 1.0f,
-
-    0.1f, 0.0f, 0.0f, 0.0f,
-    0.0f, 0.1f, 0.0f, 0.0f,
-    0.0f, 0.0f, 0.1f, 0.0f,
-    0.5f, 0.5f, 0.0f, 1.0f,
-
-    0.1f, 0.0f, 0.0f, 0.0f,
-    0.0f, 0.1f, 0.0f, 0.0f,
-    0.0f, 0.0f, 0.1f, 0.0f,
-    0.5f, -0.5f, 0.0f, 1.0f,
+    PlacedInstance{.position = {0.0f, 0.0f}, .scale = 0.5f, .meshIdx = 0, .spins = false},
+    PlacedInstance{.position = {-0.5f, -0.5f}, .scale = 0.1f, .meshIdx = 1, .spins = true},
+    PlacedInstance{.position = {-0.5f, 0.5f}, .scale = 0.1f, .meshIdx = 1, .spins = true},
+    PlacedInstance{.position = {0.5f, 0.5f}, .scale = 0.1f, .meshIdx = 1, .spins = true},
+    PlacedInstance{.position = {0.5f, -0.5f}, .scale = 0.1f, .meshIdx = 1, .spins = true}
   };
 
   GLuint vertPosBuf;
@@ -233,188 +552,578 @@ auto main() -> int {
   glCreateBuffers(1, &vertIndBuf);
   glNamedBufferStorage(vertIndBuf, sizeof vertexIndices, vertexIndices, 0);
 
-  GLuint modelMatBuf;
-  glCreateBuffers(1, &modelMatBuf);
-  glNamedBufferStorage(modelMatBuf, sizeof modelMatrices, modelMatrices, 0);
+  // Per frame data is streamed through the ring buffer, every frame binds its own ranges of it
+  std::optional<PersistentRingBuffer> ringBuffer;
+  ringBuffer.emplace(RING_BUFFER_REGION_SIZE, FRAMES_IN_FLIGHT);
 
   GLuint vao;
   glCreateVertexArrays(1, &vao);
-  glBindVertexArray(vao);
 
-  glVertexArrayVertexBuffer(vao, 0, vertPosBuf, 0, 2 * sizeof GLfloat);
+  glVertexArrayVertexBuffer(vao, 0, vertPosBuf, 0, 2 * sizeof(GLfloat));
   glVertexArrayAttribFormat(vao, 0, 2, GL_FLOAT, GL_FALSE, 0);
   glVertexArrayAttribBinding(vao, 0, 0);
   glEnableVertexArrayAttrib(vao, 0);
 
-  glVertexArrayVertexBuffer(vao, 1, vertTexIndBuf, 0, sizeof GLint);
+  glVertexArrayVertexBuffer(vao, 1, vertTexIndBuf, 0, sizeof(GLint));
   glVertexArrayAttribIFormat(vao, 1, 1, GL_INT, 0);
   glVertexArrayAttribBinding(vao, 1, 1);
   glEnableVertexArrayAttrib(vao, 1);
 
-  glVertexArrayVertexBuffer(vao, 2, modelMatBuf, 0, 16 * sizeof GLfloat);
-  glVertexArrayBindingDivisor(vao, 2, 1);
-
-  glVertexArrayAttribFormat(vao, 2, 4, GL_FLOAT, GL_FALSE, 0);
-  glVertexArrayAttribBinding(vao, 2, 2);
-  glEnableVertexArrayAttrib(vao, 2);
+  glVertexArrayElementBuffer(vao, vertIndBuf);
 
-  glVertexArrayAttribFormat(vao, 3, 4, GL_FLOAT, GL_FALSE, 4 * sizeof GLfloat);
-  glVertexArrayAttribBinding(vao, 3, 2);
-  glEnableVertexArrayAttrib(vao, 3);
+  // Culling setup
 
-  glVertexArrayAttribFormat(vao, 4, 4, GL_FLOAT, GL_FALSE, 8 * sizeof GLfloat);
-  glVertexArrayAttribBinding(vao, 4, 2);
-  glEnableVertexArrayAttrib(vao, 4);
+  // Instances are read through the visible instance indices written by the culling pass. The world matrices live in a
+  // separate transform buffer that only receives the ranges that changed.
+  struct InstanceData {
+    // Model space center in xyz, radius in w
+    GLfloat boundingSphere[4];
+    // Instances drawn directly by the CPU have no batch and are skipped by the culling pass
+    GLuint batchIdx;
+    GLuint padding[3];
+  };
 
-  glVertexArrayAttribFormat(vao, 5, 4, GL_FLOAT, GL_FALSE, 12 * sizeof GLfloat);
-  glVertexArrayAttribBinding(vao, 5, 2);
-  glEnableVertexArrayAttrib(vao, 5);
+  GLuint constexpr noBatch{0xFFFFFFFF};
 
-  glVertexArrayElementBuffer(vao, vertIndBuf);
+  struct MeshData {
+    GLuint indexCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+  };
 
-  struct DrawElementsIndirectCommand {
-    GLuint count;
-    GLuint primCount;
+  // Every combination of mesh and material is drawn by its own command, so the material is uniform within a draw
+  struct BatchData {
+    GLuint indexCount;
     GLuint firstIndex;
-    GLuint baseVertex;
-    GLuint baseInstance;
+    GLint baseVertex;
+    // Start of the batch's slice of the visible instance buffer
+    GLuint instanceOffset;
+    GLuint materialIdx;
   };
 
-  DrawElementsIndirectCommand constexpr drawIndirectCommands[]
+  MeshData constexpr meshes[]
   {
-    DrawElementsIndirectCommand
-    {
-      .count = 3,
-      .primCount = 1,
-      .firstIndex = 0,
-      .baseVertex = 0,
-      .baseInstance = 0
-    },
-
-    DrawElementsIndirectCommand
-    {
-      .count = 6,
-      .primCount = 4,
-      .firstIndex = 3,
-      .baseVertex = 3,
-      .baseInstance = 1
+    MeshData{.indexCount = 3, .firstIndex = 0, .baseVertex = 0},
+    MeshData{.indexCount = 6, .firstIndex = 3, .baseVertex = 3}
+  };
+
+  GLfloat constexpr meshBoundingSpheres[][4]
+  {
+    {0.0f, 0.0f, 0.0f, 0.7072f},
+    {0.0f, 0.0f, 0.0f, 1.4143f}
+  };
+
+  auto constexpr meshCount = static_cast<GLuint>(std::size(meshes));
+  auto constexpr batchCount = meshCount * MATERIAL_COUNT;
+
+  std::vector<BatchData> batches;
+  batches.reserve(batchCount);
+
+  for (auto const& mesh : meshes) {
+    for (GLuint materialIdx{0}; materialIdx < MATERIAL_COUNT; materialIdx++) {
+      batches.push_back(BatchData{mesh.indexCount, mesh.firstIndex, mesh.baseVertex, 0, materialIdx});
     }
+  }
+
+  std::vector<InstanceData> instances;
+  instances.reserve(std::size(placedInstances) + GENERATED_INSTANCE_COUNT);
+
+  InstanceTransforms transforms{std::size(placedInstances) + GENERATED_INSTANCE_COUNT};
+
+  auto const addInstance = [&](GLfloat const x, GLfloat const y, GLfloat const scale, GLuint const meshIdx,
+                                GLuint const batchIdx) {
+    transforms.SetPosition(instances.size(), x, y, 0);
+    transforms.SetScale(instances.size(), scale, scale, scale);
+
+    auto& instance = instances.emplace_back();
+    std::copy_n(meshBoundingSpheres[meshIdx], 4, instance.boundingSphere);
+    instance.batchIdx = batchIdx;
   };
 
-  GLuint indirectBuf;
-  glCreateBuffers(1, &indirectBuf);
-  glNamedBufferStorage(indirectBuf, sizeof drawIndirectCommands, drawIndirectCommands, 0);
-  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuf);
+  // The hand placed instances are always in view, so they skip culling and are drawn with one command each
+  for (auto const& placedInstance : placedInstances) {
+    addInstance(placedInstance.position[0], placedInstance.position[1], placedInstance.scale, placedInstance.meshIdx,
+                noBatch);
+  }
+
+  std::mt19937 rng{0};
+  std::uniform_real_distribution positionDist{-1.5f, 1.5f};
+  std::uniform_real_distribution scaleDist{0.005f, 0.02f};
+  std::uniform_int_distribution<GLuint> meshDist{0, meshCount - 1};
+  std::uniform_int_distribution<GLuint> materialDist{0, MATERIAL_COUNT - 1};
+
+  for (GLuint i{0}; i < GENERATED_INSTANCE_COUNT; i++) {
+    auto const x = positionDist(rng);
+    auto const y = positionDist(rng);
+    auto const scale = scaleDist(rng);
+    auto const meshIdx = meshDist(rng);
+    addInstance(x, y, scale, meshIdx, meshIdx * MATERIAL_COUNT + materialDist(rng));
+  }
+
+  // Every batch gets room for all of its instances in the visible instance buffer
+  std::vector<GLuint> batchInstanceCounts(batchCount, 0);
+
+  for (auto const& instance : instances) {
+    if (instance.batchIdx != noBatch) {
+      batchInstanceCounts[instance.batchIdx] += 1;
+    }
+  }
+
+  for (GLuint batchIdx{1}; batchIdx < batchCount; batchIdx++) {
+    batches[batchIdx].instanceOffset = batches[batchIdx - 1].instanceOffset + batchInstanceCounts[batchIdx - 1];
+  }
+
+  auto const instanceCount = static_cast<GLuint>(instances.size());
+
+  GLuint instanceBuf;
+  glCreateBuffers(1, &instanceBuf);
+  glNamedBufferStorage(instanceBuf, instances.size() * sizeof(InstanceData), instances.data(), 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuf);
+
+  transforms.Update();
+
+  GLuint transformBuf;
+  glCreateBuffers(1, &transformBuf);
+  glNamedBufferStorage(transformBuf, static_cast<GLsizeiptr>(transforms.GetTransforms().size_bytes()),
+                       transforms.GetTransforms().data(), GL_DYNAMIC_STORAGE_BIT);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, transformBuf);
+
+  GLuint batchBuf;
+  glCreateBuffers(1, &batchBuf);
+  glNamedBufferStorage(batchBuf, batches.size() * sizeof(BatchData), batches.data(), 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, batchBuf);
+
+  // The draw count followed by the number of visible instances of each batch
+  auto constexpr cullCountSize = static_cast<GLsizeiptr>((1 + batchCount) * sizeof(GLuint));
+
+  GLuint cullCountBuf;
+  glCreateBuffers(1, &cullCountBuf);
+  glNamedBufferStorage(cullCountBuf, cullCountSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cullCountBuf);
+
+  // The counts are copied back every frame and read once the ring buffer fence of that frame passed, telling which
+  // materials were visible FRAMES_IN_FLIGHT frames ago
+  GLbitfield constexpr feedbackMapFlags{GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT};
+  std::vector<GLuint> const initialFeedback(FRAMES_IN_FLIGHT * (1 + batchCount), 0);
+
+  GLuint visibilityFeedbackBuf;
+  glCreateBuffers(1, &visibilityFeedbackBuf);
+  glNamedBufferStorage(visibilityFeedbackBuf, FRAMES_IN_FLIGHT * cullCountSize, initialFeedback.data(),
+                       feedbackMapFlags | GL_CLIENT_STORAGE_BIT);
+  auto const* const visibilityFeedback = static_cast<GLuint const*>(glMapNamedBufferRange(
+    visibilityFeedbackBuf, 0, FRAMES_IN_FLIGHT * cullCountSize, feedbackMapFlags));
+  GLsizei feedbackSlot{0};
+
+  // The culling pass fills the first half, the second half maps every instance to itself for the direct draws
+  std::vector<GLuint> initialVisibleInstances(2 * instanceCount, 0);
+
+  for (GLuint instanceIdx{0}; instanceIdx < instanceCount; instanceIdx++) {
+    initialVisibleInstances[instanceCount + instanceIdx] = instanceIdx;
+  }
+
+  GLuint visibleInstanceBuf;
+  glCreateBuffers(1, &visibleInstanceBuf);
+  glNamedBufferStorage(visibleInstanceBuf, initialVisibleInstances.size() * sizeof(GLuint),
+                       initialVisibleInstances.data(), 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, visibleInstanceBuf);
+
+  GLuint drawCommandBuf;
+  glCreateBuffers(1, &drawCommandBuf);
+  glNamedBufferStorage(drawCommandBuf, batchCount * sizeof(DrawElementsIndirectCommand), nullptr, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, drawCommandBuf);
+
+  // The material of every compacted draw, indexed by gl_DrawID. The draw queue binds its own ranges to the same
+  // binding, so it is bound again before every compaction pass.
+  GLuint drawMaterialBuf;
+  glCreateBuffers(1, &drawMaterialBuf);
+  glNamedBufferStorage(drawMaterialBuf, batchCount * sizeof(GLuint), nullptr, 0);
+
+  // Draws are sorted and merged into multidraws every frame
+  DrawQueue drawQueue{7};
+
+  // One more slot than frames in flight, so the queries of a slot finished by the time it is reused
+  std::optional<GpuProfiler> gpuProfiler;
+  gpuProfiler.emplace(FRAMES_IN_FLIGHT + 1, gpuTracePath, GPU_TRACE_FRAME_LIMIT);
+
+  // Pixel transfer setup
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+  std::optional<PixelUploadStream> pixelUploads;
+  pixelUploads.emplace(PIXEL_UPLOAD_SLOT_SIZE, PIXEL_UPLOAD_SLOT_COUNT, PIXEL_UPLOAD_WORKER_COUNT);
+
+  // Frames are read back as tightly packed RGB8, one slot per frame in flight
+  auto constexpr captureSize = static_cast<GLsizeiptr>(WIDTH * HEIGHT * 3);
+  std::optional<PixelReadbackStream> pixelReadbacks;
+  pixelReadbacks.emplace(captureSize, FRAMES_IN_FLIGHT);
+
+  // The capture file is written by a worker thread, the render thread only copies the frame out of the slot
+  std::optional<PpmWriter> captureWriter;
+  captureWriter.emplace();
 
   // Texture setup
 
   auto constexpr texWidth = 3;
   GLubyte constexpr texColorData[texWidth][3]{{255, 0, 0}, {0, 255, 0}, {0, 0, 255}};
 
-  GLuint texture;
-  glCreateTextures(GL_TEXTURE_1D, 1, &texture);
+  // Always resident, stands in for the material textures that are not. Textures are cleared to black until their
+  // uploads land. Only used with bindless textures.
+  GLuint fallbackTexture{0};
+  GLuint64 fallbackTextureHandle{0};
 
-  glTextureStorage1D(texture, 1, GL_SRGB8, texWidth);
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-  glTextureSubImage1D(texture, 0, 0, texWidth, GL_RGB, GL_UNSIGNED_BYTE, texColorData);
+  if (bindless) {
+    glCreateTextures(GL_TEXTURE_1D, 1, &fallbackTexture);
 
-  auto const textureHandle = glGetTextureHandleARB(texture);
-  glMakeTextureHandleResidentARB(textureHandle);
+    glTextureStorage1D(fallbackTexture, 1, GL_SRGB8, texWidth);
+    glClearTexImage(fallbackTexture, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    pixelUploads->Enqueue(TextureRegion{fallbackTexture, 0, 0, 0, texWidth, 1, GL_RGB, GL_UNSIGNED_BYTE},
+                          sizeof texColorData, [texColorData](std::span<std::byte> const dst) {
+                            std::memcpy(dst.data(), texColorData, sizeof texColorData);
+                          });
 
-  // UBO setup
+    fallbackTextureHandle = glGetTextureHandleARB(fallbackTexture);
+    glMakeTextureHandleResidentARB(fallbackTextureHandle);
+  }
 
-  struct UniformBufferData {
+  // Material setup
+
+  struct MaterialData {
     GLuint64 textureHandle;
-    GLfloat gammaInv;
   };
 
-  UniformBufferData uniformBufferData{};
-  uniformBufferData.textureHandle = textureHandle;
-  uniformBufferData.gammaInv = 1.f / GAMMA;
+  // Bindless materials get a texture each whose residency is managed, otherwise all of them share an array texture
+  // bound to unit 0
+  std::optional<TextureResidencyManager> residency;
+  std::vector<GLuint> materialTextures;
+  GLuint materialTextureArray{0};
+
+  if (bindless) {
+    residency.emplace(TEXTURE_RESIDENCY_BUDGET);
+    materialTextures.resize(MATERIAL_COUNT);
+    glCreateTextures(GL_TEXTURE_1D, MATERIAL_COUNT, materialTextures.data());
+  } else {
+    glCreateTextures(GL_TEXTURE_1D_ARRAY, 1, &materialTextureArray);
+    glTextureStorage2D(materialTextureArray, 1, GL_SRGB8_ALPHA8, MATERIAL_TEXTURE_WIDTH, MATERIAL_COUNT);
+    glClearTexImage(materialTextureArray, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTextureUnit(0, materialTextureArray);
+  }
 
-  GLbitfield constexpr mapFlags{GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT};
-  GLbitfield constexpr createFlags{mapFlags | GL_DYNAMIC_STORAGE_BIT};
+  // Gradients through three random colors, the vertices fetch the first, middle and last texel
+  std::uniform_int_distribution<GLuint> colorDist{0, 255};
 
-  GLuint uniformBuffer;
-  glCreateBuffers(1, &uniformBuffer);
-  glNamedBufferStorage(uniformBuffer, sizeof UniformBufferData, nullptr, createFlags);
-  glBindBufferRange(GL_UNIFORM_BUFFER, 0, uniformBuffer, 0, sizeof UniformBufferData);
+  for (GLuint materialIdx{0}; materialIdx < MATERIAL_COUNT; materialIdx++) {
+    GLfloat keyColors[3][3];
 
-  auto const uniformBufferPtr = static_cast<UniformBufferData*>(glMapNamedBufferRange(
-    uniformBuffer, 0, sizeof UniformBufferData, mapFlags));
-  *uniformBufferPtr = uniformBufferData;
+    for (auto& keyColor : keyColors) {
+      for (auto& channel : keyColor) {
+        channel = static_cast<GLfloat>(colorDist(rng));
+      }
+    }
 
-  // Shader setup
+    // Array layers are addressed by the y coordinate of the region
+    TextureRegion region{
+      materialTextureArray, 0, 0, static_cast<GLint>(materialIdx), MATERIAL_TEXTURE_WIDTH, 1, GL_RGBA, GL_UNSIGNED_BYTE
+    };
 
-  auto const vertSrc = LoadFileText(shaderSourceDir / "shader.vert");
-  auto const fragSrc = LoadFileText(shaderSourceDir / "shader.frag");
-  auto const vertSrcP = vertSrc.data();
-  auto const fragSrcP = fragSrc.data();
+    if (bindless) {
+      region.texture = materialTextures[materialIdx];
+      region.y = 0;
+      glTextureStorage1D(region.texture, 1, GL_SRGB8_ALPHA8, MATERIAL_TEXTURE_WIDTH);
+      glClearTexImage(region.texture, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
 
-  auto const vertShader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertShader, 1, &vertSrcP, nullptr);
-  glCompileShader(vertShader);
-  GLint result;
-  glGetShaderiv(vertShader, GL_COMPILE_STATUS, &result);
-  if (result != GL_TRUE) {
-    std::cerr << "Failed to compile vertex shader!\n\n";
+    // The gradients are computed on the upload workers straight into the mapped slots
+    pixelUploads->Enqueue(region, MATERIAL_TEXTURE_WIDTH * 4, [keyColors](std::span<std::byte> const dst) {
+                            for (GLsizei texelIdx{0}; texelIdx < MATERIAL_TEXTURE_WIDTH; texelIdx++) {
+                              auto const pos = static_cast<GLfloat>(texelIdx) * 2.f / static_cast<GLfloat>(
+                                MATERIAL_TEXTURE_WIDTH - 1);
+                              auto const segment = std::min(static_cast<int>(pos), 1);
+                              auto const t = pos - static_cast<GLfloat>(segment);
+
+                              for (auto channel = 0; channel < 3; channel++) {
+                                dst[texelIdx * 4 + channel] = static_cast<std::byte>(
+                                  keyColors[segment][channel] * (1.f - t) + keyColors[segment + 1][channel] * t +
+                                  0.5f);
+                              }
+
+                              dst[texelIdx * 4 + 3] = std::byte{255};
+                            }
+                          });
+
+    // Residency indices match the material indices
+    if (residency) {
+      residency->Add(region.texture, MATERIAL_TEXTURE_WIDTH * 4);
+    }
   }
 
-  auto const fragShader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragShader, 1, &fragSrcP, nullptr);
-  glCompileShader(fragShader);
-  glGetShaderiv(fragShader, GL_COMPILE_STATUS, &result);
-  if (result != GL_TRUE) {
-    std::cerr << "Failed to compile fragment shader!\n\n";
-  }
+  // Every material starts out drawn with the fallback until it is found visible and made resident
+  GLuint materialBuf{0};
+
+  if (bindless) {
+    std::vector<MaterialData> const initialMaterials(MATERIAL_COUNT, MaterialData{fallbackTextureHandle});
 
-  auto const program = glCreateProgram();
-  glAttachShader(program, vertShader);
-  glAttachShader(program, fragShader);
-  glLinkProgram(program);
-  glGetProgramiv(program, GL_LINK_STATUS, &result);
-  if (result != GL_TRUE) {
-    GLint logLngth;
-    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLngth);
-    std::string infoLog(logLngth, ' ');
-    glGetProgramInfoLog(program, static_cast<GLsizei>(infoLog.size()), &logLngth, infoLog.data());
-    std::cerr << "Failed to link shader program: " << infoLog << "\n\n";
+    glCreateBuffers(1, &materialBuf);
+    glNamedBufferStorage(materialBuf, MATERIAL_COUNT * sizeof(MaterialData), initialMaterials.data(),
+                         GL_DYNAMIC_STORAGE_BIT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, materialBuf);
   }
 
-  glUseProgram(program);
+  // UBO setup
+
+  struct UniformBufferData {
+    GLfloat gammaInv;
+    alignas(16) GLfloat viewProj[16];
+  };
+
+  UniformBufferData uniformBufferData{};
+  uniformBufferData.gammaInv = 1.f / GAMMA;
+  std::copy_n(IDENTITY_MATRIX, 16, uniformBufferData.viewProj);
 
   // Render loop
 
+  auto frameCount = 0;
+  auto frameNumber = 0;
+  GLsizeiptr streamedTransformSize{0};
+  auto const startTime = std::chrono::steady_clock::now();
+  auto const getSeconds = [startTime] {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  };
+  auto statsStartTime = getSeconds();
+
+#ifdef HEADLESS
+  for (auto frameIdx = 0; frameIdx < HEADLESS_FRAME_COUNT; frameIdx++) {
+#else
   while (!glfwWindowShouldClose(window)) {
     glfwPollEvents();
+#endif
+
+    // A start is warm when every program came from the binary cache. Starts with failed programs are not timed.
+    if (programs->Poll() == 0 && !programsBuilt) {
+      programsBuilt = true;
+
+      if (auto const failedCount = programs->GetFailedCount()) {
+        std::cerr << failedCount << " of " << programs->GetProgramCount() << " programs failed to build" <<
+          (programs->IsFailed(cullProgram) || programs->IsFailed(buildDrawsProgram)
+             ? ", nothing is drawn without the culling programs"
+             : "") << ".\n\n";
+      } else {
+        std::cout << "All " << programs->GetProgramCount() << " programs ready " <<
+          std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - programSetupStart).count() <<
+          " ms after submission, " << programs->GetCachedCount() << " loaded from the binary cache (" <<
+          (programs->GetCachedCount() == programs->GetProgramCount() ? "warm" : "cold") << " start).\n\n";
+      }
+    }
+
+    // Nothing is drawn until the culling programs are ready, the scene program has a fallback
+    auto const cullingReady = programs->IsReady(cullProgram) && programs->IsReady(buildDrawsProgram);
+
+    ringBuffer->BeginFrame();
+    gpuProfiler->BeginFrame();
+
+    // Neither stream waits, transfers that are not done yet are picked up by a later frame
+    pixelUploads->Pump();
+    pixelReadbacks->Pump();
+    feedbackSlot = (feedbackSlot + 1) % FRAMES_IN_FLIGHT;
+
+    if (residency) {
+      // The slot was last written FRAMES_IN_FLIGHT frames ago, its fence passed in BeginFrame
+      auto const* const visibleCounts = visibilityFeedback + feedbackSlot * (1 + batchCount) + 1;
+
+      for (GLuint batchIdx{0}; batchIdx < batchCount; batchIdx++) {
+        if (visibleCounts[batchIdx]) {
+          residency->Touch(batches[batchIdx].materialIdx);
+        }
+      }
+
+      // The placed instances use the first materials
+      for (GLuint materialIdx{0}; materialIdx < std::size(placedInstances); materialIdx++) {
+        residency->Touch(materialIdx);
+      }
+
+      // Evicted handles are non-resident from here on, so the table must stop pointing at them before the draw
+      for (auto const materialIdx : residency->Update()) {
+        MaterialData const material{
+          residency->IsResident(materialIdx) ? residency->GetHandle(materialIdx) : fallbackTextureHandle
+        };
+        glNamedBufferSubData(materialBuf, static_cast<GLintptr>(materialIdx * sizeof(MaterialData)),
+                             sizeof(MaterialData), &material);
+      }
+    }
+
+    auto const uniformAlloc = ringBuffer->WriteUniform(uniformBufferData);
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, ringBuffer->GetBuffer(), uniformAlloc.offset, uniformAlloc.size);
 
-    glClearNamedFramebufferfv(framebuffer, GL_COLOR, 0, CLEAR_COLOR);
-    glClearNamedFramebufferfi(framebuffer, GL_DEPTH_STENCIL, 0, CLEAR_DEPTH, CLEAR_STENCIL);
+    auto const halfSpinAngle = static_cast<GLfloat>(getSeconds()) * SPIN_SPEED * 0.5f;
 
-    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_BYTE, nullptr,
-                                sizeof drawIndirectCommands / sizeof DrawElementsIndirectCommand, 0);
+    for (std::size_t i{0}; i < std::size(placedInstances); i++) {
+      if (placedInstances[i].spins) {
+        transforms.SetRotation(i, 0, 0, std::sin(halfSpinAngle), std::cos(halfSpinAngle));
+      }
+    }
+
+    streamedTransformSize += StreamDirtyTransforms(transforms, *ringBuffer, transformBuf);
+
+    // Visibility never leaves the GPU, the culling pass feeds the draw count of the multidraw directly
+    if (cullingReady) {
+      auto const scope = gpuProfiler->Scope("Culling");
+      glClearNamedBufferData(cullCountBuf, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+      glUseProgram(programs->GetProgram(cullProgram));
+      glDispatchCompute((instanceCount + CULLING_GROUP_SIZE - 1) / CULLING_GROUP_SIZE, 1, 1);
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-    glBlitNamedFramebuffer(framebuffer, 0, 0, 0, WIDTH, HEIGHT, 0, 0, WIDTH, HEIGHT, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+      // The draw queue invalidates its state shadow on every flush, so rebinding here does not confuse it
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, drawMaterialBuf);
+      glUseProgram(programs->GetProgram(buildDrawsProgram));
+      glDispatchCompute((batchCount + CULLING_GROUP_SIZE - 1) / CULLING_GROUP_SIZE, 1, 1);
+      glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
 
+      glCopyNamedBufferSubData(cullCountBuf, visibilityFeedbackBuf, 0, feedbackSlot * cullCountSize, cullCountSize);
+    }
+
+    {
+      auto const scope = gpuProfiler->Scope("Clear");
+      glClearNamedFramebufferfv(framebuffer, GL_COLOR, 0, CLEAR_COLOR);
+      glClearNamedFramebufferfi(framebuffer, GL_DEPTH_STENCIL, 0, CLEAR_DEPTH, CLEAR_STENCIL);
+    }
+
+    auto const sceneProgramName = programs->GetProgram(sceneProgram);
+
+    for (GLuint instanceIdx{0}; instanceIdx < std::size(placedInstances); instanceIdx++) {
+      auto const& mesh = meshes[placedInstances[instanceIdx].meshIdx];
+      drawQueue.Submit(sceneProgramName, vao, GL_UNSIGNED_BYTE, instanceIdx, 0.5f, DrawElementsIndirectCommand{
+                         mesh.indexCount, 1, mesh.firstIndex, static_cast<GLuint>(mesh.baseVertex),
+                         instanceCount + instanceIdx
+                       });
+    }
+
+    if (cullingReady) {
+      drawQueue.Submit(sceneProgramName, vao, GL_UNSIGNED_BYTE, 0.5f, DrawQueue::GpuDrawList{
+                         drawCommandBuf, cullCountBuf, 0, static_cast<GLsizei>(batchCount), drawMaterialBuf
+                       });
+    }
+
+    {
+      auto const scope = gpuProfiler->Scope("Multidraw");
+      drawQueue.Flush(*ringBuffer);
+    }
+
+    // The frame is written out a few frames later, once its readback completed
+    if (frameNumber % CAPTURE_INTERVAL == 0) {
+      pixelReadbacks->Read(TextureRegion{colorBuffer, 0, 0, 0, WIDTH, HEIGHT, GL_RGB, GL_UNSIGNED_BYTE}, captureSize,
+                           [&frameNumber, &captureWriter, capturedFrameNumber = frameNumber](
+                           std::span<std::byte const> const texels) {
+                             captureWriter->Write(capturePath, WIDTH, HEIGHT, texels);
+                             std::cout << "Captured frame " << capturedFrameNumber << " to " << capturePath << ", " <<
+                               frameNumber - capturedFrameNumber << " frames after the readback was issued\n";
+                           });
+    }
+
+#ifdef HEADLESS
+    // There is no default framebuffer to blit to, flushing stands in for the swap
+    glFlush();
+#else
+    {
+      auto const scope = gpuProfiler->Scope("Blit");
+      glBlitNamedFramebuffer(framebuffer, 0, 0, 0, WIDTH, HEIGHT, 0, 0, WIDTH, HEIGHT, GL_COLOR_BUFFER_BIT,
+                             GL_NEAREST);
+    }
+#endif
+
+    ringBuffer->EndFrame();
+
+#ifndef HEADLESS
     glfwSwapBuffers(window);
+#endif
+
+    frameCount += 1;
+    frameNumber += 1;
+
+    // Long fence waits mean the GPU is the bottleneck and the CPU ran FRAMES_IN_FLIGHT frames ahead
+    if (auto const now = getSeconds(); now - statsStartTime >= 1.0) {
+      std::cout << "Ring buffer fence wait: " << ringBuffer->ConsumeWaitSeconds() * 1000.0 / frameCount <<
+        " ms/frame over " << frameCount << " frames, " << streamedTransformSize / frameCount <<
+        " bytes of transforms streamed per frame\n";
+
+      auto const [drawCount, drawBatchCount, stateChangeCount, avoidedStateChangeCount] = drawQueue.ConsumeStats();
+      std::cout << "Draw queue: " << drawCount / frameCount << " draws submitted, " << drawBatchCount / frameCount <<
+        " batches emitted, " << stateChangeCount / frameCount << " state changes issued, " << avoidedStateChangeCount /
+        frameCount << " avoided per frame\n";
+
+      if (residency) {
+        auto const [madeResidentCount, evictedCount, deniedCount] = residency->ConsumeStats();
+        std::cout << "Texture residency: " << residency->GetResidentCount() << '/' << MATERIAL_COUNT << " resident, "
+          << residency->GetResidentSize() / 1024 << " of " << residency->GetBudget() / 1024 << " KiB budget, " <<
+          madeResidentCount << " made resident, " << evictedCount << " evicted, " << deniedCount <<
+          " denied over budget\n";
+      }
+
+      std::cout << "GPU time:";
+
+      for (auto const& [name, sampleCount, totalMs, minMs, maxMs] : gpuProfiler->ConsumeStats()) {
+        std::cout << ' ' << name << ' ' << totalMs / static_cast<double>(sampleCount) << " ms (" << minMs << '-' <<
+          maxMs << "),";
+      }
+
+      std::cout << ' ' << gpuProfiler->ConsumeDroppedFrameCount() << " frames dropped\n";
+
+      std::cout << "Pixel transfers: " << pixelUploads->ConsumeUploadedSize() / 1024 << " KiB uploaded, " <<
+        pixelUploads->GetPendingCount() << " uploads pending, " << pixelReadbacks->ConsumeDroppedCount() <<
+        " readbacks dropped, " << captureWriter->GetPendingCount() << " captures pending\n";
+      frameCount = 0;
+      streamedTransformSize = 0;
+      statsStartTime = now;
+    }
   }
 
+#ifdef HEADLESS
+  glFinish();
+  auto const runSeconds = getSeconds();
+  std::cout << "Rendered " << HEADLESS_FRAME_COUNT << " frames of " << WIDTH << 'x' << HEIGHT << " in " << runSeconds <<
+    " s, " << runSeconds * 1000.0 / HEADLESS_FRAME_COUNT << " ms/frame, " << HEADLESS_FRAME_COUNT / runSeconds <<
+    " frames/s\n";
+#endif
+
   // Cleanup
 
-  glDeleteProgram(program);
-  glDeleteShader(fragShader);
-  glDeleteShader(vertShader);
-  glMakeTextureHandleNonResidentARB(textureHandle);
-  glDeleteTextures(1, &texture);
-  glUnmapNamedBuffer(uniformBuffer);
-  glDeleteBuffers(1, &uniformBuffer);
+  programs.reset();
+  pixelReadbacks.reset();
+  captureWriter.reset();
+  pixelUploads.reset();
+  gpuProfiler.reset();
+  residency.reset();
+  glDeleteBuffers(1, &materialBuf);
+  glDeleteTextures(static_cast<GLsizei>(materialTextures.size()), materialTextures.data());
+  glDeleteTextures(1, &materialTextureArray);
+
+  if (bindless) {
+    glMakeTextureHandleNonResidentARB(fallbackTextureHandle);
+  }
+
+  glDeleteTextures(1, &fallbackTexture);
   glDeleteVertexArrays(1, &vao);
+  ringBuffer.reset();
+  glDeleteBuffers(1, &drawMaterialBuf);
+  glDeleteBuffers(1, &drawCommandBuf);
+  glDeleteBuffers(1, &visibleInstanceBuf);
+  glUnmapNamedBuffer(visibilityFeedbackBuf);
+  glDeleteBuffers(1, &visibilityFeedbackBuf);
+  glDeleteBuffers(1, &cullCountBuf);
+  glDeleteBuffers(1, &batchBuf);
+  glDeleteBuffers(1, &transformBuf);
+  glDeleteBuffers(1, &instanceBuf);
+  glDeleteBuffers(1, &vertIndBuf);
   glDeleteBuffers(1, &vertTexIndBuf);
   glDeleteBuffers(1, &vertPosBuf);
   glDeleteTextures(1, &depthStencilBuffer);
   glDeleteTextures(1, &colorBuffer);
   glDeleteFramebuffers(1, &framebuffer);
 
+#ifdef HEADLESS
+  DestroyHeadlessContext(*headless);
+#else
   glfwDestroyWindow(window);
   glfwTerminate();
+#endif
 }
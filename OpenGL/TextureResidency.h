@@ -0,0 +1,158 @@
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <list>
+#include <span>
+#include <vector>
+
+// Keeps the bindless handles of the most recently used textures resident within
+// a memory budget. Textures are touched when they are found to be in use, and
+// the next update makes the touched ones resident, evicting the least recently
+// used ones that were not touched since the previous update. Touched textures
+// that still do not fit stay non-resident, so callers have to substitute a
+// resident texture for them.
+class TextureResidencyManager {
+public:
+  struct Stats {
+    std::size_t madeResidentCount;
+    std::size_t evictedCount;
+    std::size_t deniedCount;
+  };
+
+  explicit TextureResidencyManager(GLsizeiptr const budget) :
+    budget_{budget} {}
+
+  TextureResidencyManager(TextureResidencyManager const& other) = delete;
+  TextureResidencyManager(TextureResidencyManager&& other) = delete;
+
+  ~TextureResidencyManager() {
+    for (auto const idx : lru_) {
+      glMakeTextureHandleNonResidentARB(entries_[idx].handle);
+    }
+  }
+
+  auto operator=(TextureResidencyManager const& other) -> void = delete;
+  auto operator=(TextureResidencyManager&& other) -> void = delete;
+
+  // Textures start out non-resident, returns the index of the texture
+  auto Add(GLuint const texture, GLsizeiptr const size) -> std::size_t {
+    auto& entry = entries_.emplace_back();
+    entry.handle = glGetTextureHandleARB(texture);
+    entry.size = size;
+    return entries_.size() - 1;
+  }
+
+  auto Touch(std::size_t const idx) -> void {
+    auto& entry = entries_[idx];
+
+    if (entry.touched) {
+      return;
+    }
+
+    entry.touched = true;
+    touched_.push_back(idx);
+
+    if (entry.resident) {
+      lru_.splice(lru_.begin(), lru_, entry.lruIt);
+    }
+  }
+
+  // Applies the residency changes and returns the indices of the textures whose
+  // residency changed, valid until the next call. Evicted handles are made
+  // non-resident right away, so they must not be used by later commands.
+  auto Update() -> std::span<std::size_t const> {
+    changed_.clear();
+
+    for (auto const idx : touched_) {
+      auto& entry = entries_[idx];
+
+      if (entry.resident) {
+        continue;
+      }
+
+      // Touched textures are at the front, so only untouched ones are evicted
+      while (residentSize_ + entry.size > budget_ && !lru_.empty() && !entries_[lru_.back()].touched) {
+        Evict(lru_.back());
+      }
+
+      if (residentSize_ + entry.size > budget_) {
+        stats_.deniedCount += 1;
+        continue;
+      }
+
+      glMakeTextureHandleResidentARB(entry.handle);
+      entry.resident = true;
+      entry.lruIt = lru_.insert(lru_.begin(), idx);
+      residentSize_ += entry.size;
+      changed_.push_back(idx);
+      stats_.madeResidentCount += 1;
+    }
+
+    for (auto const idx : touched_) {
+      entries_[idx].touched = false;
+    }
+
+    touched_.clear();
+    return changed_;
+  }
+
+  [[nodiscard]] auto GetHandle(std::size_t const idx) const -> GLuint64 {
+    return entries_[idx].handle;
+  }
+
+  [[nodiscard]] auto IsResident(std::size_t const idx) const -> bool {
+    return entries_[idx].resident;
+  }
+
+  [[nodiscard]] auto GetResidentCount() const -> std::size_t {
+    return lru_.size();
+  }
+
+  [[nodiscard]] auto GetResidentSize() const -> GLsizeiptr {
+    return residentSize_;
+  }
+
+  [[nodiscard]] auto GetBudget() const -> GLsizeiptr {
+    return budget_;
+  }
+
+  // Residency changes since the last call
+  [[nodiscard]] auto ConsumeStats() -> Stats {
+    auto const stats = stats_;
+    stats_ = {};
+    return stats;
+  }
+
+private:
+  struct Entry {
+    GLuint64 handle{0};
+    GLsizeiptr size{0};
+    bool resident{false};
+    bool touched{false};
+    std::list<std::size_t>::iterator lruIt;
+  };
+
+  auto Evict(std::size_t const idx) -> void {
+    auto& entry = entries_[idx];
+    glMakeTextureHandleNonResidentARB(entry.handle);
+    entry.resident = false;
+    lru_.erase(entry.lruIt);
+    residentSize_ -= entry.size;
+    changed_.push_back(idx);
+    stats_.evictedCount += 1;
+  }
+
+  GLsizeiptr budget_;
+  GLsizeiptr residentSize_{0};
+  std::vector<Entry> entries_;
+  // Resident textures, most recently used first
+  std::list<std::size_t> lru_;
+  std::vector<std::size_t> touched_;
+  std::vector<std::size_t> changed_;
+  Stats stats_{};
+};
+
+#endif
@@ -0,0 +1,10 @@
+#version 450 core
+
+layout(location = 0) out vec3 outFragColor;
+
+
+// Stands in for the scene program while it is still building
+void main()
+{
+	outFragColor = vec3(0.5);
+}
@@ -0,0 +1,30 @@
+#version 450 core
+#extension GL_ARB_shader_draw_parameters : require
+
+layout(location = 0) in vec2 inPos;
+
+layout(std140, binding = 0) uniform UniformBuffer
+{
+	float gammaInv;
+	mat4 viewProj;
+} uUniforms;
+
+layout(std430, binding = 5) readonly buffer TransformBuffer
+{
+	vec4 transforms[];
+};
+
+layout(std430, binding = 3) readonly buffer VisibleInstanceBuffer
+{
+	uint visibleInstances[];
+};
+
+
+void main()
+{
+	uint instanceIdx = visibleInstances[gl_BaseInstanceARB + gl_InstanceID];
+	vec4 pos = vec4(inPos, 0, 1);
+	vec3 worldPos = vec3(dot(transforms[instanceIdx * 3], pos), dot(transforms[instanceIdx * 3 + 1], pos),
+	                     dot(transforms[instanceIdx * 3 + 2], pos));
+	gl_Position = uUniforms.viewProj * vec4(worldPos, 1);
+}
@@ -1,5 +1,4 @@
-#version 460 core
-#extension GL_ARB_bindless_texture : require
+#version 450 core
 
 layout(location = 0) in vec3 inFragColor;
 
@@ -7,8 +6,8 @@ layout(location = 0) out vec3 outFragColor;
 
 layout(std140, binding = 0) uniform UniformBuffer
 {
-	sampler1D tex;
 	float gammaInv;
+	mat4 viewProj;
 } uUniforms;
 
 
@@ -1,21 +1,69 @@
-#version 460 core
+#version 450 core
+#extension GL_ARB_shader_draw_parameters : require
 #extension GL_ARB_bindless_texture : require
 
 layout(location = 0) in vec2 inPos;
 layout(location = 1) in int inTexelIndex;
-layout(location = 2) in mat4 inModelMat;
 
 layout(location = 0) out vec3 outVertColor;
 
 layout(std140, binding = 0) uniform UniformBuffer
 {
-	sampler1D tex;
 	float gammaInv;
+	mat4 viewProj;
 } uUniforms;
 
+struct Instance
+{
+	vec4 boundingSphere;
+	uint batchIdx;
+};
+
+struct Material
+{
+	// Bindless sampler1D handle, pointing at the fallback texture while the material's texture is not resident
+	uvec2 textureHandle;
+};
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer
+{
+	Instance instances[];
+};
+
+// Rows of the world matrices with the translation in the last column
+layout(std430, binding = 5) readonly buffer TransformBuffer
+{
+	vec4 transforms[];
+};
+
+// Written by the culling pass, every draw's base instance points at its slice. The tail maps every instance to itself
+// for the draws issued directly by the CPU.
+layout(std430, binding = 3) readonly buffer VisibleInstanceBuffer
+{
+	uint visibleInstances[];
+};
+
+layout(std430, binding = 6) readonly buffer MaterialBuffer
+{
+	Material materials[];
+};
+
+// Written by the draw compaction pass, every draw covers a single material
+layout(std430, binding = 7) readonly buffer DrawMaterialBuffer
+{
+	uint drawMaterials[];
+};
+
 
 void main()
 {
-	gl_Position = inModelMat * vec4(inPos, 0, 1);
-	outVertColor = texelFetch(uUniforms.tex, inTexelIndex, 0).rgb;
+	uint instanceIdx = visibleInstances[gl_BaseInstanceARB + gl_InstanceID];
+	vec4 pos = vec4(inPos, 0, 1);
+	vec3 worldPos = vec3(dot(transforms[instanceIdx * 3], pos), dot(transforms[instanceIdx * 3 + 1], pos),
+	                     dot(transforms[instanceIdx * 3 + 2], pos));
+	gl_Position = uUniforms.viewProj * vec4(worldPos, 1);
+	// gl_DrawIDARB is dynamically uniform, so the handle is too
+	sampler1D tex = sampler1D(materials[drawMaterials[gl_DrawIDARB]].textureHandle);
+	// Maps the texel indices onto the first, middle and last texel of textures of any width
+	outVertColor = texelFetch(tex, inTexelIndex * (textureSize(tex, 0) - 1) / 2, 0).rgb;
 }
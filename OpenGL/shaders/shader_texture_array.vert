@@ -0,0 +1,59 @@
+#version 450 core
+#extension GL_ARB_shader_draw_parameters : require
+
+layout(location = 0) in vec2 inPos;
+layout(location = 1) in int inTexelIndex;
+
+layout(location = 0) out vec3 outVertColor;
+
+layout(std140, binding = 0) uniform UniformBuffer
+{
+	float gammaInv;
+	mat4 viewProj;
+} uUniforms;
+
+struct Instance
+{
+	vec4 boundingSphere;
+	uint batchIdx;
+};
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer
+{
+	Instance instances[];
+};
+
+// Rows of the world matrices with the translation in the last column
+layout(std430, binding = 5) readonly buffer TransformBuffer
+{
+	vec4 transforms[];
+};
+
+// Written by the culling pass, every draw's base instance points at its slice. The tail maps every instance to itself
+// for the draws issued directly by the CPU.
+layout(std430, binding = 3) readonly buffer VisibleInstanceBuffer
+{
+	uint visibleInstances[];
+};
+
+// Used when bindless textures are not supported, every material is a layer of the array
+layout(binding = 0) uniform sampler1DArray uMaterialTextures;
+
+// Written by the draw compaction pass, every draw covers a single material
+layout(std430, binding = 7) readonly buffer DrawMaterialBuffer
+{
+	uint drawMaterials[];
+};
+
+
+void main()
+{
+	uint instanceIdx = visibleInstances[gl_BaseInstanceARB + gl_InstanceID];
+	vec4 pos = vec4(inPos, 0, 1);
+	vec3 worldPos = vec3(dot(transforms[instanceIdx * 3], pos), dot(transforms[instanceIdx * 3 + 1], pos),
+	                     dot(transforms[instanceIdx * 3 + 2], pos));
+	gl_Position = uUniforms.viewProj * vec4(worldPos, 1);
+	// Maps the texel indices onto the first, middle and last texel of textures of any width
+	int texelIdx = inTexelIndex * (textureSize(uMaterialTextures, 0).x - 1) / 2;
+	outVertColor = texelFetch(uMaterialTextures, ivec2(texelIdx, drawMaterials[gl_DrawIDARB]), 0).rgb;
+}
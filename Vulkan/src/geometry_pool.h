@@ -0,0 +1,469 @@
+#ifndef GEOMETRY_POOL_H
+#define GEOMETRY_POOL_H
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// First-fit allocator over a range of elements. Free ranges are kept sorted by
+// offset and merged with their neighbours when released.
+class FreeListAllocator {
+public:
+  struct Range {
+    std::uint32_t offset;
+    std::uint32_t size;
+  };
+
+  explicit FreeListAllocator(std::uint32_t const capacity) :
+    capacity_{capacity}, free_ranges_{Range{0, capacity}} {}
+
+  [[nodiscard]] auto Allocate(
+    std::uint32_t const size) -> std::optional<std::uint32_t> {
+    auto const it{
+      std::ranges::find_if(free_ranges_, [size](Range const& range) {
+        return range.size >= size;
+      })
+    };
+
+    if (it == free_ranges_.end()) {
+      return std::nullopt;
+    }
+
+    auto const offset{it->offset};
+    it->offset += size;
+    it->size -= size;
+
+    if (it->size == 0) {
+      free_ranges_.erase(it);
+    }
+
+    allocated_size_ += size;
+    return offset;
+  }
+
+  auto Free(Range const range) -> void {
+    if (range.size == 0) {
+      return;
+    }
+
+    allocated_size_ -= range.size;
+
+    auto const it{
+      free_ranges_.insert(
+        std::ranges::lower_bound(free_ranges_, range.offset, {},
+                                 &Range::offset), range)
+    };
+
+    if (auto const next{std::next(it)}; next != free_ranges_.end() && it->
+      offset + it->size == next->offset) {
+      it->size += next->size;
+      free_ranges_.erase(next);
+    }
+
+    if (it != free_ranges_.begin()) {
+      if (auto const prev{std::prev(it)}; prev->offset + prev->size == it->
+        offset) {
+        prev->size += it->size;
+        free_ranges_.erase(it);
+      }
+    }
+  }
+
+  auto Reset() -> void {
+    free_ranges_ = {Range{0, capacity_}};
+    allocated_size_ = 0;
+  }
+
+  [[nodiscard]] auto GetCapacity() const -> std::uint32_t {
+    return capacity_;
+  }
+
+  [[nodiscard]] auto GetAllocatedSize() const -> std::uint32_t {
+    return allocated_size_;
+  }
+
+  [[nodiscard]] auto GetFreeRangeCount() const -> std::size_t {
+    return free_ranges_.size();
+  }
+
+  [[nodiscard]] auto GetLargestFreeRange() const -> std::uint32_t {
+    std::uint32_t largest{0};
+
+    for (auto const& range : free_ranges_) {
+      largest = std::max(largest, range.size);
+    }
+
+    return largest;
+  }
+
+private:
+  std::uint32_t capacity_;
+  std::uint32_t allocated_size_{0};
+  std::vector<Range> free_ranges_;
+};
+
+// One device local index buffer and one vertex buffer per vertex stream shared
+// by every mesh, so drawing any number of meshes takes a single set of
+// bindings. All streams of a mesh share its vertex offset, e.g. the full
+// vertices and a position-only copy of them. Meshes are sub-allocated with a
+// free-list allocator and their records map directly onto indexed indirect
+// draw commands. Removing meshes leaves holes behind, RecordDefragmentation
+// packs the remaining ones into a fresh set of buffers.
+class GeometryPool {
+public:
+  using MeshHandle = std::uint32_t;
+
+  struct MeshRecord {
+    std::uint32_t first_index;
+    std::int32_t vertex_offset;
+    std::uint32_t index_count;
+    std::uint32_t vertex_count;
+  };
+
+  struct Stats {
+    std::size_t mesh_count;
+    std::uint32_t vertex_count;
+    std::uint32_t vertex_capacity;
+    std::uint32_t index_count;
+    std::uint32_t index_capacity;
+    // Number of free ranges, one each when the pool is not fragmented
+    std::size_t vertex_free_range_count;
+    std::size_t index_free_range_count;
+  };
+
+  GeometryPool(vk::Device const device,
+               vk::PhysicalDeviceMemoryProperties const& memory_properties,
+               std::vector<vk::DeviceSize> vertex_strides,
+               std::uint32_t const vertex_capacity,
+               std::uint32_t const index_capacity,
+               vk::BufferUsageFlags const extra_vertex_usage = {}) :
+    device_{device}, memory_properties_{memory_properties},
+    vertex_strides_{std::move(vertex_strides)},
+    extra_vertex_usage_{extra_vertex_usage},
+    vertex_allocator_{vertex_capacity}, index_allocator_{index_capacity},
+    buffers_{CreateBufferSet()} {}
+
+  GeometryPool(GeometryPool const& other) = delete;
+  GeometryPool(GeometryPool&& other) = delete;
+
+  ~GeometryPool() {
+    ReleaseRetiredBuffers();
+    DestroyBufferSet(buffers_);
+  }
+
+  auto operator=(GeometryPool const& other) -> void = delete;
+  auto operator=(GeometryPool&& other) -> void = delete;
+
+  // Reserves room for a mesh. Its contents have to be copied to
+  // GetVertexDataOffset and GetIndexDataOffset before it is drawn.
+  [[nodiscard]] auto AddMesh(std::uint32_t const vertex_count,
+                             std::uint32_t const index_count) -> MeshHandle {
+    auto const vertex_offset{vertex_allocator_.Allocate(vertex_count)};
+
+    if (!vertex_offset) {
+      throw std::runtime_error{"Geometry pool is out of vertex memory."};
+    }
+
+    auto const first_index{index_allocator_.Allocate(index_count)};
+
+    if (!first_index) {
+      vertex_allocator_.Free({*vertex_offset, vertex_count});
+      throw std::runtime_error{"Geometry pool is out of index memory."};
+    }
+
+    MeshRecord const record{
+      *first_index, static_cast<std::int32_t>(*vertex_offset), index_count,
+      vertex_count
+    };
+
+    if (!free_handles_.empty()) {
+      auto const handle{free_handles_.back()};
+      free_handles_.pop_back();
+      meshes_[handle] = record;
+      return handle;
+    }
+
+    meshes_.emplace_back(record);
+    return static_cast<MeshHandle>(meshes_.size() - 1);
+  }
+
+  // Releases the ranges of a mesh. Command buffers still referencing it must
+  // have finished executing before its ranges are handed out again.
+  auto RemoveMesh(MeshHandle const handle) -> void {
+    auto const& mesh{*meshes_[handle]};
+    vertex_allocator_.Free({
+      static_cast<std::uint32_t>(mesh.vertex_offset), mesh.vertex_count
+    });
+    index_allocator_.Free({mesh.first_index, mesh.index_count});
+    meshes_[handle].reset();
+    free_handles_.emplace_back(handle);
+  }
+
+  // Byte offset of the mesh data in the vertex buffer of a stream
+  [[nodiscard]] auto GetVertexDataOffset(MeshHandle const handle,
+                                         std::size_t const stream) const ->
+    vk::DeviceSize {
+    return static_cast<vk::DeviceSize>(meshes_[handle]->vertex_offset) *
+           vertex_strides_[stream];
+  }
+
+  // Byte offset of the mesh data in the index buffer. The indices are relative
+  // to the first vertex of the mesh.
+  [[nodiscard]] auto GetIndexDataOffset(
+    MeshHandle const handle) const -> vk::DeviceSize {
+    return meshes_[handle]->first_index * sizeof(std::uint32_t);
+  }
+
+  // Whether the free space is split up enough that packing the meshes is worth
+  // a copy of the whole pool
+  [[nodiscard]] auto IsFragmented() const -> bool {
+    auto const is_fragmented{
+      [](FreeListAllocator const& allocator) {
+        auto const free_size{
+          allocator.GetCapacity() - allocator.GetAllocatedSize()
+        };
+        return allocator.GetFreeRangeCount() > 1 && allocator.
+               GetLargestFreeRange() < free_size / 2;
+      }
+    };
+
+    return is_fragmented(vertex_allocator_) || is_fragmented(index_allocator_);
+  }
+
+  // Copies every mesh into a new set of buffers without holes in between. The
+  // mesh records are updated and the buffers change, so anything recorded
+  // against the pool has to be recorded again. The previous buffers stay alive
+  // until ReleaseRetiredBuffers, which may only be called once command_buffer
+  // has finished executing.
+  auto RecordDefragmentation(vk::CommandBuffer const command_buffer) -> void {
+    auto const src{buffers_};
+    retired_buffers_.emplace_back(src);
+    buffers_ = CreateBufferSet();
+
+    vertex_allocator_.Reset();
+    index_allocator_.Reset();
+
+    std::vector<MeshRecord*> live_meshes;
+
+    for (auto& mesh : meshes_) {
+      if (mesh) {
+        live_meshes.emplace_back(&*mesh);
+      }
+    }
+
+    // Allocating in the order of the old offsets from an empty allocator packs
+    // the meshes while preserving their relative order
+    std::vector<std::vector<vk::BufferCopy>> vertex_copies(
+      vertex_strides_.size());
+    std::ranges::sort(live_meshes, {}, &MeshRecord::vertex_offset);
+
+    for (auto* const mesh : live_meshes) {
+      auto const offset{*vertex_allocator_.Allocate(mesh->vertex_count)};
+
+      for (std::size_t i{0}; i < vertex_strides_.size(); i++) {
+        vertex_copies[i].emplace_back(
+          static_cast<vk::DeviceSize>(mesh->vertex_offset) * vertex_strides_[i],
+          offset * vertex_strides_[i],
+          mesh->vertex_count * vertex_strides_[i]);
+      }
+
+      mesh->vertex_offset = static_cast<std::int32_t>(offset);
+    }
+
+    std::vector<vk::BufferCopy> index_copies;
+    std::ranges::sort(live_meshes, {}, &MeshRecord::first_index);
+
+    for (auto* const mesh : live_meshes) {
+      auto const offset{*index_allocator_.Allocate(mesh->index_count)};
+      index_copies.emplace_back(mesh->first_index * sizeof(std::uint32_t),
+                                offset * sizeof(std::uint32_t),
+                                mesh->index_count * sizeof(std::uint32_t));
+      mesh->first_index = offset;
+    }
+
+    // The old buffers may still be read by earlier draws and the new ones are
+    // read by later ones
+    vk::MemoryBarrier2 constexpr src_barrier{
+      vk::PipelineStageFlagBits2::eAllCommands,
+      vk::AccessFlagBits2::eMemoryWrite, vk::PipelineStageFlagBits2::eCopy,
+      vk::AccessFlagBits2::eTransferRead
+    };
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, src_barrier});
+
+    if (!live_meshes.empty()) {
+      for (std::size_t i{0}; i < vertex_strides_.size(); i++) {
+        command_buffer.copyBuffer(src.vertex_buffers[i],
+                                  buffers_.vertex_buffers[i], vertex_copies[i]);
+      }
+
+      command_buffer.copyBuffer(src.index_buffer, buffers_.index_buffer,
+                                index_copies);
+    }
+
+    vk::MemoryBarrier2 constexpr dst_barrier{
+      vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite,
+      vk::PipelineStageFlagBits2::eVertexInput |
+      vk::PipelineStageFlagBits2::eVertexShader,
+      vk::AccessFlagBits2::eVertexAttributeRead |
+      vk::AccessFlagBits2::eIndexRead | vk::AccessFlagBits2::eShaderStorageRead
+    };
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, dst_barrier});
+  }
+
+  auto ReleaseRetiredBuffers() -> void {
+    for (auto const& buffers : retired_buffers_) {
+      DestroyBufferSet(buffers);
+    }
+
+    retired_buffers_.clear();
+  }
+
+  [[nodiscard]] auto GetMesh(
+    MeshHandle const handle) const -> MeshRecord const& {
+    return *meshes_[handle];
+  }
+
+  [[nodiscard]] auto GetDrawCommand(MeshHandle const handle,
+                                    std::uint32_t const instance_count = 1,
+                                    std::uint32_t const first_instance = 0)
+  const -> vk::DrawIndexedIndirectCommand {
+    auto const& mesh{*meshes_[handle]};
+    return vk::DrawIndexedIndirectCommand{
+      mesh.index_count, instance_count, mesh.first_index, mesh.vertex_offset,
+      first_instance
+    };
+  }
+
+  [[nodiscard]] auto GetVertexBuffer(
+    std::size_t const stream) const -> vk::Buffer {
+    return buffers_.vertex_buffers[stream];
+  }
+
+  [[nodiscard]] auto GetIndexBuffer() const -> vk::Buffer {
+    return buffers_.index_buffer;
+  }
+
+  [[nodiscard]] static auto GetIndexType() -> vk::IndexType {
+    return vk::IndexType::eUint32;
+  }
+
+  [[nodiscard]] auto GetStats() const -> Stats {
+    return Stats{
+      meshes_.size() - free_handles_.size(),
+      vertex_allocator_.GetAllocatedSize(), vertex_allocator_.GetCapacity(),
+      index_allocator_.GetAllocatedSize(), index_allocator_.GetCapacity(),
+      vertex_allocator_.GetFreeRangeCount(),
+      index_allocator_.GetFreeRangeCount()
+    };
+  }
+
+private:
+  // All buffers of a set are placed into a single allocation
+  struct BufferSet {
+    std::vector<vk::Buffer> vertex_buffers;
+    vk::Buffer index_buffer;
+    vk::DeviceMemory memory;
+  };
+
+  [[nodiscard]] auto CreateBufferSet() const -> BufferSet {
+    BufferSet set;
+    std::vector<vk::Buffer> buffers;
+
+    for (auto const stride : vertex_strides_) {
+      buffers.emplace_back(device_.createBuffer(vk::BufferCreateInfo{
+        {}, stride * vertex_allocator_.GetCapacity(),
+        vk::BufferUsageFlagBits::eVertexBuffer |
+        vk::BufferUsageFlagBits::eTransferSrc |
+        vk::BufferUsageFlagBits::eTransferDst | extra_vertex_usage_,
+        vk::SharingMode::eExclusive
+      }));
+      set.vertex_buffers.emplace_back(buffers.back());
+    }
+
+    set.index_buffer = device_.createBuffer(vk::BufferCreateInfo{
+      {}, sizeof(std::uint32_t) * index_allocator_.GetCapacity(),
+      vk::BufferUsageFlagBits::eIndexBuffer |
+      vk::BufferUsageFlagBits::eTransferSrc |
+      vk::BufferUsageFlagBits::eTransferDst, vk::SharingMode::eExclusive
+    });
+    buffers.emplace_back(set.index_buffer);
+
+    std::vector<vk::DeviceSize> offsets;
+    vk::DeviceSize size{0};
+    auto memory_type_bits{~std::uint32_t{0}};
+
+    for (auto const buffer : buffers) {
+      auto const mem_req{device_.getBufferMemoryRequirements(buffer)};
+      size = (size + mem_req.alignment - 1) / mem_req.alignment * mem_req.
+             alignment;
+      offsets.emplace_back(size);
+      size += mem_req.size;
+      memory_type_bits &= mem_req.memoryTypeBits;
+    }
+
+    // Buffers used through their device address need memory allocated with
+    // the matching flag
+    vk::MemoryAllocateFlagsInfo const memory_allocate_flags_info{
+      extra_vertex_usage_ & vk::BufferUsageFlagBits::eShaderDeviceAddress
+        ? vk::MemoryAllocateFlagBits::eDeviceAddress
+        : vk::MemoryAllocateFlags{}
+    };
+
+    set.memory = device_.allocateMemory(vk::MemoryAllocateInfo{
+      size,
+      FindMemoryType(memory_type_bits,
+                     vk::MemoryPropertyFlagBits::eDeviceLocal),
+      &memory_allocate_flags_info
+    });
+
+    for (std::size_t i{0}; i < buffers.size(); i++) {
+      device_.bindBufferMemory(buffers[i], set.memory, offsets[i]);
+    }
+
+    return set;
+  }
+
+  auto DestroyBufferSet(BufferSet const& set) const -> void {
+    for (auto const buffer : set.vertex_buffers) {
+      device_.destroyBuffer(buffer);
+    }
+
+    device_.destroyBuffer(set.index_buffer);
+    device_.freeMemory(set.memory);
+  }
+
+  [[nodiscard]] auto FindMemoryType(std::uint32_t const type_filter,
+                                    vk::MemoryPropertyFlags const properties)
+  const -> std::uint32_t {
+    for (std::uint32_t i{0}; i < memory_properties_.memoryTypeCount; i++) {
+      if ((type_filter & (1 << i)) && (memory_properties_.memoryTypes[i].
+        propertyFlags & properties) == properties) {
+        return i;
+      }
+    }
+
+    throw std::runtime_error{"Failed to find suitable memory type."};
+  }
+
+  vk::Device device_;
+  vk::PhysicalDeviceMemoryProperties memory_properties_;
+  std::vector<vk::DeviceSize> vertex_strides_;
+  vk::BufferUsageFlags extra_vertex_usage_;
+
+  FreeListAllocator vertex_allocator_;
+  FreeListAllocator index_allocator_;
+  BufferSet buffers_;
+  std::vector<BufferSet> retired_buffers_;
+
+  std::vector<std::optional<MeshRecord>> meshes_;
+  std::vector<MeshHandle> free_handles_;
+};
+
+#endif
@@ -1,3 +1,67 @@
+/* Vulkan test project
+ * Define MSAA_SAMPLE_COUNT to render with a fixed multisample count. Devices not supporting it are skipped.
+ * Define MSAA_MAX_SAMPLE_COUNT to cap the multisample count picked from the device limits.
+ * Without either, the highest sample count supported by the device is used.
+ * Press 1 for MSAA, 2 for FXAA, 3 for FXAA with sharpening. The post processing modes render the scene into a 1x HDR
+ * target and run a compute chain of tonemapping, FXAA and optional sharpening before copying into the swap chain.
+ * Frame times are printed every second and compared per mode on exit.
+ * Press D to toggle dynamic resolution. The scene is rendered into targets allocated at the swap chain size, but only
+ * a scaled region of them is drawn to and then upscaled into the swap chain. The scale is adjusted every frame from GPU
+ * timestamps to keep the GPU frame time at DYNAMIC_RESOLUTION_TARGET_MS.
+ * Press R to toggle pre-recorded command buffers. One command buffer is recorded per swap chain image and frame slot
+ * pair and replayed until the render graph is rebuilt or the render extent changes.
+ * Scene updates run on a simulation thread that prepares the next frame's snapshot while the main thread records and
+ * submits the current one. The snapshots are handed over through a lock-free triple buffer.
+ * Define NO_SIMULATION_THREAD to update the scene on the render thread instead.
+ * Define SIMULATION_BUSY_WORK_US to add artificial CPU work to every scene update to emulate a heavy scene.
+ * Press Z to toggle the depth prepass. It draws the position-only vertex stream into the depth buffer first, then the
+ * scene pass runs with an equal depth test and without depth writes, so every pixel is shaded exactly once.
+ * Press V to toggle vertex pulling. The scene vertex shader then reads the vertex buffer through its buffer device
+ * address instead of using vertex input attributes. Requires the bufferDeviceAddress feature.
+ * Where VK_EXT_host_image_copy is supported, the texture and its CPU generated mips are written straight into the
+ * optimally tiled image on a worker thread, without staging memory or command buffers. Otherwise it goes through a
+ * staging buffer and the mips are blitted on the GPU. Define NO_HOST_IMAGE_COPY to always use the staging path.
+ * Define TEXTURE_UPLOAD_BENCHMARK to time both upload paths on a large generated texture at startup.
+ * Press M to toggle multiview. The scene is drawn once with a view mask into layered color and depth targets, one layer
+ * per view, and the vertex shader picks each view's matrices by gl_ViewIndex. The layers are then blitted side by side
+ * into the swap chain. MULTIVIEW_VIEW_COUNT sets the number of views, 6 renders the faces of a cube map around the
+ * camera. The depth prepass, post processing and dynamic resolution are skipped in multiview mode.
+ * The scene is lit by LIGHT_COUNT animated point lights with clustered forward shading. The lights are written into a
+ * per frame storage buffer every frame, a compute pass bins them into a view space cluster grid, and the fragment
+ * shader only loops over the lights of its own cluster. Multiview mode renders unlit.
+ * Press O to toggle on-demand rendering. Frames are then only drawn when the window, the settings or the scene snapshot
+ * changed since the last drawn one, otherwise the loop sleeps until a window message arrives or a timeout passes.
+ * Press P to pause the animation so the scene stops changing. Drawn and idle frame counts and the latency from waking
+ * up to presenting are printed every second and in total on exit.
+ */
+
+// Uncomment this if you want to render with a fixed sample count
+// #define MSAA_SAMPLE_COUNT 4
+
+// Uncomment this if you want to cap the sample count picked from the device limits
+// #define MSAA_MAX_SAMPLE_COUNT 8
+
+// Uncomment this if you want to update the scene on the render thread
+// #define NO_SIMULATION_THREAD
+
+// Uncomment this if you want to emulate a heavy scene update
+// #define SIMULATION_BUSY_WORK_US 4000
+
+// Uncomment this if you want to always upload textures through staging buffers
+// #define NO_HOST_IMAGE_COPY
+
+// Uncomment this if you want to compare the texture upload paths
+// #define TEXTURE_UPLOAD_BENCHMARK
+
+// GPU frame time in milliseconds the dynamic resolution controller aims for
+#define DYNAMIC_RESOLUTION_TARGET_MS 16.0
+
+// Number of views drawn in multiview mode, 2 for a stereo pair or 6 for the faces of a cube map
+#define MULTIVIEW_VIEW_COUNT 2
+
+// Number of point lights in the scene
+#define LIGHT_COUNT 1024
+
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm.hpp>
@@ -19,28 +83,47 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <bit>
 #include <chrono>
 #include <cmath>
+#include <compare>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <limits>
+#include <map>
 #include <memory>
 #include <optional>
+#include <random>
 #include <set>
 #include <span>
 #include <string>
 #include <string_view>
 #include <stdexcept>
+#include <stop_token>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "geometry_pool.h"
+#include "render_graph.h"
+#include "staging_stream.h"
+#include "triple_buffer.h"
 #include "shaders/generated/vertex.h"
+#include "shaders/generated/depth_prepass.h"
+#include "shaders/generated/vertex_pulling.h"
 #include "shaders/generated/fragment.h"
+#include "shaders/generated/tonemap.h"
+#include "shaders/generated/fxaa.h"
+#include "shaders/generated/sharpen.h"
+#include "shaders/generated/light_culling.h"
 #include "shaders/interop.h"
 
 #ifndef NDEBUG
@@ -66,6 +149,24 @@ VKAPI_ATTR auto VKAPI_CALL vkDestroyDebugUtilsMessengerEXT(
 }
 #endif
 
+namespace {
+PFN_vkTransitionImageLayoutEXT pfn_vk_transition_image_layout_ext;
+PFN_vkCopyMemoryToImageEXT pfn_vk_copy_memory_to_image_ext;
+}
+
+VKAPI_ATTR auto VKAPI_CALL vkTransitionImageLayoutEXT(
+  VkDevice const device, std::uint32_t const transitionCount,
+  VkHostImageLayoutTransitionInfoEXT const* const pTransitions) -> VkResult {
+  return pfn_vk_transition_image_layout_ext(device, transitionCount,
+                                            pTransitions);
+}
+
+VKAPI_ATTR auto VKAPI_CALL vkCopyMemoryToImageEXT(
+  VkDevice const device,
+  VkCopyMemoryToImageInfoEXT const* const pCopyMemoryToImageInfo) -> VkResult {
+  return pfn_vk_copy_memory_to_image_ext(device, pCopyMemoryToImageInfo);
+}
+
 struct Vertex {
   glm::vec3 pos;
   glm::vec3 color;
@@ -95,6 +196,63 @@ struct Vertex {
   }
 };
 
+// vertex_pulling.vert decodes vertices as 8 tightly packed floats
+static_assert(sizeof(Vertex) == 8 * sizeof(float));
+
+static_assert(MULTIVIEW_VIEW_COUNT >= 1 &&
+  MULTIVIEW_VIEW_COUNT <= MULTIVIEW_MAX_VIEW_COUNT);
+
+// Features the scene shaders are specialized for. Every member is the value of
+// the specialization constant with the matching id in interop.h, so the code
+// of disabled features is removed when the pipeline is compiled instead of
+// being branched around at runtime.
+struct SceneShaderVariant {
+  vk::Bool32 vertex_color{vk::True};
+  vk::Bool32 texture{vk::True};
+  vk::Bool32 multiview{vk::False};
+  vk::Bool32 clustered_lighting{vk::True};
+
+  auto operator<=>(SceneShaderVariant const& other) const = default;
+
+  [[nodiscard]] static auto
+  GetMapEntries() -> std::array<vk::SpecializationMapEntry, 4> {
+    return std::array{
+      vk::SpecializationMapEntry{
+        SCENE_CONSTANT_VERTEX_COLOR, offsetof(SceneShaderVariant, vertex_color),
+        sizeof(vk::Bool32)
+      },
+      vk::SpecializationMapEntry{
+        SCENE_CONSTANT_TEXTURE, offsetof(SceneShaderVariant, texture),
+        sizeof(vk::Bool32)
+      },
+      vk::SpecializationMapEntry{
+        SCENE_CONSTANT_MULTIVIEW, offsetof(SceneShaderVariant, multiview),
+        sizeof(vk::Bool32)
+      },
+      vk::SpecializationMapEntry{
+        SCENE_CONSTANT_CLUSTERED_LIGHTING,
+        offsetof(SceneShaderVariant, clustered_lighting), sizeof(vk::Bool32)
+      },
+    };
+  }
+};
+
+enum class ScenePipelineKind : std::uint8_t {
+  kDepthPrepass,
+  kShading,
+  kShadingDepthEqual,
+  kMultiview,
+};
+
+// Everything a scene pipeline differs in besides the render target formats
+struct ScenePipelineKey {
+  ScenePipelineKind kind;
+  bool vertex_pulling;
+  SceneShaderVariant shader_variant;
+
+  auto operator<=>(ScenePipelineKey const& other) const = default;
+};
+
 [[nodiscard]] auto operator==(Vertex const& lhs, Vertex const& rhs) -> bool {
   return lhs.pos == rhs.pos && lhs.color == rhs.color && lhs.uv == rhs.uv;
 }
@@ -108,6 +266,12 @@ struct std::hash<Vertex> {
   }
 };
 
+enum class AntiAliasing : std::uint8_t {
+  kMsaa,
+  kFxaa,
+  kFxaaSharpen
+};
+
 class Application {
 public:
   Application() {
@@ -159,7 +323,7 @@ public:
 
     vk::ApplicationInfo constexpr app_info{
       "Vulkan Test", VK_MAKE_VERSION(0, 1, 0), "No Engine",
-      VK_MAKE_VERSION(0, 1, 0), VK_API_VERSION_1_0
+      VK_MAKE_VERSION(0, 1, 0), VK_API_VERSION_1_3
     };
 
     std::vector enabled_instance_extensions{
@@ -205,7 +369,7 @@ public:
       {}, window_class.hInstance, hwnd_.get()
     });
 
-    std::array constexpr enabled_device_extensions{
+    std::vector<char const*> enabled_device_extensions{
       VK_KHR_SWAPCHAIN_EXTENSION_NAME
     };
 
@@ -242,8 +406,18 @@ public:
         continue;
       }
 
-      if (auto const physical_device_features{physical_device.getFeatures()};
-        physical_device_features.samplerAnisotropy == vk::False) {
+      if (physical_device.getProperties().apiVersion < VK_API_VERSION_1_3) {
+        continue;
+      }
+
+      if (auto const physical_device_features{
+        physical_device.getFeatures2<vk::PhysicalDeviceFeatures2,
+                                     vk::PhysicalDeviceVulkan13Features>()
+      }; physical_device_features.get<vk::PhysicalDeviceFeatures2>().features.
+         samplerAnisotropy == vk::False || physical_device_features.get<
+           vk::PhysicalDeviceVulkan13Features>().synchronization2 == vk::False
+         || physical_device_features.get<vk::PhysicalDeviceVulkan13Features>().
+         dynamicRendering == vk::False) {
         continue;
       }
 
@@ -251,8 +425,17 @@ public:
         continue;
       }
 
+      auto const sample_count{
+        SelectSampleCount(physical_device, sample_count_policy_)
+      };
+
+      if (!sample_count) {
+        continue;
+      }
+
       physical_device_ = physical_device;
-      msaa_samples_ = GetMaxUsableSampleCount();
+      max_msaa_samples_ = *sample_count;
+      msaa_samples_ = max_msaa_samples_;
       break;
     }
 
@@ -260,6 +443,27 @@ public:
       throw std::runtime_error{"Failed to find a suitable GPU."};
     }
 
+    vertex_pulling_supported_ = physical_device_.getFeatures2<
+      vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>().get<
+      vk::PhysicalDeviceVulkan12Features>().bufferDeviceAddress == vk::True;
+
+    if (!vertex_pulling_supported_) {
+      std::cout << "Buffer device addresses are not supported, vertex pulling "
+        "is disabled.\n";
+    }
+
+#ifndef NO_HOST_IMAGE_COPY
+    host_image_copy_supported_ = IsHostImageCopySupported();
+#endif
+
+    if (host_image_copy_supported_) {
+      enabled_device_extensions.emplace_back(
+        VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+    } else {
+      std::cout << "Host image copies are not available, textures are "
+        "uploaded through staging buffers.\n";
+    }
+
     auto const [graphics_queue_family_idx, present_queue_family_idx]{
       FindQueueFamilies(physical_device_)
     };
@@ -288,155 +492,62 @@ public:
       }()
     };
 
-    device_ = physical_device_.createDevice(vk::DeviceCreateInfo{
-      {}, queue_create_infos, enabled_layers, enabled_device_extensions,
-      &enabled_device_features
-    });
-
-    graphics_queue_ = device_.getQueue(graphics_queue_family_idx.value(), 0);
-    present_queue_ = device_.getQueue(present_queue_family_idx.value(), 0);
-
-    CreateSwapChainAndViews();
-
-    vk::AttachmentDescription const color_attachment{
-      {}, swap_chain_image_format_, msaa_samples_, vk::AttachmentLoadOp::eClear,
-      vk::AttachmentStoreOp::eStore, vk::AttachmentLoadOp::eDontCare,
-      vk::AttachmentStoreOp::eDontCare, vk::ImageLayout::eUndefined,
-      vk::ImageLayout::eColorAttachmentOptimal
-    };
-
-    vk::AttachmentReference constexpr color_attachment_ref{
-      0, vk::ImageLayout::eColorAttachmentOptimal
-    };
-
-    vk::AttachmentDescription const depth_attachment{
-      {}, FindDepthFormat(), msaa_samples_, vk::AttachmentLoadOp::eClear,
-      vk::AttachmentStoreOp::eDontCare, vk::AttachmentLoadOp::eDontCare,
-      vk::AttachmentStoreOp::eDontCare, vk::ImageLayout::eUndefined,
-      vk::ImageLayout::eDepthStencilAttachmentOptimal
-    };
-
-    vk::AttachmentReference constexpr depth_attachment_ref{
-      1, vk::ImageLayout::eDepthStencilAttachmentOptimal
-    };
-
-    vk::AttachmentDescription const color_resolve_attachment{
-      {}, swap_chain_image_format_, vk::SampleCountFlagBits::e1,
-      vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eStore,
-      vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eDontCare,
-      vk::ImageLayout::eUndefined, vk::ImageLayout::ePresentSrcKHR
-    };
-
-    vk::AttachmentReference constexpr color_resolve_attachment_ref{
-      2, vk::ImageLayout::eColorAttachmentOptimal
-    };
-
-    vk::SubpassDescription const subpass_desc{
-      {}, vk::PipelineBindPoint::eGraphics, {}, color_attachment_ref,
-      color_resolve_attachment_ref, &depth_attachment_ref
-    };
-
-    vk::SubpassDependency constexpr subpass_dep{
-      vk::SubpassExternal, 0,
-      vk::PipelineStageFlagBits::eColorAttachmentOutput |
-      vk::PipelineStageFlagBits::eEarlyFragmentTests,
-      vk::PipelineStageFlagBits::eColorAttachmentOutput |
-      vk::PipelineStageFlagBits::eEarlyFragmentTests,
-      {},
-      vk::AccessFlagBits::eColorAttachmentWrite |
-      vk::AccessFlagBits::eDepthStencilAttachmentWrite,
-      {}
-    };
-
-    std::array const attachments{
-      color_attachment, depth_attachment, color_resolve_attachment
-    };
-
-    render_pass_ = device_.createRenderPass(vk::RenderPassCreateInfo{
-      {}, attachments, subpass_desc, subpass_dep
-    });
-
-    auto const vertex_shader_module{
-      device_.createShaderModule(vk::ShaderModuleCreateInfo{{}, g_vertex_bin})
-    };
-    auto const fragment_shader_module{
-      device_.createShaderModule(vk::ShaderModuleCreateInfo{{}, g_fragment_bin})
-    };
-
-    std::array const pipeline_shader_stage_create_infos{
-      vk::PipelineShaderStageCreateInfo{
-        {}, vk::ShaderStageFlagBits::eVertex, vertex_shader_module, "main"
+    vk::StructureChain device_create_info_chain{
+      vk::DeviceCreateInfo{
+        {}, queue_create_infos, enabled_layers, enabled_device_extensions
       },
-      vk::PipelineShaderStageCreateInfo{
-        {}, vk::ShaderStageFlagBits::eFragment, fragment_shader_module, "main"
-      },
-    };
-
-    std::array constexpr dynamic_states{
-      vk::DynamicState::eViewport, vk::DynamicState::eScissor
-    };
-
-    vk::PipelineDynamicStateCreateInfo const pipeline_dynamic_state_create_info{
-      {}, dynamic_states
-    };
-
-    auto constexpr vertex_input_binding_description{
-      Vertex::GetBindingDescription()
-    };
-    auto const vertex_input_attribute_descriptions{
-      Vertex::GetAttributeDescriptions()
+      vk::PhysicalDeviceFeatures2{enabled_device_features},
+      vk::PhysicalDeviceVulkan13Features{}.setSynchronization2(vk::True).
+      setDynamicRendering(vk::True),
+      vk::PhysicalDeviceVulkan12Features{}.setBufferDeviceAddress(
+        vertex_pulling_supported_),
+      // Multiview is required by Vulkan 1.1, the shaders using gl_ViewIndex
+      // need it enabled even when not rendering with a view mask
+      vk::PhysicalDeviceVulkan11Features{}.setMultiview(vk::True),
+      vk::PhysicalDeviceHostImageCopyFeaturesEXT{vk::True}
     };
 
-    vk::PipelineVertexInputStateCreateInfo const
-      pipeline_vertex_input_state_create_info{
-        {}, vertex_input_binding_description,
-        vertex_input_attribute_descriptions
-      };
-
-    vk::PipelineInputAssemblyStateCreateInfo constexpr
-      pipeline_input_assembly_state_create_info{
-        {}, vk::PrimitiveTopology::eTriangleList, vk::False
-      };
+    if (!host_image_copy_supported_) {
+      device_create_info_chain.unlink<
+        vk::PhysicalDeviceHostImageCopyFeaturesEXT>();
+    }
 
-    vk::PipelineViewportStateCreateInfo constexpr
-      pipeline_viewport_state_create_info{{}, 1, nullptr, 1, nullptr};
+    device_ = physical_device_.createDevice(device_create_info_chain.get());
 
-    vk::PipelineRasterizationStateCreateInfo constexpr
-      pipeline_rasterization_state_create_info{
-        {}, vk::False, vk::False, vk::PolygonMode::eFill,
-        vk::CullModeFlagBits::eBack, vk::FrontFace::eCounterClockwise,
-        vk::False, 0, 0, 0, 1.0f
-      };
+    if (host_image_copy_supported_) {
+      pfn_vk_transition_image_layout_ext = std::bit_cast<
+        PFN_vkTransitionImageLayoutEXT>(device_.getProcAddr(
+        "vkTransitionImageLayoutEXT"));
+      pfn_vk_copy_memory_to_image_ext = std::bit_cast<
+        PFN_vkCopyMemoryToImageEXT>(device_.getProcAddr(
+        "vkCopyMemoryToImageEXT"));
+    }
 
-    vk::PipelineMultisampleStateCreateInfo const
-      pipeline_multisample_state_create_info{
-        {}, msaa_samples_, vk::False, 1, nullptr, vk::False, vk::False
-      };
+    graphics_queue_ = device_.getQueue(graphics_queue_family_idx.value(), 0);
+    present_queue_ = device_.getQueue(present_queue_family_idx.value(), 0);
 
-    vk::PipelineDepthStencilStateCreateInfo constexpr
-      pipeline_depth_stencil_state_create_info{
-        {}, vk::True, vk::True, vk::CompareOp::eLess, vk::False, vk::False, {},
-        {}, 0, 1
-      };
+    timestamp_period_ = physical_device_.getProperties().limits.timestampPeriod;
+    timestamps_supported_ = physical_device_.getQueueFamilyProperties()[
+      graphics_queue_family_idx.value()].timestampValidBits != 0;
 
-    vk::PipelineColorBlendAttachmentState constexpr
-      pipeline_color_blend_attachment_state{
-        vk::False, vk::BlendFactor::eOne, vk::BlendFactor::eZero,
-        vk::BlendOp::eAdd, vk::BlendFactor::eOne, vk::BlendFactor::eZero,
-        vk::BlendOp::eAdd,
-        vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
-        vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA
-      };
+    if (timestamps_supported_) {
+      timestamp_query_pool_ = device_.createQueryPool(vk::QueryPoolCreateInfo{
+        {}, vk::QueryType::eTimestamp, 2 * max_frames_in_flight_
+      });
+    } else {
+      std::cout << "The graphics queue does not support timestamps, dynamic "
+        "resolution is disabled.\n";
+    }
 
-    vk::PipelineColorBlendStateCreateInfo const color_blend_state_create_info{
-      {}, vk::False, vk::LogicOp::eCopy, pipeline_color_blend_attachment_state,
-      {0, 0, 0, 0}
-    };
+    CreateSwapChainAndViews();
 
+    // The light culling pass uses the same set as the scene, so the lights,
+    // the clusters and the uniform buffer are bound once for both
     std::array constexpr descriptor_set_layout_bindings{
       vk::DescriptorSetLayoutBinding{
         0, vk::DescriptorType::eUniformBuffer, 1,
-        vk::ShaderStageFlagBits::eVertex
+        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment |
+        vk::ShaderStageFlagBits::eCompute
       },
       vk::DescriptorSetLayoutBinding{
         1, vk::DescriptorType::eSampledImage, 1,
@@ -444,98 +555,59 @@ public:
       },
       vk::DescriptorSetLayoutBinding{
         2, vk::DescriptorType::eSampler, 1, vk::ShaderStageFlagBits::eFragment
+      },
+      vk::DescriptorSetLayoutBinding{
+        3, vk::DescriptorType::eStorageBuffer, 1,
+        vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute
+      },
+      vk::DescriptorSetLayoutBinding{
+        4, vk::DescriptorType::eStorageBuffer, 1,
+        vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute
       }
     };
 
     descriptor_set_layout_ = device_.createDescriptorSetLayout(
       vk::DescriptorSetLayoutCreateInfo{{}, descriptor_set_layout_bindings});
 
-    pipeline_layout_ = device_.createPipelineLayout(
-      vk::PipelineLayoutCreateInfo{{}, descriptor_set_layout_});
+    vk::PushConstantRange constexpr push_constant_range{
+      vk::ShaderStageFlagBits::eVertex, 0, sizeof(VertexPullingPushConstants)
+    };
 
-    if (auto const& [result, value]{
-      device_.createGraphicsPipeline(
-        VK_NULL_HANDLE, vk::GraphicsPipelineCreateInfo{
-          {}, pipeline_shader_stage_create_infos,
-          &pipeline_vertex_input_state_create_info,
-          &pipeline_input_assembly_state_create_info, nullptr,
-          &pipeline_viewport_state_create_info,
-          &pipeline_rasterization_state_create_info,
-          &pipeline_multisample_state_create_info,
-          &pipeline_depth_stencil_state_create_info,
-          &color_blend_state_create_info, &pipeline_dynamic_state_create_info,
-          pipeline_layout_, render_pass_, 0, VK_NULL_HANDLE, -1
-        })
-    }; result == vk::Result::eSuccess) {
-      pipeline_ = value;
-    } else {
-      throw std::runtime_error{"Failed to create graphics pipeline."};
-    }
+    pipeline_layout_ = device_.createPipelineLayout(
+      vk::PipelineLayoutCreateInfo{
+        {}, descriptor_set_layout_, push_constant_range
+      });
 
-    device_.destroyShaderModule(fragment_shader_module);
-    device_.destroyShaderModule(vertex_shader_module);
+    CreatePostProcessingPipelines();
+    pipeline_cache_ = device_.createPipelineCache(
+      vk::PipelineCacheCreateInfo{});
+    CreateLightCullingPipeline();
 
     command_pool_ = device_.createCommandPool(vk::CommandPoolCreateInfo{
       vk::CommandPoolCreateFlagBits::eResetCommandBuffer
     });
 
-    CreateColorResources();
-    CreateDepthResources();
-    CreateFramebuffers();
-
-    int width;
-    int height;
-    int channel_count;
-    auto const pixel_data{
-      stbi_load(texture_path_.data(), &width, &height, &channel_count,
-                STBI_rgb_alpha)
-    };
-
-    if (!pixel_data) {
-      throw std::runtime_error{"Failed to load texture image."};
-    }
-
-    mip_levels_ = static_cast<std::uint32_t>(std::log2(std::max(width, height)))
-      + 1;
-
-    auto staging_buffer_size{static_cast<vk::DeviceSize>(width) * height * 4};
-
-    vk::Buffer staging_buffer;
-    vk::DeviceMemory staging_buffer_memory;
-
-    CreateBuffer(staging_buffer_size, vk::BufferUsageFlagBits::eTransferSrc,
-                 vk::MemoryPropertyFlagBits::eHostVisible |
-                 vk::MemoryPropertyFlagBits::eHostCoherent, staging_buffer,
-                 staging_buffer_memory);
+    CreateRenderGraph();
 
-    auto staging_buffer_ptr{
-      device_.mapMemory(staging_buffer_memory, {}, staging_buffer_size)
+    // Host image copies use neither the queue nor the command pool, so the
+    // texture can be uploaded on a worker thread while the model is loaded
+    auto texture_upload{
+      std::async(host_image_copy_supported_
+                   ? std::launch::async
+                   : std::launch::deferred, [this] { return LoadTexture(); })
     };
-    std::memcpy(staging_buffer_ptr, pixel_data, staging_buffer_size);
-    device_.unmapMemory(staging_buffer_memory);
-
-    stbi_image_free(pixel_data);
 
-    CreateImage(width, height, mip_levels_, vk::SampleCountFlagBits::e1,
-                vk::Format::eR8G8B8A8Srgb, vk::ImageTiling::eOptimal,
-                vk::ImageUsageFlagBits::eTransferSrc |
-                vk::ImageUsageFlagBits::eTransferDst |
-                vk::ImageUsageFlagBits::eSampled,
-                vk::MemoryPropertyFlagBits::eDeviceLocal, texture_image_,
-                texture_image_memory_);
-
-    TransitionImageLayout(texture_image_, vk::ImageLayout::eUndefined,
-                          vk::ImageLayout::eTransferDstOptimal, mip_levels_);
+    LoadModel();
+    CreateGraphicsPipeline();
 
-    CopyBufferToImage(staging_buffer, texture_image_,
-                      static_cast<std::uint32_t>(width),
-                      static_cast<std::uint32_t>(height));
+    std::cout << "Texture upload " << (host_image_copy_supported_
+                                         ? "with host image copy"
+                                         : "through a staging buffer") <<
+      " took " << texture_upload.get() * 1000.0 << " ms.\n";
 
-    GenerateMipmaps(texture_image_, vk::Format::eR8G8B8A8Srgb, width, height,
-                    mip_levels_);
-
-    device_.destroyBuffer(staging_buffer);
-    device_.freeMemory(staging_buffer_memory);
+#ifdef TEXTURE_UPLOAD_BENCHMARK
+    BenchmarkTextureUpload();
+#endif
 
     texture_image_view_ = CreateImageView(texture_image_,
                                           vk::Format::eR8G8B8A8Srgb,
@@ -552,107 +624,24 @@ public:
       vk::BorderColor::eIntOpaqueBlack, vk::False
     });
 
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string warn;
-    std::string err;
-
-    if (!LoadObj(&attrib, &shapes, &materials, &warn, &err,
-                 model_path_.data())) {
-      throw std::runtime_error{warn + err};
-    }
-
-    std::unordered_map<Vertex, std::uint32_t> unique_vertices;
-
-    for (auto const& [name, mesh, lines, points] : shapes) {
-      for (auto const& [vertex_index, normal_index, texcoord_index] : mesh.
-           indices) {
-        Vertex vertex;
-
-        vertex.pos = {
-          attrib.vertices[3 * vertex_index + 0],
-          attrib.vertices[3 * vertex_index + 1],
-          attrib.vertices[3 * vertex_index + 2],
-        };
-
-        vertex.uv = {
-          attrib.texcoords[2 * texcoord_index + 0],
-          1.0f - attrib.texcoords[2 * texcoord_index + 1],
-        };
-
-        vertex.color = {1.0f, 1.0f, 1.0f};
-
-        if (!unique_vertices.contains(vertex)) {
-          unique_vertices[vertex] = static_cast<std::uint32_t>(vertices_.
-            size());
-          vertices_.emplace_back(vertex);
-        }
-
-        indices_.emplace_back(unique_vertices[vertex]);
-      }
-    }
-
-    staging_buffer_size = sizeof(vertices_[0]) * vertices_.size();
-
-    CreateBuffer(staging_buffer_size, vk::BufferUsageFlagBits::eTransferSrc,
-                 vk::MemoryPropertyFlagBits::eHostVisible |
-                 vk::MemoryPropertyFlagBits::eHostCoherent, staging_buffer,
-                 staging_buffer_memory);
-
-    staging_buffer_ptr = device_.mapMemory(staging_buffer_memory, 0,
-                                           staging_buffer_size);
-    std::memcpy(staging_buffer_ptr, vertices_.data(), staging_buffer_size);
-    device_.unmapMemory(staging_buffer_memory);
-
-    CreateBuffer(staging_buffer_size,
-                 vk::BufferUsageFlagBits::eTransferDst |
-                 vk::BufferUsageFlagBits::eVertexBuffer,
-                 vk::MemoryPropertyFlagBits::eDeviceLocal, vertex_buffer_,
-                 vertex_buffer_memory_);
-    CopyBuffer(staging_buffer, vertex_buffer_, staging_buffer_size);
-
-    device_.destroyBuffer(staging_buffer);
-    device_.freeMemory(staging_buffer_memory);
-
-    staging_buffer_size = sizeof(indices_[0]) * indices_.size();
-
-    CreateBuffer(staging_buffer_size, vk::BufferUsageFlagBits::eTransferSrc,
-                 vk::MemoryPropertyFlagBits::eHostVisible |
-                 vk::MemoryPropertyFlagBits::eHostCoherent, staging_buffer,
-                 staging_buffer_memory);
-
-    staging_buffer_ptr = device_.mapMemory(staging_buffer_memory, 0,
-                                           staging_buffer_size);
-    std::memcpy(staging_buffer_ptr, indices_.data(), staging_buffer_size);
-    device_.unmapMemory(staging_buffer_memory);
-
-    CreateBuffer(staging_buffer_size,
-                 vk::BufferUsageFlagBits::eTransferDst |
-                 vk::BufferUsageFlagBits::eIndexBuffer,
-                 vk::MemoryPropertyFlagBits::eDeviceLocal, index_buffer_,
-                 index_buffer_memory_);
-    CopyBuffer(staging_buffer, index_buffer_, staging_buffer_size);
-
-    device_.destroyBuffer(staging_buffer);
-    device_.freeMemory(staging_buffer_memory);
-
-    staging_buffer_size = sizeof(UniformBufferObject);
+    vk::DeviceSize constexpr uniform_buffer_size{sizeof(UniformBufferObject)};
 
     uniform_buffers_.resize(max_frames_in_flight_);
     uniform_buffer_memories_.resize(max_frames_in_flight_);
     uniform_buffers_mapped_.resize(max_frames_in_flight_);
 
     for (auto i{0}; i < max_frames_in_flight_; i++) {
-      CreateBuffer(staging_buffer_size, vk::BufferUsageFlagBits::eUniformBuffer,
+      CreateBuffer(uniform_buffer_size, vk::BufferUsageFlagBits::eUniformBuffer,
                    vk::MemoryPropertyFlagBits::eHostVisible |
                    vk::MemoryPropertyFlagBits::eHostCoherent,
                    uniform_buffers_[i], uniform_buffer_memories_[i]);
 
       uniform_buffers_mapped_[i] = device_.mapMemory(
-        uniform_buffer_memories_[i], 0, staging_buffer_size);
+        uniform_buffer_memories_[i], 0, uniform_buffer_size);
     }
 
+    CreateLightBuffers();
+
     std::array constexpr descriptor_pool_sizes{
       vk::DescriptorPoolSize{
         vk::DescriptorType::eUniformBuffer,
@@ -665,6 +654,10 @@ public:
       vk::DescriptorPoolSize{
         vk::DescriptorType::eSampler,
         static_cast<std::uint32_t>(max_frames_in_flight_)
+      },
+      vk::DescriptorPoolSize{
+        vk::DescriptorType::eStorageBuffer,
+        static_cast<std::uint32_t>(2 * max_frames_in_flight_)
       }
     };
 
@@ -686,10 +679,15 @@ public:
         uniform_buffers_[i], 0, sizeof(UniformBufferObject)
       };
       vk::DescriptorImageInfo const image_info{
-        VK_NULL_HANDLE, texture_image_view_,
-        vk::ImageLayout::eShaderReadOnlyOptimal
+        VK_NULL_HANDLE, texture_image_view_, texture_image_layout_
       };
       vk::DescriptorImageInfo const sampler_info{texture_sampler_};
+      vk::DescriptorBufferInfo const light_buffer_info{
+        light_buffers_[i], 0, vk::WholeSize
+      };
+      vk::DescriptorBufferInfo const cluster_buffer_info{
+        cluster_buffers_[i], 0, vk::WholeSize
+      };
 
       device_.updateDescriptorSets(std::array{
                                      vk::WriteDescriptorSet{
@@ -707,6 +705,16 @@ public:
                                        vk::DescriptorType::eSampler,
                                        sampler_info
                                      },
+                                     vk::WriteDescriptorSet{
+                                       descriptor_sets_[i], 3, 0,
+                                       vk::DescriptorType::eStorageBuffer, {},
+                                       light_buffer_info
+                                     },
+                                     vk::WriteDescriptorSet{
+                                       descriptor_sets_[i], 4, 0,
+                                       vk::DescriptorType::eStorageBuffer, {},
+                                       cluster_buffer_info
+                                     },
                                    }, {});
     }
 
@@ -728,12 +736,31 @@ public:
         vk::FenceCreateFlagBits::eSignaled
       }));
     }
-  }
 
-  Application(Application const& other) = delete;
-  Application(Application&& other) = delete;
+    // The first snapshot is ready before the first frame so the render thread
+    // never has to wait for one.
+    last_update_time_ = std::chrono::high_resolution_clock::now();
+    on_demand_window_start_ = last_update_time_;
+    PublishSceneSnapshot(1);
+
+#ifndef NO_SIMULATION_THREAD
+    simulation_thread_ = std::jthread{
+      [this](std::stop_token const stop_token) {
+        SimulationThreadMain(stop_token);
+      }
+    };
+#endif
+  }
+
+  Application(Application const& other) = delete;
+  Application(Application&& other) = delete;
+
+  ~Application() {
+#ifndef NO_SIMULATION_THREAD
+    simulation_thread_.request_stop();
+    simulation_thread_.join();
+#endif
 
-  ~Application() {
     for (auto i{0}; i < max_frames_in_flight_; i++) {
       device_.destroyFence(in_flight_fences_[i]);
       device_.destroySemaphore(render_finished_semaphores_[i]);
@@ -746,13 +773,15 @@ public:
       device_.unmapMemory(uniform_buffer_memories_[i]);
       device_.destroyBuffer(uniform_buffers_[i]);
       device_.freeMemory(uniform_buffer_memories_[i]);
-    }
 
-    device_.destroyBuffer(index_buffer_);
-    device_.freeMemory(index_buffer_memory_);
+      device_.unmapMemory(light_buffer_memories_[i]);
+      device_.destroyBuffer(light_buffers_[i]);
+      device_.freeMemory(light_buffer_memories_[i]);
+      device_.destroyBuffer(cluster_buffers_[i]);
+      device_.freeMemory(cluster_buffer_memories_[i]);
+    }
 
-    device_.destroyBuffer(vertex_buffer_);
-    device_.freeMemory(vertex_buffer_memory_);
+    geometry_pool_.reset();
 
     device_.destroySampler(texture_sampler_);
     device_.destroyImageView(texture_image_view_);
@@ -761,12 +790,23 @@ public:
 
     device_.destroyCommandPool(command_pool_);
 
-    device_.destroyPipeline(pipeline_);
+    device_.destroyQueryPool(timestamp_query_pool_);
+
+    DestroyGraphicsPipelines();
+    device_.destroyPipelineCache(pipeline_cache_);
     device_.destroyPipelineLayout(pipeline_layout_);
+    device_.destroyPipeline(light_culling_pipeline_);
+    device_.destroyPipelineLayout(light_culling_pipeline_layout_);
 
     device_.destroyDescriptorSetLayout(descriptor_set_layout_);
 
-    device_.destroyRenderPass(render_pass_);
+    device_.destroyPipeline(sharpen_pipeline_);
+    device_.destroyPipeline(fxaa_pipeline_);
+    device_.destroyPipeline(tonemap_pipeline_);
+    device_.destroyPipelineLayout(post_process_pipeline_layout_);
+    device_.destroyDescriptorPool(post_process_descriptor_pool_);
+    device_.destroyDescriptorSetLayout(post_process_descriptor_set_layout_);
+    device_.destroySampler(post_process_sampler_);
 
     CleanupSwapChain();
 
@@ -790,6 +830,8 @@ public:
       while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
         if (msg.message == WM_QUIT) {
           device_.waitIdle();
+          PrintFrameTimeComparison();
+          PrintOnDemandTotals();
           return;
         }
 
@@ -797,6 +839,69 @@ public:
         DispatchMessageW(&msg);
       }
 
+      if (requested_anti_aliasing_) {
+        SetAntiAliasing(*requested_anti_aliasing_);
+        requested_anti_aliasing_.reset();
+      }
+
+      if (dynamic_resolution_toggle_requested_) {
+        ToggleDynamicResolution();
+        dynamic_resolution_toggle_requested_ = false;
+      }
+
+      if (vertex_pulling_toggle_requested_) {
+        ToggleVertexPulling();
+        vertex_pulling_toggle_requested_ = false;
+      }
+
+      if (depth_prepass_toggle_requested_) {
+        ToggleDepthPrepass();
+        depth_prepass_toggle_requested_ = false;
+      }
+
+      if (multiview_toggle_requested_) {
+        ToggleMultiview();
+        multiview_toggle_requested_ = false;
+      }
+
+      if (prerecord_toggle_requested_) {
+        prerecord_command_buffers_ = !prerecord_command_buffers_;
+        prerecord_toggle_requested_ = false;
+        InvalidatePrerecordedCommandBuffers();
+        std::cout << "Pre-recorded command buffers " << (
+          prerecord_command_buffers_
+            ? "enabled"
+            : "disabled") << ".\n";
+      }
+
+      if (on_demand_toggle_requested_) {
+        ToggleOnDemandRendering();
+        on_demand_toggle_requested_ = false;
+      }
+
+      if (pause_toggle_requested_) {
+        auto const paused{!animation_paused_.load(std::memory_order_relaxed)};
+        animation_paused_.store(paused, std::memory_order_relaxed);
+        pause_toggle_requested_ = false;
+        std::cout << "Animation " << (paused ? "paused" : "resumed") << ".\n";
+      }
+
+      // The timeout bounds how late a change that does not come with a window
+      // message, like the animation being resumed, is noticed.
+      if (on_demand_rendering_ && !IsFrameNeeded()) {
+        // The time spent sleeping is not frame time
+        last_frame_time_.reset();
+        MsgWaitForMultipleObjectsEx(0, nullptr, on_demand_idle_timeout_ms_,
+                                    QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+        wakeup_time_ = std::chrono::high_resolution_clock::now();
+        RecordOnDemandFrame(false);
+        continue;
+      }
+
+      frame_invalidated_ = false;
+
+      auto const wait_start_time{std::chrono::high_resolution_clock::now()};
+
       if (device_.waitForFences(in_flight_fences_[current_frame_], vk::True,
                                 std::numeric_limits<std::uint64_t>::max()) !=
         vk::Result::eSuccess) {
@@ -821,63 +926,68 @@ public:
 
       device_.resetFences(in_flight_fences_[current_frame_]);
 
-      command_buffers_[current_frame_].reset();
-      command_buffers_[current_frame_].begin(vk::CommandBufferBeginInfo{});
+      auto const record_start_time{std::chrono::high_resolution_clock::now()};
+      stage_window_.wait_seconds += std::chrono::duration<double>(
+        record_start_time - wait_start_time).count();
 
-      std::array constexpr clear_values{
-        vk::ClearValue{vk::ClearColorValue{0.0f, 0.0f, 0.0f, 1.0f}},
-        vk::ClearValue{vk::ClearDepthStencilValue{1.0f, 0}}
-      };
+      // The fence guarantees the timestamps of this frame slot are available
+      if (timestamps_written_[current_frame_]) {
+        UpdateRenderScale(ReadGpuFrameTime());
+      }
 
-      command_buffers_[current_frame_].beginRenderPass(
-        vk::RenderPassBeginInfo{
-          render_pass_, swap_chain_framebuffers_[img_idx],
-          vk::Rect2D{{0, 0}, swap_chain_extent_}, clear_values
-        }, vk::SubpassContents::eInline);
-      command_buffers_[current_frame_].bindPipeline(
-        vk::PipelineBindPoint::eGraphics, pipeline_);
-      command_buffers_[current_frame_].bindVertexBuffers(
-        0, vertex_buffer_, vk::DeviceSize{0});
-      command_buffers_[current_frame_].bindIndexBuffer(
-        index_buffer_, 0, vk::IndexType::eUint32);
-      command_buffers_[current_frame_].setViewport(0, vk::Viewport{
-                                                     0, 0,
-                                                     static_cast<float>(
-                                                       swap_chain_extent_.
-                                                       width),
-                                                     static_cast<float>(
-                                                       swap_chain_extent_.
-                                                       height),
-                                                     0, 1
-                                                   });
-      command_buffers_[current_frame_].setScissor(
-        0, vk::Rect2D{{0, 0}, swap_chain_extent_});
-      command_buffers_[current_frame_].bindDescriptorSets(
-        vk::PipelineBindPoint::eGraphics, pipeline_layout_, 0,
-        descriptor_sets_[current_frame_], {});
-      command_buffers_[current_frame_].drawIndexed(
-        static_cast<std::uint32_t>(indices_.size()), 1, 0, 0, 0);
-      command_buffers_[current_frame_].endRenderPass();
-      command_buffers_[current_frame_].end();
-
-      auto static start_time{std::chrono::high_resolution_clock::now()};
-
-      auto const current_time{std::chrono::high_resolution_clock::now()};
-      auto const time{
-        std::chrono::duration<float>(current_time - start_time).count()
-      };
+      vk::CommandBuffer command_buffer;
+
+      if (prerecord_command_buffers_) {
+        // Everything recorded depends only on the swap chain image, the frame
+        // slot and the render extent, so it can be replayed until one of the
+        // invalidating events happens.
+        auto& [prerecorded_command_buffer, recorded_extent]{
+          prerecorded_command_buffers_[img_idx * max_frames_in_flight_ +
+            current_frame_]
+        };
+
+        if (recorded_extent != GetRenderExtent()) {
+          RecordFrameCommandBuffer(prerecorded_command_buffer, img_idx);
+          recorded_extent = GetRenderExtent();
+          stage_window_.rerecord_count += 1;
+        }
+
+        command_buffer = prerecorded_command_buffer;
+      } else {
+        command_buffers_[current_frame_].reset();
+        RecordFrameCommandBuffer(command_buffers_[current_frame_], img_idx);
+        command_buffer = command_buffers_[current_frame_];
+      }
+
+      auto const submit_start_time{std::chrono::high_resolution_clock::now()};
+      stage_window_.record_seconds += std::chrono::duration<double>(
+        submit_start_time - record_start_time).count();
+
+      auto const& snapshot{AcquireSceneSnapshot()};
+      drawn_scene_time_ = snapshot.time;
+      drawn_view_ = snapshot.view;
 
       UniformBufferObject ubo{
-        .model = rotate(glm::mat4{1}, time * glm::radians(90.0f),
-                        glm::vec3{0, 0, 1}),
-        .view = lookAt(glm::vec3{2, 2, 2}, glm::vec3{0, 0, 0},
-                       glm::vec3{0, 0, 1}),
+        .model = snapshot.model,
+        .view = snapshot.view,
         .proj = glm::perspective(glm::radians(45.0f),
                                  static_cast<float>(swap_chain_extent_.width) /
                                  static_cast<float>(swap_chain_extent_.height),
-                                 0.1f, 10.0f)
+                                 z_near_, z_far_)
       };
       ubo.proj[1][1] *= -1;
+      ubo.inv_proj = glm::inverse(ubo.proj);
+      ubo.light_count = LIGHT_COUNT;
+      ubo.z_near = z_near_;
+      ubo.z_far = z_far_;
+
+      WriteLights(snapshot);
+
+      if (multiview_) {
+        for (std::uint32_t i{0}; i < multiview_view_count_; i++) {
+          ubo.view_projs[i] = GetMultiviewViewProjection(snapshot.view, i);
+        }
+      }
 
       std::memcpy(uniform_buffers_mapped_[current_frame_], &ubo, sizeof(ubo));
 
@@ -895,10 +1005,11 @@ public:
 
       graphics_queue_.submit(vk::SubmitInfo{
                                submit_wait_semaphores, wait_stages,
-                               command_buffers_[current_frame_],
-                               submit_signal_semaphores
+                               command_buffer, submit_signal_semaphores
                              }, in_flight_fences_[current_frame_]);
 
+      timestamps_written_[current_frame_] = timestamps_supported_;
+
       if (auto const result{
           present_queue_.presentKHR(vk::PresentInfoKHR{
             submit_signal_semaphores, swap_chain_, img_idx
@@ -911,32 +1022,33 @@ public:
         throw std::runtime_error{"Failed to present."};
       }
 
+      stage_window_.submit_seconds += std::chrono::duration<double>(
+        std::chrono::high_resolution_clock::now() - submit_start_time).count();
+
+      RecordFrameTime();
+
+      if (on_demand_rendering_) {
+        RecordOnDemandFrame(true);
+      }
+
       current_frame_ = (current_frame_ + 1) % max_frames_in_flight_;
     }
   }
 
 private:
-  auto CleanupSwapChain() const -> void {
-    for (auto const framebuffer : swap_chain_framebuffers_) {
-      device_.destroyFramebuffer(framebuffer);
-    }
+  auto CleanupSwapChain() -> void {
+    DestroyRenderGraph();
 
     for (auto const image_view : swap_chain_image_views_) {
       device_.destroyImageView(image_view);
     }
 
     device_.destroySwapchainKHR(swap_chain_);
-
-    device_.destroyImageView(depth_image_view_);
-    device_.destroyImage(depth_image_);
-    device_.freeMemory(depth_image_memory_);
-
-    device_.destroyImageView(color_image_view_);
-    device_.destroyImage(color_image_);
-    device_.freeMemory(color_image_memory_);
   }
 
   auto RecreateSwapChain() -> void {
+    frame_invalidated_ = true;
+
     std::uint32_t width;
     std::uint32_t height;
     RECT client_rect;
@@ -965,277 +1077,2410 @@ private:
 
     CleanupSwapChain();
     CreateSwapChainAndViews();
-    CreateColorResources();
-    CreateDepthResources();
-    CreateFramebuffers();
+
+    if (anti_aliasing_ != AntiAliasing::kMsaa && !post_processing_supported_) {
+      ApplyAntiAliasing(AntiAliasing::kMsaa);
+    }
+
+    CreateRenderGraph();
   }
 
-  struct SwapChainSupportInfo {
-    vk::SurfaceCapabilitiesKHR capabilities;
-    std::vector<vk::SurfaceFormatKHR> formats;
-    std::vector<vk::PresentModeKHR> present_modes;
-  };
+  auto SetAntiAliasing(AntiAliasing const anti_aliasing) -> void {
+    if (anti_aliasing == anti_aliasing_) {
+      return;
+    }
 
-  [[nodiscard]] auto QuerySwapChainSupport(
-    vk::PhysicalDevice const physical_device) const -> SwapChainSupportInfo {
-    return SwapChainSupportInfo{
-      physical_device.getSurfaceCapabilitiesKHR(surface_),
-      physical_device.getSurfaceFormatsKHR(surface_),
-      physical_device.getSurfacePresentModesKHR(surface_)
+    if (anti_aliasing != AntiAliasing::kMsaa && !post_processing_supported_) {
+      std::cout << "The swap chain does not support post processing, staying "
+        "on " << GetAntiAliasingName(anti_aliasing_) << ".\n";
+      return;
+    }
+
+    device_.waitIdle();
+
+    DestroyRenderGraph();
+    ApplyAntiAliasing(anti_aliasing);
+    CreateRenderGraph();
+
+    std::cout << "Switched to " << GetAntiAliasingName(anti_aliasing_) << ".\n";
+  }
+
+  // Expects the device to be idle. The render graph has to be rebuilt after.
+  auto ApplyAntiAliasing(AntiAliasing const anti_aliasing) -> void {
+    anti_aliasing_ = anti_aliasing;
+    msaa_samples_ = anti_aliasing_ == AntiAliasing::kMsaa
+                      ? max_msaa_samples_
+                      : vk::SampleCountFlagBits::e1;
+
+    // The scene pipelines bake in the sample count and the color format
+    DestroyGraphicsPipelines();
+    CreateGraphicsPipeline();
+
+    // Do not count the frame spent rebuilding towards the new mode
+    last_frame_time_.reset();
+    frame_time_window_ = {};
+    stage_window_ = {};
+  }
+
+  [[nodiscard]] static auto GetAntiAliasingName(
+    AntiAliasing const anti_aliasing) -> std::string_view {
+    switch (anti_aliasing) {
+    case AntiAliasing::kMsaa:
+      return "MSAA";
+    case AntiAliasing::kFxaa:
+      return "FXAA";
+    case AntiAliasing::kFxaaSharpen:
+      return "FXAA + sharpen";
+    }
+
+    return "Unknown";
+  }
+
+  auto RecordFrameTime() -> void {
+    auto const now{std::chrono::high_resolution_clock::now()};
+
+    if (last_frame_time_) {
+      auto const frame_time{
+        std::chrono::duration<double>(now - *last_frame_time_).count()
+      };
+
+      auto& [total_seconds, frame_count]{
+        frame_time_stats_[static_cast<std::size_t>(anti_aliasing_)]
+      };
+      total_seconds += frame_time;
+      frame_count += 1;
+
+      frame_time_window_.total_seconds += frame_time;
+      frame_time_window_.frame_count += 1;
+
+      if (frame_time_window_.total_seconds >= 1.0) {
+        std::cout << GetAntiAliasingName(anti_aliasing_) << (multiview_
+          ? " + multiview"
+          : depth_prepass_
+          ? " + depth prepass"
+          : "") << (vertex_pulling_ ? " + vertex pulling" : "") << ": " <<
+          frame_time_window_.total_seconds * 1000.0 / frame_time_window_.
+          frame_count << " ms/frame over " << frame_time_window_.frame_count <<
+          " frames";
+
+        if (timestamps_supported_) {
+          std::cout << ", GPU " << gpu_frame_time_ms_ << " ms";
+        }
+
+        if (IsDynamicResolutionActive()) {
+          auto const [width, height]{GetRenderExtent()};
+          std::cout << " at " << width << 'x' << height << " (" <<
+            render_scale_ * 100.0f << "%)";
+        }
+
+        if (prerecord_command_buffers_) {
+          std::cout << ", " << stage_window_.rerecord_count <<
+            " re-recordings";
+        }
+
+        // Per frame CPU time of each stage, the simulation runs in parallel
+        // with the others unless NO_SIMULATION_THREAD is defined.
+        auto const to_us{1'000'000.0 / frame_time_window_.frame_count};
+        std::cout << ".\n  simulation " << stage_window_.simulation_seconds *
+          to_us << " us, wait " << stage_window_.wait_seconds * to_us <<
+          " us, record " << stage_window_.record_seconds * to_us <<
+          " us, submit " << stage_window_.submit_seconds * to_us << " us\n";
+        frame_time_window_ = {};
+        stage_window_ = {};
+      }
+    }
+
+    last_frame_time_ = now;
+  }
+
+  auto ToggleOnDemandRendering() -> void {
+    on_demand_rendering_ = !on_demand_rendering_;
+    frame_invalidated_ = true;
+    wakeup_time_.reset();
+
+    MergeOnDemandStats(on_demand_totals_, on_demand_window_);
+    on_demand_window_ = {};
+    on_demand_window_start_ = std::chrono::high_resolution_clock::now();
+
+    std::cout << "On-demand rendering " << (on_demand_rendering_
+                                              ? "enabled"
+                                              : "disabled") << ".\n";
+  }
+
+  // Whether anything visible changed since the last drawn frame. Takes the
+  // newest scene snapshot, which the next frame then draws.
+  [[nodiscard]] auto IsFrameNeeded() -> bool {
+    if (frame_invalidated_ || framebuffer_resized_) {
+      return true;
+    }
+
+    auto const& snapshot{AcquireSceneSnapshot()};
+    return snapshot.time != drawn_scene_time_ || snapshot.view != drawn_view_;
+  }
+
+  auto RecordOnDemandFrame(bool const drawn) -> void {
+    auto const now{std::chrono::high_resolution_clock::now()};
+
+    if (drawn) {
+      on_demand_window_.active_frame_count += 1;
+
+      if (wakeup_time_) {
+        auto const latency{
+          std::chrono::duration<double>(now - *wakeup_time_).count()
+        };
+        on_demand_window_.wakeup_count += 1;
+        on_demand_window_.total_wakeup_latency_seconds += latency;
+        on_demand_window_.max_wakeup_latency_seconds = std::max(
+          on_demand_window_.max_wakeup_latency_seconds, latency);
+        wakeup_time_.reset();
+      }
+    } else {
+      on_demand_window_.idle_frame_count += 1;
+    }
+
+    // Intervals without drawn frames are merged into the next report, so an
+    // idle window stays quiet.
+    auto const window_seconds{
+      std::chrono::duration<double>(now - on_demand_window_start_).count()
     };
+
+    if (window_seconds < 1.0 || on_demand_window_.active_frame_count == 0) {
+      return;
+    }
+
+    std::cout << "On-demand: ";
+    PrintOnDemandStats(on_demand_window_);
+    std::cout << " over " << window_seconds << " s.\n";
+
+    MergeOnDemandStats(on_demand_totals_, on_demand_window_);
+    on_demand_window_ = {};
+    on_demand_window_start_ = now;
   }
 
-  struct QueueFamilyIndices {
-    std::optional<std::uint32_t> graphics_family;
-    std::optional<std::uint32_t> present_family;
+  auto PrintOnDemandTotals() -> void {
+    MergeOnDemandStats(on_demand_totals_, on_demand_window_);
+    on_demand_window_ = {};
 
-    [[nodiscard]] auto IsComplete() const -> bool {
-      return graphics_family.has_value() && present_family.has_value();
+    if (on_demand_totals_.active_frame_count == 0 && on_demand_totals_.
+      idle_frame_count == 0) {
+      return;
+    }
+
+    std::cout << "On-demand rendering in total: ";
+    PrintOnDemandStats(on_demand_totals_);
+    std::cout << ".\n";
+  }
+
+  auto PrintFrameTimeComparison() const -> void {
+    auto const& msaa_stats{
+      frame_time_stats_[static_cast<std::size_t>(AntiAliasing::kMsaa)]
+    };
+    auto const msaa_ms{
+      msaa_stats.frame_count
+        ? msaa_stats.total_seconds * 1000.0 / msaa_stats.frame_count
+        : 0.0
+    };
+
+    std::cout << "Average frame times:\n";
+
+    for (std::size_t i{0}; i < frame_time_stats_.size(); i++) {
+      auto const& [total_seconds, frame_count]{frame_time_stats_[i]};
+
+      if (frame_count == 0) {
+        continue;
+      }
+
+      auto const ms{total_seconds * 1000.0 / frame_count};
+
+      std::cout << "  " << GetAntiAliasingName(static_cast<AntiAliasing>(i)) <<
+        ": " << ms << " ms over " << frame_count << " frames";
+
+      if (i != static_cast<std::size_t>(AntiAliasing::kMsaa) && msaa_ms > 0.0) {
+        std::cout << " (" << (ms - msaa_ms) << " ms compared to " <<
+          static_cast<std::uint32_t>(max_msaa_samples_) << "x MSAA)";
+      }
+
+      std::cout << '\n';
+    }
+  }
+
+  auto ToggleVertexPulling() -> void {
+    if (!vertex_pulling_supported_) {
+      std::cout << "Vertex pulling is not supported.\n";
+      return;
+    }
+
+    // Only changes which pipeline the scene pass binds, the graph stays
+    vertex_pulling_ = !vertex_pulling_;
+    InvalidatePrerecordedCommandBuffers();
+
+    frame_time_window_ = {};
+    stage_window_ = {};
+
+    std::cout << "Vertex pulling " << (vertex_pulling_ ? "enabled" : "disabled")
+      << ".\n";
+  }
+
+  auto ToggleDepthPrepass() -> void {
+    device_.waitIdle();
+
+    depth_prepass_ = !depth_prepass_;
+
+    DestroyRenderGraph();
+    CreateRenderGraph();
+
+    // Do not mix frame times of the two modes in the same window
+    frame_time_window_ = {};
+    stage_window_ = {};
+
+    std::cout << "Depth prepass " << (depth_prepass_ ? "enabled" : "disabled")
+      << ".\n";
+  }
+
+  auto ToggleMultiview() -> void {
+    if (!swap_chain_blit_supported_) {
+      std::cout << "Multiview is not supported, the swap chain does not "
+        "support blits.\n";
+      return;
+    }
+
+    device_.waitIdle();
+
+    multiview_ = !multiview_;
+
+    DestroyRenderGraph();
+    CreateRenderGraph();
+
+    frame_time_window_ = {};
+    stage_window_ = {};
+
+    std::cout << "Multiview " << (multiview_ ? "enabled" : "disabled") <<
+      " with " << multiview_view_count_ << " views.\n";
+  }
+
+  auto ToggleDynamicResolution() -> void {
+    device_.waitIdle();
+
+    dynamic_resolution_ = !dynamic_resolution_;
+    render_scale_ = 1.0f;
+
+    DestroyRenderGraph();
+    CreateRenderGraph();
+
+    std::cout << "Dynamic resolution " << (IsDynamicResolutionActive()
+                                             ? "enabled"
+                                             : "disabled") << ".\n";
+  }
+
+  // MSAA can only resolve at the same size, so in MSAA mode the upscale is a
+  // blit into the swap chain. The post processing chain upscales when
+  // tonemapping. The multiview targets are always drawn in full.
+  [[nodiscard]] auto IsDynamicResolutionActive() const -> bool {
+    return dynamic_resolution_ && timestamps_supported_ && !multiview_ && (
+      anti_aliasing_ != AntiAliasing::kMsaa || swap_chain_blit_supported_);
+  }
+
+  [[nodiscard]] auto GetRenderExtent() const -> vk::Extent2D {
+    return vk::Extent2D{
+      std::max(1u, static_cast<std::uint32_t>(std::lround(
+                 static_cast<float>(swap_chain_extent_.width) *
+                 render_scale_))),
+      std::max(1u, static_cast<std::uint32_t>(std::lround(
+                 static_cast<float>(swap_chain_extent_.height) *
+                 render_scale_)))
+    };
+  }
+
+  [[nodiscard]] auto ReadGpuFrameTime() const -> double {
+    std::array<std::uint64_t, 2> timestamps{};
+
+    if (device_.getQueryPoolResults(timestamp_query_pool_, 2 * current_frame_,
+                                    2, sizeof(timestamps), timestamps.data(),
+                                    sizeof(std::uint64_t),
+                                    vk::QueryResultFlagBits::e64) !=
+      vk::Result::eSuccess) {
+      return gpu_frame_time_ms_;
+    }
+
+    return static_cast<double>(timestamps[1] - timestamps[0]) *
+      timestamp_period_ / 1'000'000.0;
+  }
+
+  auto UpdateRenderScale(double const gpu_frame_time_ms) -> void {
+    gpu_frame_time_ms_ = gpu_frame_time_ms;
+
+    if (!IsDynamicResolutionActive() || gpu_frame_time_ms <= 0.0) {
+      return;
+    }
+
+    // The cost of the scene is roughly proportional to the pixel count, so the
+    // scale that would hit the target is the square root of the time ratio.
+    auto const target_ms{DYNAMIC_RESOLUTION_TARGET_MS};
+    auto const ideal_scale{
+      render_scale_ * static_cast<float>(std::sqrt(
+        target_ms / gpu_frame_time_ms))
+    };
+
+    // Drop the resolution immediately when over budget to hold the frame rate,
+    // but only raise it slowly once there is headroom to avoid oscillating.
+    if (gpu_frame_time_ms > target_ms) {
+      render_scale_ = ideal_scale;
+    } else if (gpu_frame_time_ms < target_ms * render_scale_headroom_) {
+      render_scale_ += (ideal_scale - render_scale_) *
+        render_scale_increase_rate_;
     }
+
+    render_scale_ = std::clamp(render_scale_, min_render_scale_, 1.0f);
+  }
+
+  struct SceneSnapshot {
+    glm::mat4 model;
+    glm::mat4 view;
+    // Seconds since start the lights are animated to
+    float time;
+    std::uint64_t frame_idx;
+    double update_seconds;
   };
 
-  [[nodiscard]] auto FindQueueFamilies(
-    vk::PhysicalDevice const physical_device) const -> QueueFamilyIndices {
-    QueueFamilyIndices indices;
+  // Only touches the write slot of the snapshot buffer and the animation time,
+  // so it is safe to call from the simulation thread.
+  auto PublishSceneSnapshot(std::uint64_t const frame_idx) -> void {
+    auto const update_start_time{std::chrono::high_resolution_clock::now()};
 
-    auto const queue_family_properties{
-      physical_device.getQueueFamilyProperties()
+    if (!animation_paused_.load(std::memory_order_relaxed)) {
+      animation_time_ += std::chrono::duration<float>(
+        update_start_time - last_update_time_).count();
+    }
+
+    last_update_time_ = update_start_time;
+    auto const time{animation_time_};
+
+    auto& snapshot{scene_snapshots_.GetWriteSlot()};
+    snapshot.model = rotate(glm::mat4{1}, time * glm::radians(90.0f),
+                            glm::vec3{0, 0, 1});
+    snapshot.view = lookAt(glm::vec3{2, 2, 2}, glm::vec3{0, 0, 0},
+                           glm::vec3{0, 0, 1});
+    snapshot.time = time;
+    snapshot.frame_idx = frame_idx;
+
+#ifdef SIMULATION_BUSY_WORK_US
+    while (std::chrono::high_resolution_clock::now() - update_start_time <
+      std::chrono::microseconds{SIMULATION_BUSY_WORK_US}) {}
+#endif
+
+    snapshot.update_seconds = std::chrono::duration<double>(
+      std::chrono::high_resolution_clock::now() - update_start_time).count();
+
+    scene_snapshots_.Publish();
+  }
+
+  // Takes the newest snapshot. If the simulation fell behind, the previous one
+  // is returned again instead of stalling the frame.
+  auto AcquireSceneSnapshot() -> SceneSnapshot const& {
+#ifdef NO_SIMULATION_THREAD
+    PublishSceneSnapshot(scene_snapshots_.GetReadSlot().frame_idx + 1);
+#endif
+
+    if (scene_snapshots_.Acquire()) {
+      stage_window_.simulation_seconds += scene_snapshots_.GetReadSlot().
+        update_seconds;
+    }
+
+    auto const& snapshot{scene_snapshots_.GetReadSlot()};
+
+    consumed_snapshot_.store(snapshot.frame_idx, std::memory_order_release);
+    consumed_snapshot_.notify_one();
+    return snapshot;
+  }
+
+#ifndef NO_SIMULATION_THREAD
+  auto SimulationThreadMain(std::stop_token const& stop_token) -> void {
+    // Waiting for the render thread is not part of the handoff, it only keeps
+    // the simulation from running more than one snapshot ahead.
+    std::stop_callback const wake_on_stop{
+      stop_token, [this] {
+        consumed_snapshot_.store(std::numeric_limits<std::uint64_t>::max());
+        consumed_snapshot_.notify_one();
+      }
     };
 
-    for (std::uint32_t idx{0}; auto const& [queueFlags, queueCount,
-           timestampValidBits, minImageTransferGranularity] :
-         queue_family_properties) {
-      if (queueFlags & vk::QueueFlagBits::eGraphics) {
-        indices.graphics_family = idx;
+    for (std::uint64_t frame_idx{2}; !stop_token.stop_requested();
+         frame_idx++) {
+      for (auto consumed{consumed_snapshot_.load(std::memory_order_acquire)};
+           consumed < frame_idx - 1; consumed = consumed_snapshot_.load(
+             std::memory_order_acquire)) {
+        consumed_snapshot_.wait(consumed);
+      }
+
+      if (stop_token.stop_requested()) {
+        break;
       }
 
-      if (physical_device.getSurfaceSupportKHR(idx, surface_)) {
-        indices.present_family = idx;
-      }
+      PublishSceneSnapshot(frame_idx);
+    }
+  }
+#endif
+
+  auto RecordFrameCommandBuffer(vk::CommandBuffer const command_buffer,
+                                std::uint32_t const img_idx) const -> void {
+    command_buffer.begin(vk::CommandBufferBeginInfo{});
+
+    if (timestamps_supported_) {
+      command_buffer.resetQueryPool(timestamp_query_pool_, 2 * current_frame_,
+                                    2);
+      command_buffer.writeTimestamp2(vk::PipelineStageFlagBits2::eTopOfPipe,
+                                     timestamp_query_pool_, 2 * current_frame_);
+    }
+
+    // Multiview renders unlit
+    if (!multiview_) {
+      RecordLightCulling(command_buffer);
+    }
+
+    render_graph_->SetImportedImage(swap_chain_resource_,
+                                    swap_chain_images_[img_idx],
+                                    swap_chain_image_views_[img_idx]);
+    render_graph_->Execute(command_buffer);
+
+    if (timestamps_supported_) {
+      command_buffer.writeTimestamp2(vk::PipelineStageFlagBits2::eBottomOfPipe,
+                                     timestamp_query_pool_,
+                                     2 * current_frame_ + 1);
+    }
+
+    command_buffer.end();
+  }
+
+  // Bins the lights into the clusters of the current frame before any pass of
+  // the render graph shades with them
+  auto RecordLightCulling(vk::CommandBuffer const command_buffer) const ->
+    void {
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                light_culling_pipeline_);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                      light_culling_pipeline_layout_, 0,
+                                      descriptor_sets_[current_frame_], {});
+    command_buffer.dispatch(
+      (CLUSTER_COUNT + LIGHT_CULLING_GROUP_SIZE - 1) / LIGHT_CULLING_GROUP_SIZE,
+      1, 1);
+
+    vk::BufferMemoryBarrier2 const barrier{
+      vk::PipelineStageFlagBits2::eComputeShader,
+      vk::AccessFlagBits2::eShaderStorageWrite,
+      vk::PipelineStageFlagBits2::eFragmentShader,
+      vk::AccessFlagBits2::eShaderStorageRead, vk::QueueFamilyIgnored,
+      vk::QueueFamilyIgnored, cluster_buffers_[current_frame_], 0,
+      vk::WholeSize
+    };
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, {}, barrier});
+  }
+
+  // Has to be called whenever anything recorded into the command buffers
+  // besides the render extent changes: render graph rebuilds, pipelines and
+  // the draws of the scene.
+  auto InvalidatePrerecordedCommandBuffers() -> void {
+    for (auto& prerecorded : prerecorded_command_buffers_) {
+      prerecorded.recorded_extent.reset();
+    }
+  }
+
+  // Creates every scene pipeline the current material can be drawn with. The
+  // pipelines go through the pipeline cache, so recreating them after the
+  // multisampling or color format changes is cheap.
+  auto CreateGraphicsPipeline() -> void {
+    for (auto const kind : {
+           ScenePipelineKind::kDepthPrepass, ScenePipelineKind::kShading,
+           ScenePipelineKind::kShadingDepthEqual, ScenePipelineKind::kMultiview
+         }) {
+      for (auto const vertex_pulling : {false, true}) {
+        // The depth prepass always reads the position-only stream
+        if (vertex_pulling && (!vertex_pulling_supported_ || kind ==
+          ScenePipelineKind::kDepthPrepass)) {
+          continue;
+        }
+
+        ScenePipelineKey const key{
+          kind, vertex_pulling, GetShaderVariant(kind)
+        };
+        scene_pipelines_.emplace(key, CreateScenePipeline(key));
+      }
+    }
+  }
+
+  [[nodiscard]] auto GetShaderVariant(
+    ScenePipelineKind const kind) const -> SceneShaderVariant {
+    if (kind == ScenePipelineKind::kDepthPrepass) {
+      return SceneShaderVariant{};
+    }
+
+    // The light clusters only cover the main view
+    auto variant{material_variant_};
+    variant.multiview = kind == ScenePipelineKind::kMultiview
+                          ? vk::True
+                          : vk::False;
+    variant.clustered_lighting = kind == ScenePipelineKind::kMultiview
+                                   ? vk::False
+                                   : vk::True;
+    return variant;
+  }
+
+  [[nodiscard]] auto CreateScenePipeline(
+    ScenePipelineKey const& key) const -> vk::Pipeline {
+    auto const depth_prepass{key.kind == ScenePipelineKind::kDepthPrepass};
+
+    auto const vertex_shader_code{
+      depth_prepass
+        ? std::span<std::uint32_t const>{g_depth_prepass_bin}
+        : key.vertex_pulling
+        ? std::span<std::uint32_t const>{g_vertex_pulling_bin}
+        : std::span<std::uint32_t const>{g_vertex_bin}
+    };
+    auto const vertex_shader_module{
+      device_.createShaderModule(vk::ShaderModuleCreateInfo{
+        {}, vertex_shader_code.size_bytes(), vertex_shader_code.data()
+      })
+    };
+    auto const fragment_shader_module{
+      device_.createShaderModule(vk::ShaderModuleCreateInfo{{}, g_fragment_bin})
+    };
+
+    // Both stages see every constant, the ones a stage does not declare are
+    // ignored
+    auto const specialization_map_entries{SceneShaderVariant::GetMapEntries()};
+    vk::SpecializationInfo const specialization_info{
+      static_cast<std::uint32_t>(specialization_map_entries.size()),
+      specialization_map_entries.data(), sizeof(key.shader_variant),
+      &key.shader_variant
+    };
+
+    std::array const pipeline_shader_stage_create_infos{
+      vk::PipelineShaderStageCreateInfo{
+        {}, vk::ShaderStageFlagBits::eVertex, vertex_shader_module, "main",
+        &specialization_info
+      },
+      vk::PipelineShaderStageCreateInfo{
+        {}, vk::ShaderStageFlagBits::eFragment, fragment_shader_module, "main",
+        &specialization_info
+      },
+    };
+
+    std::array constexpr dynamic_states{
+      vk::DynamicState::eViewport, vk::DynamicState::eScissor
+    };
+
+    vk::PipelineDynamicStateCreateInfo const pipeline_dynamic_state_create_info{
+      {}, dynamic_states
+    };
+
+    auto constexpr vertex_input_binding_description{
+      Vertex::GetBindingDescription()
+    };
+    auto const vertex_input_attribute_descriptions{
+      Vertex::GetAttributeDescriptions()
+    };
+
+    vk::VertexInputBindingDescription constexpr position_binding_description{
+      0, sizeof(glm::vec3), vk::VertexInputRate::eVertex
+    };
+    vk::VertexInputAttributeDescription constexpr
+      position_attribute_description{0, 0, vk::Format::eR32G32B32Sfloat, 0};
+
+    // The depth prepass reads the position-only stream and vertex pulling
+    // reads no attributes at all
+    auto const pipeline_vertex_input_state_create_info{
+      depth_prepass
+        ? vk::PipelineVertexInputStateCreateInfo{
+          {}, position_binding_description, position_attribute_description
+        }
+        : key.vertex_pulling
+        ? vk::PipelineVertexInputStateCreateInfo{}
+        : vk::PipelineVertexInputStateCreateInfo{
+          {}, vertex_input_binding_description,
+          vertex_input_attribute_descriptions
+        }
+    };
+
+    vk::PipelineInputAssemblyStateCreateInfo constexpr
+      pipeline_input_assembly_state_create_info{
+        {}, vk::PrimitiveTopology::eTriangleList, vk::False
+      };
+
+    vk::PipelineViewportStateCreateInfo constexpr
+      pipeline_viewport_state_create_info{{}, 1, nullptr, 1, nullptr};
+
+    vk::PipelineRasterizationStateCreateInfo constexpr
+      pipeline_rasterization_state_create_info{
+        {}, vk::False, vk::False, vk::PolygonMode::eFill,
+        vk::CullModeFlagBits::eBack, vk::FrontFace::eCounterClockwise,
+        vk::False, 0, 0, 0, 1.0f
+      };
+
+    vk::PipelineMultisampleStateCreateInfo const
+      pipeline_multisample_state_create_info{
+        {}, msaa_samples_, vk::False, 1, nullptr, vk::False, vk::False
+      };
+
+    // After the depth prepass only the closest fragments pass the test, both
+    // vertex shaders declare gl_Position invariant so the depths match.
+    auto const depth_equal{key.kind == ScenePipelineKind::kShadingDepthEqual};
+
+    vk::PipelineDepthStencilStateCreateInfo const
+      pipeline_depth_stencil_state_create_info{
+        {}, vk::True, depth_equal ? vk::False : vk::True,
+        depth_equal ? vk::CompareOp::eEqual : vk::CompareOp::eLess, vk::False,
+        vk::False, {}, {}, 0, 1
+      };
+
+    vk::PipelineColorBlendAttachmentState constexpr
+      pipeline_color_blend_attachment_state{
+        vk::False, vk::BlendFactor::eOne, vk::BlendFactor::eZero,
+        vk::BlendOp::eAdd, vk::BlendFactor::eOne, vk::BlendFactor::eZero,
+        vk::BlendOp::eAdd,
+        vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+        vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA
+      };
+
+    vk::PipelineColorBlendStateCreateInfo const color_blend_state_create_info{
+      {}, vk::False, vk::LogicOp::eCopy, pipeline_color_blend_attachment_state,
+      {0, 0, 0, 0}
+    };
+
+    auto const color_format{GetSceneColorFormat()};
+
+    // The depth prepass has no fragment shader and no color attachment. The
+    // multiview pipeline has to be created with the view mask of the pass it
+    // is used in.
+    vk::PipelineRenderingCreateInfo const pipeline_rendering_create_info{
+      key.kind == ScenePipelineKind::kMultiview ? GetMultiviewMask() : 0,
+      depth_prepass ? 0u : 1u, depth_prepass ? nullptr : &color_format,
+      FindDepthFormat()
+    };
+
+    vk::GraphicsPipelineCreateInfo const pipeline_create_info{
+      {}, depth_prepass ? 1u : 2u, pipeline_shader_stage_create_infos.data(),
+      &pipeline_vertex_input_state_create_info,
+      &pipeline_input_assembly_state_create_info, nullptr,
+      &pipeline_viewport_state_create_info,
+      &pipeline_rasterization_state_create_info,
+      &pipeline_multisample_state_create_info,
+      &pipeline_depth_stencil_state_create_info,
+      depth_prepass ? nullptr : &color_blend_state_create_info,
+      &pipeline_dynamic_state_create_info, pipeline_layout_, VK_NULL_HANDLE, 0,
+      VK_NULL_HANDLE, -1, &pipeline_rendering_create_info
+    };
+
+    auto const [result, pipeline]{
+      device_.createGraphicsPipeline(pipeline_cache_, pipeline_create_info)
+    };
+
+    device_.destroyShaderModule(fragment_shader_module);
+    device_.destroyShaderModule(vertex_shader_module);
+
+    if (result != vk::Result::eSuccess) {
+      throw std::runtime_error{"Failed to create graphics pipeline."};
+    }
+
+    return pipeline;
+  }
+
+  auto DestroyGraphicsPipelines() -> void {
+    for (auto const& [key, pipeline] : scene_pipelines_) {
+      device_.destroyPipeline(pipeline);
+    }
+
+    scene_pipelines_.clear();
+  }
+
+  auto CreatePostProcessingPipelines() -> void {
+    std::array constexpr descriptor_set_layout_bindings{
+      vk::DescriptorSetLayoutBinding{
+        0, vk::DescriptorType::eCombinedImageSampler, 1,
+        vk::ShaderStageFlagBits::eCompute
+      },
+      vk::DescriptorSetLayoutBinding{
+        1, vk::DescriptorType::eStorageImage, 1,
+        vk::ShaderStageFlagBits::eCompute
+      }
+    };
+
+    post_process_descriptor_set_layout_ = device_.createDescriptorSetLayout(
+      vk::DescriptorSetLayoutCreateInfo{{}, descriptor_set_layout_bindings});
+
+    vk::PushConstantRange constexpr push_constant_range{
+      vk::ShaderStageFlagBits::eCompute, 0, sizeof(PostProcessPushConstants)
+    };
+
+    post_process_pipeline_layout_ = device_.createPipelineLayout(
+      vk::PipelineLayoutCreateInfo{
+        {}, post_process_descriptor_set_layout_, push_constant_range
+      });
+
+    std::array constexpr descriptor_pool_sizes{
+      vk::DescriptorPoolSize{
+        vk::DescriptorType::eCombinedImageSampler, max_post_process_passes_
+      },
+      vk::DescriptorPoolSize{
+        vk::DescriptorType::eStorageImage, max_post_process_passes_
+      }
+    };
+
+    post_process_descriptor_pool_ = device_.createDescriptorPool(
+      vk::DescriptorPoolCreateInfo{
+        {}, max_post_process_passes_, descriptor_pool_sizes
+      });
+
+    // FXAA relies on bilinear taps between texels
+    post_process_sampler_ = device_.createSampler(vk::SamplerCreateInfo{
+      {}, vk::Filter::eLinear, vk::Filter::eLinear,
+      vk::SamplerMipmapMode::eNearest, vk::SamplerAddressMode::eClampToEdge,
+      vk::SamplerAddressMode::eClampToEdge,
+      vk::SamplerAddressMode::eClampToEdge
+    });
+
+    auto const create_compute_pipeline{
+      [this](std::span<std::uint32_t const> const code) {
+        auto const shader_module{
+          device_.createShaderModule(vk::ShaderModuleCreateInfo{
+            {}, code.size_bytes(), code.data()
+          })
+        };
+
+        auto const [result, value]{
+          device_.createComputePipeline(
+            VK_NULL_HANDLE, vk::ComputePipelineCreateInfo{
+              {}, vk::PipelineShaderStageCreateInfo{
+                {}, vk::ShaderStageFlagBits::eCompute, shader_module, "main"
+              },
+              post_process_pipeline_layout_
+            })
+        };
+
+        device_.destroyShaderModule(shader_module);
+
+        if (result != vk::Result::eSuccess) {
+          throw std::runtime_error{"Failed to create compute pipeline."};
+        }
+
+        return value;
+      }
+    };
+
+    tonemap_pipeline_ = create_compute_pipeline(g_tonemap_bin);
+    fxaa_pipeline_ = create_compute_pipeline(g_fxaa_bin);
+    sharpen_pipeline_ = create_compute_pipeline(g_sharpen_bin);
+  }
+
+  // Shares the descriptor set layout of the scene pipelines
+  auto CreateLightCullingPipeline() -> void {
+    light_culling_pipeline_layout_ = device_.createPipelineLayout(
+      vk::PipelineLayoutCreateInfo{{}, descriptor_set_layout_});
+
+    auto const shader_module{
+      device_.createShaderModule(vk::ShaderModuleCreateInfo{
+        {}, g_light_culling_bin
+      })
+    };
+
+    auto const [result, pipeline]{
+      device_.createComputePipeline(
+        pipeline_cache_, vk::ComputePipelineCreateInfo{
+          {}, vk::PipelineShaderStageCreateInfo{
+            {}, vk::ShaderStageFlagBits::eCompute, shader_module, "main"
+          },
+          light_culling_pipeline_layout_
+        })
+    };
+
+    device_.destroyShaderModule(shader_module);
+
+    if (result != vk::Result::eSuccess) {
+      throw std::runtime_error{"Failed to create light culling pipeline."};
+    }
+
+    light_culling_pipeline_ = pipeline;
+  }
+
+  // The lights are rewritten by the host every frame like the uniform buffer,
+  // the clusters are only ever touched by the device.
+  auto CreateLightBuffers() -> void {
+    vk::DeviceSize constexpr light_buffer_size{
+      LIGHT_COUNT * sizeof(PointLight)
+    };
+    vk::DeviceSize constexpr cluster_buffer_size{
+      CLUSTER_COUNT * sizeof(Cluster)
+    };
+
+    light_buffers_.resize(max_frames_in_flight_);
+    light_buffer_memories_.resize(max_frames_in_flight_);
+    light_buffers_mapped_.resize(max_frames_in_flight_);
+    cluster_buffers_.resize(max_frames_in_flight_);
+    cluster_buffer_memories_.resize(max_frames_in_flight_);
+
+    for (auto i{0}; i < max_frames_in_flight_; i++) {
+      CreateBuffer(light_buffer_size, vk::BufferUsageFlagBits::eStorageBuffer,
+                   vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+                   light_buffers_[i], light_buffer_memories_[i]);
+
+      light_buffers_mapped_[i] = static_cast<PointLight*>(device_.mapMemory(
+        light_buffer_memories_[i], 0, light_buffer_size));
+
+      CreateBuffer(cluster_buffer_size, vk::BufferUsageFlagBits::eStorageBuffer,
+                   vk::MemoryPropertyFlagBits::eDeviceLocal,
+                   cluster_buffers_[i], cluster_buffer_memories_[i]);
+    }
+  }
+
+  // Circular path a light is animated along in world space
+  struct LightOrbit {
+    float radius;
+    float height;
+    float angular_speed;
+    float phase;
+    float light_radius;
+    glm::vec3 color;
+  };
+
+  [[nodiscard]] static auto GenerateLightOrbits() -> std::vector<LightOrbit> {
+    // Fixed seed so every run shows the same lights
+    std::mt19937 rng;
+    std::uniform_real_distribution dist{0.0f, 1.0f};
+
+    std::vector<LightOrbit> orbits;
+    orbits.reserve(LIGHT_COUNT);
+
+    for (auto i{0}; i < LIGHT_COUNT; i++) {
+      auto& orbit{orbits.emplace_back()};
+      orbit.radius = 0.2f + dist(rng);
+      orbit.height = 0.8f * dist(rng);
+      orbit.angular_speed = (dist(rng) - 0.5f) * 2.0f;
+      orbit.phase = glm::radians(360.0f) * dist(rng);
+      orbit.light_radius = 0.1f + 0.2f * dist(rng);
+      orbit.color = glm::vec3{dist(rng), dist(rng), dist(rng)};
+      orbit.color /= std::max({orbit.color.r, orbit.color.g, orbit.color.b});
+    }
+
+    return orbits;
+  }
+
+  // Writes straight into the mapped light buffer of the current frame, in
+  // the view space of the snapshot
+  auto WriteLights(SceneSnapshot const& snapshot) const -> void {
+    auto const lights{light_buffers_mapped_[current_frame_]};
+
+    for (std::size_t i{0}; i < light_orbits_.size(); i++) {
+      auto const& orbit{light_orbits_[i]};
+      auto const angle{orbit.phase + orbit.angular_speed * snapshot.time};
+      glm::vec4 const world_position{
+        orbit.radius * std::cos(angle), orbit.radius * std::sin(angle),
+        orbit.height, 1
+      };
+
+      lights[i] = PointLight{
+        glm::vec3{snapshot.view * world_position}, orbit.light_radius,
+        orbit.color, 0.0f
+      };
+    }
+  }
+
+  [[nodiscard]] auto GetSceneColorFormat() const -> vk::Format {
+    // Post processing tonemaps from a linear HDR target
+    return anti_aliasing_ == AntiAliasing::kMsaa
+             ? swap_chain_image_format_
+             : vk::Format::eR16G16B16A16Sfloat;
+  }
+
+  struct SwapChainSupportInfo {
+    vk::SurfaceCapabilitiesKHR capabilities;
+    std::vector<vk::SurfaceFormatKHR> formats;
+    std::vector<vk::PresentModeKHR> present_modes;
+  };
+
+  [[nodiscard]] auto QuerySwapChainSupport(
+    vk::PhysicalDevice const physical_device) const -> SwapChainSupportInfo {
+    return SwapChainSupportInfo{
+      physical_device.getSurfaceCapabilitiesKHR(surface_),
+      physical_device.getSurfaceFormatsKHR(surface_),
+      physical_device.getSurfacePresentModesKHR(surface_)
+    };
+  }
+
+  struct QueueFamilyIndices {
+    std::optional<std::uint32_t> graphics_family;
+    std::optional<std::uint32_t> present_family;
+
+    [[nodiscard]] auto IsComplete() const -> bool {
+      return graphics_family.has_value() && present_family.has_value();
+    }
+  };
+
+  [[nodiscard]] auto FindQueueFamilies(
+    vk::PhysicalDevice const physical_device) const -> QueueFamilyIndices {
+    QueueFamilyIndices indices;
+
+    auto const queue_family_properties{
+      physical_device.getQueueFamilyProperties()
+    };
+
+    for (std::uint32_t idx{0}; auto const& [queueFlags, queueCount,
+           timestampValidBits, minImageTransferGranularity] :
+         queue_family_properties) {
+      if (queueFlags & vk::QueueFlagBits::eGraphics) {
+        indices.graphics_family = idx;
+      }
+
+      if (physical_device.getSurfaceSupportKHR(idx, surface_)) {
+        indices.present_family = idx;
+      }
+
+      if (indices.IsComplete()) {
+        break;
+      }
+
+      ++idx;
+    }
+
+    return indices;
+  }
+
+  struct SampleCountPolicy {
+    vk::SampleCountFlagBits samples;
+    // Require exactly samples instead of picking the highest supported count
+    // not above it.
+    bool fixed;
+  };
+
+  [[nodiscard]] static auto SelectSampleCount(
+    vk::PhysicalDevice const physical_device,
+    SampleCountPolicy const& policy) -> std::optional<
+    vk::SampleCountFlagBits> {
+    auto const physical_device_properties{physical_device.getProperties()};
+
+    auto const counts{
+      physical_device_properties.limits.framebufferColorSampleCounts &
+      physical_device_properties.limits.framebufferDepthSampleCounts
+    };
+
+    if (policy.fixed) {
+      if (counts & policy.samples) {
+        return policy.samples;
+      }
+
+      return std::nullopt;
+    }
+
+    std::array constexpr candidate_counts{
+      vk::SampleCountFlagBits::e64, vk::SampleCountFlagBits::e32,
+      vk::SampleCountFlagBits::e16, vk::SampleCountFlagBits::e8,
+      vk::SampleCountFlagBits::e4, vk::SampleCountFlagBits::e2
+    };
+
+    for (auto const count : candidate_counts) {
+      if (count <= policy.samples && counts & count) {
+        return count;
+      }
+    }
+
+    return vk::SampleCountFlagBits::e1;
+  }
+
+  auto CreateSwapChainAndViews() -> void {
+    auto const& [capabilities, formats, present_modes]{
+      QuerySwapChainSupport(physical_device_)
+    };
+
+    auto const [format, color_space]{
+      [&formats] {
+        auto const it{
+          std::ranges::find(formats, vk::SurfaceFormatKHR{
+                              vk::Format::eB8G8R8A8Srgb,
+                              vk::ColorSpaceKHR::eSrgbNonlinear
+                            })
+        };
+        return it != formats.end() ? *it : formats[0];
+      }()
+    };
+
+    auto const present_mode{
+      [&present_modes] {
+        auto const it{
+          std::ranges::find(present_modes, vk::PresentModeKHR::eMailbox)
+        };
+        return it != present_modes.end() ? *it : vk::PresentModeKHR::eFifo;
+      }()
+    };
+
+    auto const extent{
+      [&capabilities, this] {
+        if (auto constexpr extent_special_val{0xFFFFFFFF}; capabilities.
+          currentExtent.width != extent_special_val && capabilities.
+          currentExtent.height != extent_special_val) {
+          return capabilities.currentExtent;
+        }
+
+        std::uint32_t width;
+        std::uint32_t height;
+        RECT client_rect;
+        GetClientRect(hwnd_.get(), &client_rect);
+        CalculateWindowSize(client_rect, width, height);
+
+        return vk::Extent2D{
+          std::clamp(width, capabilities.minImageExtent.width,
+                     capabilities.maxImageExtent.width),
+          std::clamp(height, capabilities.minImageExtent.height,
+                     capabilities.maxImageExtent.height)
+        };
+      }()
+    };
+
+    auto const image_count{std::min(2u, capabilities.maxImageCount)};
+
+    auto const [graphics_family_idx, present_family_idx]{
+      FindQueueFamilies(physical_device_)
+    };
+
+    std::array const queue_family_indices{
+      graphics_family_idx.value(), present_family_idx.value()
+    };
+
+    auto const transfer_dst_supported{
+      static_cast<bool>(capabilities.supportedUsageFlags &
+                        vk::ImageUsageFlagBits::eTransferDst)
+    };
+
+    // The post processing chain writes an 8 bit RGBA image that gets copied
+    // into the swap chain, so the formats have to match bit for bit.
+    post_processing_supported_ = transfer_dst_supported && (format ==
+      vk::Format::eB8G8R8A8Srgb || format == vk::Format::eB8G8R8A8Unorm ||
+      format == vk::Format::eR8G8B8A8Srgb || format ==
+      vk::Format::eR8G8B8A8Unorm);
+
+    // Dynamic resolution in MSAA mode blits from a target of the same format
+    auto constexpr blit_features{
+      vk::FormatFeatureFlagBits::eBlitSrc | vk::FormatFeatureFlagBits::eBlitDst
+      | vk::FormatFeatureFlagBits::eSampledImageFilterLinear
+    };
+    swap_chain_blit_supported_ = transfer_dst_supported && (physical_device_.
+      getFormatProperties(format).optimalTilingFeatures & blit_features) ==
+      blit_features;
+
+    swap_chain_ = device_.createSwapchainKHR(vk::SwapchainCreateInfoKHR{
+      {}, surface_, image_count, format, color_space, extent, 1,
+      transfer_dst_supported
+        ? vk::ImageUsageFlagBits::eColorAttachment |
+        vk::ImageUsageFlagBits::eTransferDst
+        : vk::ImageUsageFlagBits::eColorAttachment,
+      graphics_family_idx != present_family_idx
+        ? vk::SharingMode::eConcurrent
+        : vk::SharingMode::eExclusive,
+      queue_family_indices, capabilities.currentTransform,
+      vk::CompositeAlphaFlagBitsKHR::eOpaque, present_mode, vk::True
+    });
+
+    swap_chain_images_ = device_.getSwapchainImagesKHR(swap_chain_);
+    swap_chain_image_format_ = format;
+    swap_chain_extent_ = extent;
+
+    swap_chain_image_views_.resize(swap_chain_images_.size());
+
+    for (std::size_t i{0}; i < swap_chain_images_.size(); i++) {
+      swap_chain_image_views_[i] = CreateImageView(
+        swap_chain_images_[i], swap_chain_image_format_,
+        vk::ImageAspectFlagBits::eColor, 1);
+    }
+  }
+
+  [[nodiscard]] auto CreateImageView(vk::Image const image,
+                                     vk::Format const format,
+                                     vk::ImageAspectFlags const aspect_mask,
+                                     std::uint32_t const mip_count) const ->
+    vk::ImageView {
+    return device_.createImageView(vk::ImageViewCreateInfo{
+      {}, image, vk::ImageViewType::e2D, format, {},
+      vk::ImageSubresourceRange{aspect_mask, 0, mip_count, 0, 1}
+    });
+  }
+
+  [[nodiscard]] auto FindSupportedFormat(
+    std::span<vk::Format const> const candidates, vk::ImageTiling const tiling,
+    vk::FormatFeatureFlags const features) const -> vk::Format {
+    for (auto const format : candidates) {
+      auto const format_props{physical_device_.getFormatProperties(format)};
+
+      if (tiling == vk::ImageTiling::eLinear && (format_props.
+        linearTilingFeatures & features) == features) {
+        return format;
+      }
+
+      if (tiling == vk::ImageTiling::eOptimal && (format_props.
+        optimalTilingFeatures & features) == features) {
+        return format;
+      }
+    }
+
+    throw std::runtime_error{"Failed to find supported format."};
+  }
+
+  auto CreateImage(std::uint32_t const width, std::uint32_t const height,
+                   std::uint32_t const mip_count,
+                   vk::SampleCountFlagBits const sample_count,
+                   vk::Format const format, vk::ImageTiling const tiling,
+                   vk::ImageUsageFlags const usage,
+                   vk::MemoryPropertyFlags const memory_properties,
+                   vk::Image& image,
+                   vk::DeviceMemory& image_memory) const -> void {
+    image = device_.createImage(vk::ImageCreateInfo{
+      {}, vk::ImageType::e2D, format, vk::Extent3D{width, height, 1}, mip_count,
+      1, sample_count, tiling, usage, vk::SharingMode::eExclusive,
+    });
+
+    auto const mem_req{device_.getImageMemoryRequirements(image)};
+    image_memory = device_.allocateMemory(vk::MemoryAllocateInfo{
+      mem_req.size, FindMemoryType(mem_req.memoryTypeBits, memory_properties)
+    });
+    device_.bindImageMemory(image, image_memory, 0);
+  }
+
+  auto CreateColorResources() -> void {
+    if (anti_aliasing_ != AntiAliasing::kMsaa) {
+      color_resource_ = render_graph_->CreateImage(RenderGraph::ImageDesc{
+        GetSceneColorFormat(), swap_chain_extent_
+      });
+      return;
+    }
+
+    if (msaa_samples_ == vk::SampleCountFlagBits::e1) {
+      color_resource_.reset();
+      return;
+    }
+
+    // The graph creates attachment-only images as transient attachments and
+    // backs them with lazily allocated memory where available.
+    color_resource_ = render_graph_->CreateImage(RenderGraph::ImageDesc{
+      swap_chain_image_format_, swap_chain_extent_, msaa_samples_,
+      vk::ImageAspectFlagBits::eColor
+    });
+  }
+
+  [[nodiscard]] auto FindDepthFormat() const -> vk::Format {
+    return FindSupportedFormat(
+      std::array{
+        vk::Format::eD32Sfloat, vk::Format::eD32SfloatS8Uint,
+        vk::Format::eD24UnormS8Uint
+      }, vk::ImageTiling::eOptimal,
+      vk::FormatFeatureFlagBits::eDepthStencilAttachment);
+  }
+
+  auto CreateDepthResources() -> void {
+    depth_resource_ = render_graph_->CreateImage(RenderGraph::ImageDesc{
+      FindDepthFormat(), swap_chain_extent_, msaa_samples_,
+      vk::ImageAspectFlagBits::eDepth
+    });
+  }
+
+  auto CreateRenderGraph() -> void {
+    render_graph_ = std::make_unique<RenderGraph>(
+      device_, physical_device_.getMemoryProperties());
+
+    // Swap chain images come out of the acquire semaphore wait, which is
+    // placed on the color attachment output stage.
+    swap_chain_resource_ = render_graph_->ImportImage(
+      RenderGraph::ImageDesc{swap_chain_image_format_, swap_chain_extent_},
+      ImageSyncState{
+        vk::PipelineStageFlagBits2::eColorAttachmentOutput, {},
+        vk::ImageLayout::eUndefined
+      }, ResourceUsage::kPresent);
+
+    // The views are blitted into the swap chain, which may lose blit support
+    // when it is recreated
+    if (multiview_ && !swap_chain_blit_supported_) {
+      multiview_ = false;
+      std::cout <<
+        "Multiview disabled, the swap chain does not support blits.\n";
+    }
+
+    scene_output_resource_.reset();
+    post_process_passes_.clear();
+
+    if (!IsDynamicResolutionActive()) {
+      render_scale_ = 1.0f;
+    }
+
+    if (multiview_) {
+      AddMultiviewPasses();
+    } else {
+      AddScenePasses();
+    }
+
+    render_graph_->Compile();
+
+    // The swap chain image count may change with the swap chain
+    if (auto const count{swap_chain_images_.size() * max_frames_in_flight_};
+      prerecorded_command_buffers_.size() != count) {
+      for (auto const& prerecorded : prerecorded_command_buffers_) {
+        device_.freeCommandBuffers(command_pool_, prerecorded.command_buffer);
+      }
+
+      prerecorded_command_buffers_.clear();
+
+      for (auto const command_buffer : device_.allocateCommandBuffers(
+             vk::CommandBufferAllocateInfo{
+               command_pool_, vk::CommandBufferLevel::ePrimary,
+               static_cast<std::uint32_t>(count)
+             })) {
+        prerecorded_command_buffers_.emplace_back(
+          PrerecordedCommandBuffer{command_buffer});
+      }
+    }
+
+    InvalidatePrerecordedCommandBuffers();
+
+    if (!post_process_passes_.empty()) {
+      WritePostProcessingDescriptorSets();
+    }
+
+    auto const [unaliased_size, allocated_size, lazily_allocated_size,
+      lazily_committed_size, transient_image_count, memory_block_count,
+      culled_pass_count]{render_graph_->GetMemoryStats()};
+
+    std::cout << "Render graph: " << transient_image_count <<
+      " transient images at " << static_cast<std::uint32_t>(msaa_samples_) <<
+      "x MSAA in " << memory_block_count << " memory blocks, " <<
+      allocated_size / 1024 << " KiB allocated (" << unaliased_size / 1024 <<
+      " KiB without aliasing), " << lazily_allocated_size / 1024 <<
+      " KiB of it lazily allocated, " << culled_pass_count <<
+      " passes culled.\n";
+  }
+
+  auto AddScenePasses() -> void {
+    CreateColorResources();
+    CreateDepthResources();
+
+    // All targets are allocated at the swap chain size, the scale is applied
+    // through the render area so changing it never reallocates.
+    if (IsDynamicResolutionActive() && anti_aliasing_ == AntiAliasing::kMsaa) {
+      scene_output_resource_ = render_graph_->CreateImage(
+        RenderGraph::ImageDesc{swap_chain_image_format_, swap_chain_extent_});
+    }
+
+    if (depth_prepass_) {
+      render_graph_->AddPass("Depth Prepass", {
+                               {
+                                 depth_resource_,
+                                 ResourceUsage::kDepthStencilAttachment
+                               }
+                             },
+                             [this](vk::CommandBuffer const command_buffer,
+                                    RenderGraph const& graph) {
+                               RecordDepthPrepass(command_buffer, graph);
+                             });
+    }
+
+    std::vector<RenderGraph::ResourceUse> scene_uses{
+      {
+        depth_resource_,
+        depth_prepass_
+          ? ResourceUsage::kDepthStencilReadOnly
+          : ResourceUsage::kDepthStencilAttachment
+      }
+    };
+
+    if (anti_aliasing_ == AntiAliasing::kMsaa) {
+      scene_uses.emplace_back(
+        scene_output_resource_.value_or(swap_chain_resource_),
+        ResourceUsage::kColorAttachment);
+    }
+
+    if (color_resource_) {
+      scene_uses.emplace_back(*color_resource_,
+                              ResourceUsage::kColorAttachment);
+    }
+
+    render_graph_->AddPass("Scene", std::move(scene_uses),
+                           [this](vk::CommandBuffer const command_buffer,
+                                  RenderGraph const& graph) {
+                             RecordScenePass(command_buffer, graph);
+                           });
+
+    if (anti_aliasing_ != AntiAliasing::kMsaa) {
+      AddPostProcessingPasses();
+    }
+
+    if (scene_output_resource_) {
+      render_graph_->AddPass("Upscale", {
+                               {
+                                 *scene_output_resource_,
+                                 ResourceUsage::kTransferSrc
+                               },
+                               {
+                                 swap_chain_resource_,
+                                 ResourceUsage::kTransferDst
+                               }
+                             },
+                             [this](vk::CommandBuffer const command_buffer,
+                                    RenderGraph const& graph) {
+                               RecordUpscalePass(command_buffer, graph);
+                             });
+    }
+  }
+
+  // Every view is drawn by a single pass into its own layer of array images,
+  // then the layers are placed side by side in the swap chain. Neither the
+  // depth prepass nor post processing run in multiview mode.
+  auto AddMultiviewPasses() -> void {
+    auto const extent{GetMultiviewExtent()};
+    auto const color_format{GetSceneColorFormat()};
+
+    auto const output{
+      render_graph_->CreateImage(RenderGraph::ImageDesc{
+        color_format, extent, vk::SampleCountFlagBits::e1,
+        vk::ImageAspectFlagBits::eColor, {}, multiview_view_count_
+      })
+    };
+
+    if (msaa_samples_ == vk::SampleCountFlagBits::e1) {
+      color_resource_.reset();
+    } else {
+      color_resource_ = render_graph_->CreateImage(RenderGraph::ImageDesc{
+        color_format, extent, msaa_samples_, vk::ImageAspectFlagBits::eColor,
+        {}, multiview_view_count_
+      });
+    }
+
+    depth_resource_ = render_graph_->CreateImage(RenderGraph::ImageDesc{
+      FindDepthFormat(), extent, msaa_samples_, vk::ImageAspectFlagBits::eDepth,
+      {}, multiview_view_count_
+    });
+
+    std::vector<RenderGraph::ResourceUse> scene_uses{
+      {depth_resource_, ResourceUsage::kDepthStencilAttachment},
+      {output, ResourceUsage::kColorAttachment}
+    };
+
+    if (color_resource_) {
+      scene_uses.emplace_back(*color_resource_,
+                              ResourceUsage::kColorAttachment);
+    }
+
+    render_graph_->AddPass("Multiview Scene", std::move(scene_uses),
+                           [this, output](
+                           vk::CommandBuffer const command_buffer,
+                           RenderGraph const& graph) {
+                             RecordMultiviewScenePass(command_buffer, graph,
+                                                      output);
+                           });
+
+    render_graph_->AddPass("Copy Views To Swap Chain", {
+                             {output, ResourceUsage::kTransferSrc},
+                             {swap_chain_resource_, ResourceUsage::kTransferDst}
+                           },
+                           [this, output](
+                           vk::CommandBuffer const command_buffer,
+                           RenderGraph const& graph) {
+                             RecordMultiviewCopyPass(command_buffer, graph,
+                                                     output);
+                           });
+  }
+
+  auto AddPostProcessingPasses() -> void {
+    auto const swizzle{
+      swap_chain_image_format_ == vk::Format::eB8G8R8A8Srgb ||
+      swap_chain_image_format_ == vk::Format::eB8G8R8A8Unorm
+    };
+
+    std::vector<std::pair<std::string, vk::Pipeline>> stages{
+      {"Tonemap", tonemap_pipeline_}, {"FXAA", fxaa_pipeline_}
+    };
+
+    if (anti_aliasing_ == AntiAliasing::kFxaaSharpen) {
+      stages.emplace_back("Sharpen", sharpen_pipeline_);
+    }
+
+    // Each stage reads the previous output through a sampler and writes a new
+    // 8 bit image. Stages two apart do not overlap, so the graph can alias
+    // their images.
+    auto input{*color_resource_};
+
+    for (std::size_t i{0}; i < stages.size(); i++) {
+      auto& [name, pipeline]{stages[i]};
+
+      auto const output{
+        render_graph_->CreateImage(RenderGraph::ImageDesc{
+          vk::Format::eR8G8B8A8Unorm, swap_chain_extent_
+        })
+      };
+
+      // Only the last stage writes in swap chain channel order
+      post_process_passes_.emplace_back(PostProcessPass{
+        pipeline, input, output,
+        swizzle && i + 1 == stages.size() ? POST_PROCESS_FLAG_SWIZZLE_BGRA : 0
+      });
+
+      render_graph_->AddPass(std::move(name), {
+                               {input, ResourceUsage::kComputeShaderSampled},
+                               {output, ResourceUsage::kComputeShaderStorage}
+                             },
+                             [this, i](vk::CommandBuffer const command_buffer,
+                                       RenderGraph const& graph) {
+                               RecordPostProcessPass(
+                                 command_buffer, graph,
+                                 post_process_passes_[i]);
+                             });
+
+      input = output;
+    }
+
+    render_graph_->AddPass("Copy To Swap Chain", {
+                             {input, ResourceUsage::kTransferSrc},
+                             {swap_chain_resource_, ResourceUsage::kTransferDst}
+                           },
+                           [this, input](vk::CommandBuffer const command_buffer,
+                                         RenderGraph const& graph) {
+                             vk::ImageSubresourceLayers constexpr
+                               subresource{vk::ImageAspectFlagBits::eColor, 0,
+                                           0, 1};
+
+                             command_buffer.copyImage(
+                               graph.GetImage(input),
+                               vk::ImageLayout::eTransferSrcOptimal,
+                               graph.GetImage(swap_chain_resource_),
+                               vk::ImageLayout::eTransferDstOptimal,
+                               vk::ImageCopy{
+                                 subresource, {}, subresource, {},
+                                 vk::Extent3D{swap_chain_extent_, 1}
+                               });
+                           });
+  }
+
+  // Transient image views only exist after compilation, so the descriptor sets
+  // are rewritten every time the graph is rebuilt.
+  auto WritePostProcessingDescriptorSets() -> void {
+    device_.resetDescriptorPool(post_process_descriptor_pool_);
+
+    std::vector const descriptor_set_layouts{
+      post_process_passes_.size(), post_process_descriptor_set_layout_
+    };
+
+    auto const descriptor_sets{
+      device_.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{
+        post_process_descriptor_pool_, descriptor_set_layouts
+      })
+    };
+
+    for (std::size_t i{0}; i < post_process_passes_.size(); i++) {
+      auto& pass{post_process_passes_[i]};
+      pass.descriptor_set = descriptor_sets[i];
+
+      vk::DescriptorImageInfo const input_info{
+        post_process_sampler_, render_graph_->GetImageView(pass.input),
+        vk::ImageLayout::eShaderReadOnlyOptimal
+      };
+      vk::DescriptorImageInfo const output_info{
+        VK_NULL_HANDLE, render_graph_->GetImageView(pass.output),
+        vk::ImageLayout::eGeneral
+      };
+
+      device_.updateDescriptorSets(std::array{
+                                     vk::WriteDescriptorSet{
+                                       pass.descriptor_set, 0, 0,
+                                       vk::DescriptorType::
+                                       eCombinedImageSampler, input_info
+                                     },
+                                     vk::WriteDescriptorSet{
+                                       pass.descriptor_set, 1, 0,
+                                       vk::DescriptorType::eStorageImage,
+                                       output_info
+                                     }
+                                   }, {});
+    }
+  }
+
+  auto DestroyRenderGraph() -> void {
+    if (render_graph_) {
+      PrintLazyMemoryCommitment();
+    }
+
+    render_graph_.reset();
+  }
+
+  auto PrintLazyMemoryCommitment() const -> void {
+    auto const stats{render_graph_->GetMemoryStats()};
+
+    if (stats.lazily_allocated_size == 0) {
+      std::cout << "Lazily allocated memory is not available, transient "
+        "attachments use device local memory.\n";
+      return;
+    }
+
+    std::cout << "Lazily allocated attachments committed " << stats.
+      lazily_committed_size / 1024 << " KiB of " << stats.lazily_allocated_size
+      / 1024 << " KiB, saving " << (stats.lazily_allocated_size - stats.
+        lazily_committed_size) / 1024 << " KiB.\n";
+  }
+
+  auto RecordScenePass(vk::CommandBuffer const command_buffer,
+                       RenderGraph const& graph) const -> void {
+    // With multisampling the scene is drawn into the transient color image and
+    // resolved into the output image at the end of rendering. With post
+    // processing it is drawn into the HDR image at one sample. The output is
+    // the swap chain image unless it gets upscaled.
+    auto const resolve{msaa_samples_ != vk::SampleCountFlagBits::e1};
+    auto const output{scene_output_resource_.value_or(swap_chain_resource_)};
+    auto const render_extent{GetRenderExtent()};
+
+    vk::RenderingAttachmentInfo const color_attachment{
+      color_resource_
+        ? graph.GetImageView(*color_resource_)
+        : graph.GetImageView(output),
+      vk::ImageLayout::eColorAttachmentOptimal,
+      resolve
+        ? vk::ResolveModeFlagBits::eAverage
+        : vk::ResolveModeFlagBits::eNone,
+      resolve ? graph.GetImageView(output) : vk::ImageView{},
+      vk::ImageLayout::eColorAttachmentOptimal, vk::AttachmentLoadOp::eClear,
+      resolve
+        ? vk::AttachmentStoreOp::eDontCare
+        : vk::AttachmentStoreOp::eStore,
+      vk::ClearColorValue{0.0f, 0.0f, 0.0f, 1.0f}
+    };
+
+    // With the depth prepass the depth buffer is already complete and only
+    // read, storeOp none keeps the read-only attachment from being written.
+    vk::RenderingAttachmentInfo const depth_attachment{
+      graph.GetImageView(depth_resource_),
+      depth_prepass_
+        ? vk::ImageLayout::eDepthStencilReadOnlyOptimal
+        : vk::ImageLayout::eDepthStencilAttachmentOptimal,
+      vk::ResolveModeFlagBits::eNone, VK_NULL_HANDLE,
+      vk::ImageLayout::eUndefined,
+      depth_prepass_
+        ? vk::AttachmentLoadOp::eLoad
+        : vk::AttachmentLoadOp::eClear,
+      depth_prepass_
+        ? vk::AttachmentStoreOp::eNone
+        : vk::AttachmentStoreOp::eDontCare,
+      vk::ClearDepthStencilValue{1.0f, 0}
+    };
+
+    command_buffer.beginRendering(vk::RenderingInfo{
+      {}, vk::Rect2D{{0, 0}, render_extent}, 1, 0, color_attachment,
+      &depth_attachment
+    });
+    RecordSceneDraws(command_buffer, render_extent);
+    command_buffer.endRendering();
+  }
+
+  // Binds the scene pipeline and geometry inside an already begun rendering
+  // and draws every mesh
+  auto RecordSceneDraws(vk::CommandBuffer const command_buffer,
+                        vk::Extent2D const render_extent) const -> void {
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                                GetScenePipeline());
+
+    if (vertex_pulling_) {
+      VertexPullingPushConstants const push_constants{vertex_buffer_address_};
+      command_buffer.pushConstants(pipeline_layout_,
+                                   vk::ShaderStageFlagBits::eVertex, 0,
+                                   sizeof(push_constants), &push_constants);
+    } else {
+      command_buffer.bindVertexBuffers(
+        0, geometry_pool_->GetVertexBuffer(full_vertex_stream_),
+        vk::DeviceSize{0});
+    }
+
+    command_buffer.bindIndexBuffer(geometry_pool_->GetIndexBuffer(), 0,
+                                   GeometryPool::GetIndexType());
+    command_buffer.setViewport(0, vk::Viewport{
+                                 0, 0, static_cast<float>(render_extent.width),
+                                 static_cast<float>(render_extent.height), 0, 1
+                               });
+    command_buffer.setScissor(0, vk::Rect2D{{0, 0}, render_extent});
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+                                      pipeline_layout_, 0,
+                                      descriptor_sets_[current_frame_], {});
+    DrawMeshes(command_buffer);
+  }
+
+  // The view mask makes a single draw stream render into every layer of the
+  // attachments, the vertex shader picks the matrices by gl_ViewIndex
+  auto RecordMultiviewScenePass(vk::CommandBuffer const command_buffer,
+                                RenderGraph const& graph,
+                                RenderGraph::ResourceHandle const output) const
+    -> void {
+    auto const resolve{msaa_samples_ != vk::SampleCountFlagBits::e1};
+    auto const extent{GetMultiviewExtent()};
+
+    vk::RenderingAttachmentInfo const color_attachment{
+      color_resource_
+        ? graph.GetImageView(*color_resource_)
+        : graph.GetImageView(output),
+      vk::ImageLayout::eColorAttachmentOptimal,
+      resolve
+        ? vk::ResolveModeFlagBits::eAverage
+        : vk::ResolveModeFlagBits::eNone,
+      resolve ? graph.GetImageView(output) : vk::ImageView{},
+      vk::ImageLayout::eColorAttachmentOptimal, vk::AttachmentLoadOp::eClear,
+      resolve
+        ? vk::AttachmentStoreOp::eDontCare
+        : vk::AttachmentStoreOp::eStore,
+      vk::ClearColorValue{0.0f, 0.0f, 0.0f, 1.0f}
+    };
+
+    vk::RenderingAttachmentInfo const depth_attachment{
+      graph.GetImageView(depth_resource_),
+      vk::ImageLayout::eDepthStencilAttachmentOptimal,
+      vk::ResolveModeFlagBits::eNone, VK_NULL_HANDLE,
+      vk::ImageLayout::eUndefined, vk::AttachmentLoadOp::eClear,
+      vk::AttachmentStoreOp::eDontCare, vk::ClearDepthStencilValue{1.0f, 0}
+    };
+
+    // The layer count is ignored when the view mask is not zero
+    command_buffer.beginRendering(vk::RenderingInfo{
+      {}, vk::Rect2D{{0, 0}, extent}, 1, GetMultiviewMask(), color_attachment,
+      &depth_attachment
+    });
+    RecordSceneDraws(command_buffer, extent);
+    command_buffer.endRendering();
+  }
+
+  auto RecordMultiviewCopyPass(vk::CommandBuffer const command_buffer,
+                               RenderGraph const& graph,
+                               RenderGraph::ResourceHandle const output) const
+    -> void {
+    auto const swap_chain_image{graph.GetImage(swap_chain_resource_)};
+
+    // The views do not cover the whole swap chain image, the rest would be
+    // left undefined
+    command_buffer.clearColorImage(swap_chain_image,
+                                   vk::ImageLayout::eTransferDstOptimal,
+                                   vk::ClearColorValue{0.0f, 0.0f, 0.0f, 1.0f},
+                                   vk::ImageSubresourceRange{
+                                     vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1
+                                   });
+
+    vk::MemoryBarrier2 constexpr clear_barrier{
+      vk::PipelineStageFlagBits2::eClear, vk::AccessFlagBits2::eTransferWrite,
+      vk::PipelineStageFlagBits2::eBlit, vk::AccessFlagBits2::eTransferWrite
+    };
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, clear_barrier});
+
+    auto const [width, height]{GetMultiviewExtent()};
+    std::vector<vk::ImageBlit> regions;
+
+    // The views have the same size in both images, the blit only converts
+    // the format
+    for (std::uint32_t i{0}; i < multiview_view_count_; i++) {
+      auto const x{static_cast<std::int32_t>(i * width)};
+      regions.emplace_back(
+        vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, i, 1},
+        std::array{
+          vk::Offset3D{0, 0, 0},
+          vk::Offset3D{
+            static_cast<std::int32_t>(width), static_cast<std::int32_t>(height),
+            1
+          }
+        },
+        vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1},
+        std::array{
+          vk::Offset3D{x, 0, 0},
+          vk::Offset3D{
+            x + static_cast<std::int32_t>(width),
+            static_cast<std::int32_t>(height), 1
+          }
+        });
+    }
+
+    command_buffer.blitImage(graph.GetImage(output),
+                             vk::ImageLayout::eTransferSrcOptimal,
+                             swap_chain_image,
+                             vk::ImageLayout::eTransferDstOptimal, regions,
+                             vk::Filter::eNearest);
+  }
+
+  [[nodiscard]] auto GetMultiviewMask() const -> std::uint32_t {
+    return (1u << multiview_view_count_) - 1;
+  }
+
+  // Each view gets an equal share of the swap chain width. Cube faces are
+  // square to match their 90 degree field of view.
+  [[nodiscard]] auto GetMultiviewExtent() const -> vk::Extent2D {
+    auto const width{
+      std::max(1u, swap_chain_extent_.width / multiview_view_count_)
+    };
+
+    if (multiview_cube_faces_) {
+      auto const size{std::min(width, swap_chain_extent_.height)};
+      return vk::Extent2D{size, size};
+    }
+
+    return vk::Extent2D{width, swap_chain_extent_.height};
+  }
+
+  // With six views they are the faces of a cube map around the camera,
+  // otherwise eyes next to each other looking in the camera's direction
+  [[nodiscard]] auto GetMultiviewViewProjection(
+    glm::mat4 const& view, std::uint32_t const view_idx) const -> glm::mat4 {
+    auto const [width, height]{GetMultiviewExtent()};
+
+    if (multiview_cube_faces_) {
+      // +X, -X, +Y, -Y, +Z, -Z with the usual cube map up vectors
+      static std::array<std::pair<glm::vec3, glm::vec3>, 6> const faces{
+        {
+          {{1, 0, 0}, {0, -1, 0}}, {{-1, 0, 0}, {0, -1, 0}},
+          {{0, 1, 0}, {0, 0, 1}}, {{0, -1, 0}, {0, 0, -1}},
+          {{0, 0, 1}, {0, -1, 0}}, {{0, 0, -1}, {0, -1, 0}}
+        }
+      };
+
+      auto const eye{glm::vec3{glm::inverse(view)[3]}};
+      auto const& [direction, up]{faces[view_idx]};
+      auto proj{glm::perspective(glm::radians(90.0f), 1.0f, z_near_, z_far_)};
+      proj[1][1] *= -1;
+      return proj * glm::lookAt(eye, eye + direction, up);
+    }
+
+    // Moving the world the other way moves the eye along the view's x axis
+    auto const eye_offset{
+      (static_cast<float>(view_idx) -
+       static_cast<float>(multiview_view_count_ - 1) / 2.0f) *
+      multiview_eye_separation_
+    };
+    auto proj{
+      glm::perspective(glm::radians(45.0f),
+                       static_cast<float>(width) / static_cast<float>(height),
+                       z_near_, z_far_)
+    };
+    proj[1][1] *= -1;
+    return proj * glm::translate(glm::mat4{1}, glm::vec3{-eye_offset, 0, 0}) *
+           view;
+  }
+
+  [[nodiscard]] auto GetScenePipeline() const -> vk::Pipeline {
+    auto const kind{
+      multiview_
+        ? ScenePipelineKind::kMultiview
+        : depth_prepass_
+        ? ScenePipelineKind::kShadingDepthEqual
+        : ScenePipelineKind::kShading
+    };
+    return scene_pipelines_.at(ScenePipelineKey{
+      kind, vertex_pulling_, GetShaderVariant(kind)
+    });
+  }
+
+  // Every mesh lives in the geometry pool, so they are all drawn from the same
+  // bindings with their own offsets
+  auto DrawMeshes(vk::CommandBuffer const command_buffer) const -> void {
+    for (auto const& mesh : meshes_) {
+      auto const [first_index, vertex_offset, index_count, vertex_count]{
+        geometry_pool_->GetMesh(mesh.handle)
+      };
+      command_buffer.drawIndexed(index_count, 1, first_index, vertex_offset, 0);
+    }
+  }
+
+  auto RecordDepthPrepass(vk::CommandBuffer const command_buffer,
+                          RenderGraph const& graph) const -> void {
+    auto const render_extent{GetRenderExtent()};
+
+    vk::RenderingAttachmentInfo const depth_attachment{
+      graph.GetImageView(depth_resource_),
+      vk::ImageLayout::eDepthStencilAttachmentOptimal,
+      vk::ResolveModeFlagBits::eNone, VK_NULL_HANDLE,
+      vk::ImageLayout::eUndefined, vk::AttachmentLoadOp::eClear,
+      vk::AttachmentStoreOp::eStore, vk::ClearDepthStencilValue{1.0f, 0}
+    };
+
+    command_buffer.beginRendering(vk::RenderingInfo{
+      {}, vk::Rect2D{{0, 0}, render_extent}, 1, 0, 0, nullptr,
+      &depth_attachment
+    });
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                                scene_pipelines_.at(ScenePipelineKey{
+                                  ScenePipelineKind::kDepthPrepass, false, {}
+                                }));
+    command_buffer.bindVertexBuffers(
+      0, geometry_pool_->GetVertexBuffer(position_stream_), vk::DeviceSize{0});
+    command_buffer.bindIndexBuffer(geometry_pool_->GetIndexBuffer(), 0,
+                                   GeometryPool::GetIndexType());
+    command_buffer.setViewport(0, vk::Viewport{
+                                 0, 0, static_cast<float>(render_extent.width),
+                                 static_cast<float>(render_extent.height), 0, 1
+                               });
+    command_buffer.setScissor(0, vk::Rect2D{{0, 0}, render_extent});
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+                                      pipeline_layout_, 0,
+                                      descriptor_sets_[current_frame_], {});
+    DrawMeshes(command_buffer);
+    command_buffer.endRendering();
+  }
+
+  auto RecordUpscalePass(vk::CommandBuffer const command_buffer,
+                         RenderGraph const& graph) const -> void {
+    auto const [render_width, render_height]{GetRenderExtent()};
+
+    vk::ImageSubresourceLayers constexpr subresource{
+      vk::ImageAspectFlagBits::eColor, 0, 0, 1
+    };
+
+    command_buffer.blitImage(graph.GetImage(*scene_output_resource_),
+                             vk::ImageLayout::eTransferSrcOptimal,
+                             graph.GetImage(swap_chain_resource_),
+                             vk::ImageLayout::eTransferDstOptimal,
+                             vk::ImageBlit{
+                               subresource,
+                               {
+                                 vk::Offset3D{0, 0, 0},
+                                 vk::Offset3D{
+                                   static_cast<std::int32_t>(render_width),
+                                   static_cast<std::int32_t>(render_height), 1
+                                 }
+                               },
+                               subresource,
+                               {
+                                 vk::Offset3D{0, 0, 0},
+                                 vk::Offset3D{
+                                   static_cast<std::int32_t>(swap_chain_extent_.
+                                     width),
+                                   static_cast<std::int32_t>(swap_chain_extent_.
+                                     height),
+                                   1
+                                 }
+                               }
+                             }, vk::Filter::eLinear);
+  }
+
+  struct PostProcessPass {
+    vk::Pipeline pipeline;
+    RenderGraph::ResourceHandle input;
+    RenderGraph::ResourceHandle output;
+    int flags;
+    vk::DescriptorSet descriptor_set;
+  };
+
+  auto RecordPostProcessPass(vk::CommandBuffer const command_buffer,
+                             RenderGraph const& graph,
+                             PostProcessPass const& pass) const -> void {
+    auto const& extent{graph.GetImageDesc(pass.output).extent};
+
+    // Only the region drawn at the current render scale of the scene color
+    // holds valid data, the tonemap pass upscales from it.
+    auto const [render_width, render_height]{GetRenderExtent()};
+    auto const input_scale{
+      pass.input == *color_resource_
+        ? glm::vec2{
+          static_cast<float>(render_width) / static_cast<float>(extent.width),
+          static_cast<float>(render_height) / static_cast<float>(extent.height)
+        }
+        : glm::vec2{1}
+    };
+
+    PostProcessPushConstants const push_constants{
+      glm::vec2{1.0f / extent.width, 1.0f / extent.height}, sharpness_,
+      pass.flags, input_scale
+    };
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pass.pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                      post_process_pipeline_layout_, 0,
+                                      pass.descriptor_set, {});
+    command_buffer.pushConstants(post_process_pipeline_layout_,
+                                 vk::ShaderStageFlagBits::eCompute, 0,
+                                 sizeof(push_constants), &push_constants);
+    command_buffer.dispatch(
+      (extent.width + POST_PROCESS_GROUP_SIZE - 1) / POST_PROCESS_GROUP_SIZE,
+      (extent.height + POST_PROCESS_GROUP_SIZE - 1) / POST_PROCESS_GROUP_SIZE,
+      1);
+  }
+
+  // Host image copies need the extension, the feature and support for the
+  // texture format. The texture is written in the layout it is sampled in if
+  // the implementation allows, otherwise it stays in the general layout.
+  [[nodiscard]] auto IsHostImageCopySupported() -> bool {
+    if (std::ranges::none_of(
+      physical_device_.enumerateDeviceExtensionProperties(),
+      [](vk::ExtensionProperties const& extension) {
+        return std::strcmp(extension.extensionName,
+                           VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME) == 0;
+      })) {
+      return false;
+    }
+
+    if (physical_device_.getFeatures2<
+      vk::PhysicalDeviceFeatures2,
+      vk::PhysicalDeviceHostImageCopyFeaturesEXT>().get<
+      vk::PhysicalDeviceHostImageCopyFeaturesEXT>().hostImageCopy ==
+        vk::False) {
+      return false;
+    }
+
+    if (!(physical_device_.getFormatProperties2<
+      vk::FormatProperties2, vk::FormatProperties3>(
+      vk::Format::eR8G8B8A8Srgb).get<vk::FormatProperties3>().
+      optimalTilingFeatures &
+      vk::FormatFeatureFlagBits2::eHostImageTransferEXT)) {
+      return false;
+    }
+
+    auto properties_chain{
+      physical_device_.getProperties2<
+        vk::PhysicalDeviceProperties2,
+        vk::PhysicalDeviceHostImageCopyPropertiesEXT>()
+    };
+    auto& host_image_copy_properties{
+      properties_chain.get<vk::PhysicalDeviceHostImageCopyPropertiesEXT>()
+    };
+    std::vector<vk::ImageLayout> copy_dst_layouts(
+      host_image_copy_properties.copyDstLayoutCount);
+    host_image_copy_properties.pCopyDstLayouts = copy_dst_layouts.data();
+    physical_device_.getProperties2(
+      &properties_chain.get<vk::PhysicalDeviceProperties2>());
+
+    texture_image_layout_ = std::ranges::find(
+                              copy_dst_layouts,
+                              vk::ImageLayout::eShaderReadOnlyOptimal) !=
+                            copy_dst_layouts.end()
+                              ? vk::ImageLayout::eShaderReadOnlyOptimal
+                              : vk::ImageLayout::eGeneral;
+    return true;
+  }
+
+  // Returns the time the upload took in seconds, without decoding the file
+  [[nodiscard]] auto LoadTexture() -> double {
+    int width;
+    int height;
+    int channel_count;
+    auto const pixel_data{
+      stbi_load(texture_path_.data(), &width, &height, &channel_count,
+                STBI_rgb_alpha)
+    };
+
+    if (!pixel_data) {
+      throw std::runtime_error{"Failed to load texture image."};
+    }
+
+    mip_levels_ = static_cast<std::uint32_t>(std::log2(std::max(width, height)))
+      + 1;
+
+    auto const start{std::chrono::high_resolution_clock::now()};
+    auto const texture_width{static_cast<std::uint32_t>(width)};
+    auto const texture_height{static_cast<std::uint32_t>(height)};
+
+    CreateTextureImage(texture_width, texture_height, mip_levels_,
+                       host_image_copy_supported_, texture_image_,
+                       texture_image_memory_);
+
+    std::span const pixels{
+      pixel_data, static_cast<std::size_t>(texture_width) * texture_height * 4
+    };
+
+    if (host_image_copy_supported_) {
+      UploadTextureWithHostCopy(pixels, texture_width, texture_height,
+                                mip_levels_, texture_image_);
+    } else {
+      UploadTextureWithStaging(pixels, texture_width, texture_height,
+                               mip_levels_, texture_image_);
+    }
+
+    std::chrono::duration<double> const upload_time{
+      std::chrono::high_resolution_clock::now() - start
+    };
+
+    stbi_image_free(pixel_data);
+    return upload_time.count();
+  }
+
+  auto CreateTextureImage(std::uint32_t const width, std::uint32_t const height,
+                          std::uint32_t const mip_levels, bool const host_copy,
+                          vk::Image& image,
+                          vk::DeviceMemory& image_memory) const -> void {
+    CreateImage(width, height, mip_levels, vk::SampleCountFlagBits::e1,
+                vk::Format::eR8G8B8A8Srgb, vk::ImageTiling::eOptimal,
+                host_copy
+                  ? vk::ImageUsageFlagBits::eHostTransferEXT |
+                  vk::ImageUsageFlagBits::eSampled
+                  : vk::ImageUsageFlagBits::eTransferSrc |
+                  vk::ImageUsageFlagBits::eTransferDst |
+                  vk::ImageUsageFlagBits::eSampled,
+                vk::MemoryPropertyFlagBits::eDeviceLocal, image, image_memory);
+  }
+
+  // Copies the top level through a staging buffer and blits the rest of the
+  // mip chain on the GPU
+  auto UploadTextureWithStaging(std::span<std::uint8_t const> const pixels,
+                                std::uint32_t const width,
+                                std::uint32_t const height,
+                                std::uint32_t const mip_levels,
+                                vk::Image const image) const -> void {
+    vk::Buffer staging_buffer;
+    vk::DeviceMemory staging_buffer_memory;
+
+    CreateBuffer(pixels.size_bytes(), vk::BufferUsageFlagBits::eTransferSrc,
+                 vk::MemoryPropertyFlagBits::eHostVisible |
+                 vk::MemoryPropertyFlagBits::eHostCoherent, staging_buffer,
+                 staging_buffer_memory);
+
+    auto const staging_buffer_ptr{
+      device_.mapMemory(staging_buffer_memory, {}, pixels.size_bytes())
+    };
+    std::memcpy(staging_buffer_ptr, pixels.data(), pixels.size_bytes());
+    device_.unmapMemory(staging_buffer_memory);
+
+    TransitionImageLayout(image, vk::ImageLayout::eUndefined,
+                          vk::ImageLayout::eTransferDstOptimal, mip_levels);
+
+    CopyBufferToImage(staging_buffer, image, width, height);
+
+    GenerateMipmaps(image, vk::Format::eR8G8B8A8Srgb,
+                    static_cast<std::int32_t>(width),
+                    static_cast<std::int32_t>(height), mip_levels);
+
+    device_.destroyBuffer(staging_buffer);
+    device_.freeMemory(staging_buffer_memory);
+  }
+
+  // Generates the mip chain on the CPU and writes every level straight into
+  // the image. Nothing is submitted to the device, so this may run on any
+  // thread.
+  auto UploadTextureWithHostCopy(std::span<std::uint8_t const> const pixels,
+                                 std::uint32_t const width,
+                                 std::uint32_t const height,
+                                 std::uint32_t const mip_levels,
+                                 vk::Image const image) const -> void {
+    device_.transitionImageLayoutEXT(vk::HostImageLayoutTransitionInfoEXT{
+      image, vk::ImageLayout::eUndefined, texture_image_layout_,
+      {vk::ImageAspectFlagBits::eColor, 0, mip_levels, 0, 1}
+    });
+
+    auto const mips{GenerateMipmapsOnHost(pixels, width, height, mip_levels)};
+
+    std::vector<vk::MemoryToImageCopyEXT> regions;
+    auto mip_width{width};
+    auto mip_height{height};
+
+    for (std::uint32_t i{0}; i < mip_levels; i++) {
+      regions.emplace_back(i == 0 ? pixels.data() : mips[i - 1].data(), 0, 0,
+                           vk::ImageSubresourceLayers{
+                             vk::ImageAspectFlagBits::eColor, i, 0, 1
+                           }, vk::Offset3D{0, 0, 0},
+                           vk::Extent3D{mip_width, mip_height, 1});
+      mip_width = std::max(mip_width / 2, 1u);
+      mip_height = std::max(mip_height / 2, 1u);
+    }
+
+    device_.copyMemoryToImageEXT(vk::CopyMemoryToImageInfoEXT{
+      {}, image, texture_image_layout_, regions
+    });
+  }
+
+  // Box filtered mip levels below the top one of an sRGB RGBA8 image. The
+  // color channels are averaged in linear space.
+  [[nodiscard]] static auto GenerateMipmapsOnHost(
+    std::span<std::uint8_t const> const pixels, std::uint32_t width,
+    std::uint32_t height,
+    std::uint32_t const mip_levels) -> std::vector<std::vector<std::uint8_t>> {
+    static auto const srgb_to_linear{
+      [] {
+        std::array<float, 256> ret{};
+
+        for (std::size_t i{0}; i < ret.size(); i++) {
+          auto const srgb{static_cast<float>(i) / 255.0f};
+          ret[i] = srgb <= 0.04045f
+                     ? srgb / 12.92f
+                     : std::pow((srgb + 0.055f) / 1.055f, 2.4f);
+        }
+
+        return ret;
+      }()
+    };
+
+    auto const linear_to_srgb{
+      [](float const linear) {
+        auto const srgb{
+          linear <= 0.0031308f
+            ? linear * 12.92f
+            : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f
+        };
+        return static_cast<std::uint8_t>(std::clamp(srgb, 0.0f, 1.0f) * 255.0f
+                                         + 0.5f);
+      }
+    };
+
+    std::vector<std::vector<std::uint8_t>> mips;
+    mips.reserve(mip_levels - 1);
+    auto src{pixels};
+
+    for (std::uint32_t level{1}; level < mip_levels; level++) {
+      auto const dst_width{std::max(width / 2, 1u)};
+      auto const dst_height{std::max(height / 2, 1u)};
+      auto& dst{mips.emplace_back(std::size_t{dst_width} * dst_height * 4)};
+
+      for (std::uint32_t y{0}; y < dst_height; y++) {
+        for (std::uint32_t x{0}; x < dst_width; x++) {
+          std::array const texels{
+            std::size_t{std::min(2 * y, height - 1)} * width +
+            std::min(2 * x, width - 1),
+            std::size_t{std::min(2 * y, height - 1)} * width +
+            std::min(2 * x + 1, width - 1),
+            std::size_t{std::min(2 * y + 1, height - 1)} * width +
+            std::min(2 * x, width - 1),
+            std::size_t{std::min(2 * y + 1, height - 1)} * width +
+            std::min(2 * x + 1, width - 1),
+          };
+
+          auto const dst_texel{(std::size_t{y} * dst_width + x) * 4};
+
+          for (std::size_t c{0}; c < 3; c++) {
+            auto sum{0.0f};
+
+            for (auto const texel : texels) {
+              sum += srgb_to_linear[src[texel * 4 + c]];
+            }
+
+            dst[dst_texel + c] = linear_to_srgb(sum / 4.0f);
+          }
+
+          std::uint32_t alpha_sum{0};
+
+          for (auto const texel : texels) {
+            alpha_sum += src[texel * 4 + 3];
+          }
 
-      if (indices.IsComplete()) {
-        break;
+          dst[dst_texel + 3] = static_cast<std::uint8_t>((alpha_sum + 2) / 4);
+        }
       }
 
-      ++idx;
+      src = dst;
+      width = dst_width;
+      height = dst_height;
     }
 
-    return indices;
+    return mips;
   }
 
-  [[nodiscard]] auto
-  GetMaxUsableSampleCount() const -> vk::SampleCountFlagBits {
-    auto const physical_device_properties{physical_device_.getProperties()};
-
-    auto const counts{
-      physical_device_properties.limits.framebufferColorSampleCounts &
-      physical_device_properties.limits.framebufferDepthSampleCounts
-    };
-
-    if (counts & vk::SampleCountFlagBits::e64) {
-      return vk::SampleCountFlagBits::e64;
-    }
+#ifdef TEXTURE_UPLOAD_BENCHMARK
+  // Uploads a generated texture through both paths, including the creation of
+  // the image and the mip chain
+  auto BenchmarkTextureUpload() const -> void {
+    auto const size{texture_upload_benchmark_size_};
+    auto const mip_levels{static_cast<std::uint32_t>(std::log2(size)) + 1};
+    std::vector<std::uint8_t> pixels(std::size_t{size} * size * 4);
 
-    if (counts & vk::SampleCountFlagBits::e32) {
-      return vk::SampleCountFlagBits::e32;
+    for (std::size_t i{0}; i < pixels.size(); i++) {
+      pixels[i] = static_cast<std::uint8_t>(i * 2654435761u >> 24);
     }
 
-    if (counts & vk::SampleCountFlagBits::e16) {
-      return vk::SampleCountFlagBits::e16;
-    }
+    auto const benchmark{
+      [&](bool const host_copy) {
+        std::chrono::duration<double> total_time{0};
 
-    if (counts & vk::SampleCountFlagBits::e8) {
-      return vk::SampleCountFlagBits::e8;
-    }
+        for (auto i{0}; i < texture_upload_benchmark_iterations_; i++) {
+          vk::Image image;
+          vk::DeviceMemory image_memory;
+          auto const start{std::chrono::high_resolution_clock::now()};
 
-    if (counts & vk::SampleCountFlagBits::e4) {
-      return vk::SampleCountFlagBits::e4;
-    }
+          CreateTextureImage(size, size, mip_levels, host_copy, image,
+                             image_memory);
 
-    if (counts & vk::SampleCountFlagBits::e2) {
-      return vk::SampleCountFlagBits::e2;
-    }
+          if (host_copy) {
+            UploadTextureWithHostCopy(pixels, size, size, mip_levels, image);
+          } else {
+            UploadTextureWithStaging(pixels, size, size, mip_levels, image);
+          }
 
-    return vk::SampleCountFlagBits::e1;
-  }
+          total_time += std::chrono::high_resolution_clock::now() - start;
 
-  auto CreateSwapChainAndViews() -> void {
-    auto const& [capabilities, formats, present_modes]{
-      QuerySwapChainSupport(physical_device_)
-    };
+          device_.destroyImage(image);
+          device_.freeMemory(image_memory);
+        }
 
-    auto const [format, color_space]{
-      [&formats] {
-        auto const it{
-          std::ranges::find(formats, vk::SurfaceFormatKHR{
-                              vk::Format::eB8G8R8A8Srgb,
-                              vk::ColorSpaceKHR::eSrgbNonlinear
-                            })
-        };
-        return it != formats.end() ? *it : formats[0];
-      }()
+        return total_time.count() * 1000.0 /
+               texture_upload_benchmark_iterations_;
+      }
     };
 
-    auto const present_mode{
-      [&present_modes] {
-        auto const it{
-          std::ranges::find(present_modes, vk::PresentModeKHR::eMailbox)
-        };
-        return it != present_modes.end() ? *it : vk::PresentModeKHR::eFifo;
-      }()
-    };
+    std::cout << "Texture upload benchmark, " << size << 'x' << size <<
+      " with " << mip_levels << " mip levels: staging buffer " <<
+      benchmark(false) << " ms";
 
-    auto const extent{
-      [&capabilities, this] {
-        if (auto constexpr extent_special_val{0xFFFFFFFF}; capabilities.
-          currentExtent.width != extent_special_val && capabilities.
-          currentExtent.height != extent_special_val) {
-          return capabilities.currentExtent;
-        }
+    if (host_image_copy_supported_) {
+      std::cout << ", host image copy " << benchmark(true) << " ms";
+    }
 
-        std::uint32_t width;
-        std::uint32_t height;
-        RECT client_rect;
-        GetClientRect(hwnd_.get(), &client_rect);
-        CalculateWindowSize(client_rect, width, height);
+    std::cout << ".\n";
+  }
+#endif
 
-        return vk::Extent2D{
-          std::clamp(width, capabilities.minImageExtent.width,
-                     capabilities.maxImageExtent.width),
-          std::clamp(height, capabilities.minImageExtent.height,
-                     capabilities.maxImageExtent.height)
-        };
-      }()
-    };
+  // Deduplicated vertices, their positions and the indices are written straight
+  // into mapped staging memory while the model is parsed, and the staging
+  // memory is released once it has been copied into the geometry pool. Only
+  // the mesh records and bounds stay on the host.
+  auto LoadModel() -> void {
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn;
+    std::string err;
 
-    auto const image_count{std::min(2u, capabilities.maxImageCount)};
+    if (!LoadObj(&attrib, &shapes, &materials, &warn, &err,
+                 model_path_.data())) {
+      throw std::runtime_error{warn + err};
+    }
 
-    auto const [graphics_family_idx, present_family_idx]{
-      FindQueueFamilies(physical_device_)
+    auto const memory_properties{physical_device_.getMemoryProperties()};
+    StagingStream vertex_staging{
+      device_, memory_properties, staging_chunk_size_
+    };
+    StagingStream position_staging{
+      device_, memory_properties, staging_chunk_size_
+    };
+    StagingStream index_staging{
+      device_, memory_properties, staging_chunk_size_
     };
 
-    std::array const queue_family_indices{
-      graphics_family_idx.value(), present_family_idx.value()
+    struct MeshData {
+      std::uint32_t first_vertex;
+      std::uint32_t vertex_count;
+      std::uint32_t first_index;
+      std::uint32_t index_count;
+      glm::vec3 bounds_min;
+      glm::vec3 bounds_max;
     };
 
-    swap_chain_ = device_.createSwapchainKHR(vk::SwapchainCreateInfoKHR{
-      {}, surface_, image_count, format, color_space, extent, 1,
-      vk::ImageUsageFlagBits::eColorAttachment,
-      graphics_family_idx != present_family_idx
-        ? vk::SharingMode::eConcurrent
-        : vk::SharingMode::eExclusive,
-      queue_family_indices, capabilities.currentTransform,
-      vk::CompositeAlphaFlagBitsKHR::eOpaque, present_mode, vk::True
-    });
+    std::vector<MeshData> mesh_data;
+    auto has_vertex_colors{false};
+    std::uint32_t vertex_count{0};
+    std::uint32_t index_count{0};
 
-    swap_chain_images_ = device_.getSwapchainImagesKHR(swap_chain_);
-    swap_chain_image_format_ = format;
-    swap_chain_extent_ = extent;
+    // Every shape becomes a separate mesh of the geometry pool. Its indices are
+    // relative to its own first vertex.
+    for (auto const& [name, mesh, lines, points] : shapes) {
+      MeshData data{
+        vertex_count, 0, index_count, 0,
+        glm::vec3{std::numeric_limits<float>::max()},
+        glm::vec3{std::numeric_limits<float>::lowest()}
+      };
 
-    swap_chain_image_views_.resize(swap_chain_images_.size());
+      std::unordered_map<Vertex, std::uint32_t> unique_vertices;
 
-    for (std::size_t i{0}; i < swap_chain_images_.size(); i++) {
-      swap_chain_image_views_[i] = CreateImageView(
-        swap_chain_images_[i], swap_chain_image_format_,
-        vk::ImageAspectFlagBits::eColor, 1);
-    }
-  }
+      for (auto const& [vertex_index, normal_index, texcoord_index] : mesh.
+           indices) {
+        Vertex vertex;
 
-  [[nodiscard]] auto CreateImageView(vk::Image const image,
-                                     vk::Format const format,
-                                     vk::ImageAspectFlags const aspect_mask,
-                                     std::uint32_t const mip_count) const ->
-    vk::ImageView {
-    return device_.createImageView(vk::ImageViewCreateInfo{
-      {}, image, vk::ImageViewType::e2D, format, {},
-      vk::ImageSubresourceRange{aspect_mask, 0, mip_count, 0, 1}
-    });
-  }
+        vertex.pos = {
+          attrib.vertices[3 * vertex_index + 0],
+          attrib.vertices[3 * vertex_index + 1],
+          attrib.vertices[3 * vertex_index + 2],
+        };
 
-  [[nodiscard]] auto FindSupportedFormat(
-    std::span<vk::Format const> const candidates, vk::ImageTiling const tiling,
-    vk::FormatFeatureFlags const features) const -> vk::Format {
-    for (auto const format : candidates) {
-      auto const format_props{physical_device_.getFormatProperties(format)};
+        vertex.uv = {
+          attrib.texcoords[2 * texcoord_index + 0],
+          1.0f - attrib.texcoords[2 * texcoord_index + 1],
+        };
 
-      if (tiling == vk::ImageTiling::eLinear && (format_props.
-        linearTilingFeatures & features) == features) {
-        return format;
+        // Files without vertex colors either have no colors at all or white
+        // ones, depending on the loader version
+        vertex.color = attrib.colors.empty()
+                         ? glm::vec3{1.0f, 1.0f, 1.0f}
+                         : glm::vec3{
+                           attrib.colors[3 * vertex_index + 0],
+                           attrib.colors[3 * vertex_index + 1],
+                           attrib.colors[3 * vertex_index + 2],
+                         };
+
+        if (vertex.color != glm::vec3{1.0f, 1.0f, 1.0f}) {
+          has_vertex_colors = true;
+        }
+
+        auto const [it, inserted]{
+          unique_vertices.try_emplace(vertex, vertex_count - data.first_vertex)
+        };
+
+        if (inserted) {
+          // Depth-only work only needs the positions, a tightly packed stream
+          // of them avoids fetching the rest of the attributes.
+          vertex_staging.Write(vertex);
+          position_staging.Write(vertex.pos);
+          data.bounds_min = glm::min(data.bounds_min, vertex.pos);
+          data.bounds_max = glm::max(data.bounds_max, vertex.pos);
+          ++vertex_count;
+        }
+
+        index_staging.Write(it->second);
+        ++index_count;
       }
 
-      if (tiling == vk::ImageTiling::eOptimal && (format_props.
-        optimalTilingFeatures & features) == features) {
-        return format;
+      data.vertex_count = vertex_count - data.first_vertex;
+      data.index_count = index_count - data.first_index;
+
+      if (data.index_count != 0) {
+        mesh_data.emplace_back(data);
       }
     }
 
-    throw std::runtime_error{"Failed to find supported format."};
-  }
+    // Multiplying by white is compiled out of the scene shaders
+    material_variant_.vertex_color = has_vertex_colors ? vk::True : vk::False;
+    material_variant_.texture = vk::True;
 
-  auto CreateImage(std::uint32_t const width, std::uint32_t const height,
-                   std::uint32_t const mip_count,
-                   vk::SampleCountFlagBits const sample_count,
-                   vk::Format const format, vk::ImageTiling const tiling,
-                   vk::ImageUsageFlags const usage,
-                   vk::MemoryPropertyFlags const memory_properties,
-                   vk::Image& image,
-                   vk::DeviceMemory& image_memory) const -> void {
-    image = device_.createImage(vk::ImageCreateInfo{
-      {}, vk::ImageType::e2D, format, vk::Extent3D{width, height, 1}, mip_count,
-      1, sample_count, tiling, usage, vk::SharingMode::eExclusive,
-    });
+    // The parsed model is not needed anymore, only the staged data is
+    attrib = tinyobj::attrib_t{};
+    shapes = {};
+    materials = {};
 
-    auto const mem_req{device_.getImageMemoryRequirements(image)};
-    image_memory = device_.allocateMemory(vk::MemoryAllocateInfo{
-      mem_req.size, FindMemoryType(mem_req.memoryTypeBits, memory_properties)
-    });
-    device_.bindImageMemory(image, image_memory, 0);
-  }
+    geometry_pool_ = std::make_unique<GeometryPool>(
+      device_, memory_properties,
+      std::vector<vk::DeviceSize>{sizeof(Vertex), sizeof(glm::vec3)},
+      std::max(geometry_pool_vertex_capacity_, vertex_count),
+      std::max(geometry_pool_index_capacity_, index_count),
+      vertex_pulling_supported_
+        ? vk::BufferUsageFlags{vk::BufferUsageFlagBits::eShaderDeviceAddress}
+        : vk::BufferUsageFlags{});
 
-  auto CreateColorResources() -> void {
-    auto const color_format{swap_chain_image_format_};
+    auto const command_buffer{BeginSingleTimeCommands()};
 
-    CreateImage(swap_chain_extent_.width, swap_chain_extent_.height, 1,
-                msaa_samples_, color_format, vk::ImageTiling::eOptimal,
-                vk::ImageUsageFlagBits::eTransientAttachment |
-                vk::ImageUsageFlagBits::eColorAttachment,
-                vk::MemoryPropertyFlagBits::eDeviceLocal, color_image_,
-                color_image_memory_);
-    color_image_view_ = CreateImageView(color_image_, color_format,
-                                        vk::ImageAspectFlagBits::eColor, 1);
-  }
+    for (auto const& data : mesh_data) {
+      auto const handle{
+        geometry_pool_->AddMesh(data.vertex_count, data.index_count)
+      };
 
-  [[nodiscard]] auto FindDepthFormat() const -> vk::Format {
-    return FindSupportedFormat(
-      std::array{
-        vk::Format::eD32Sfloat, vk::Format::eD32SfloatS8Uint,
-        vk::Format::eD24UnormS8Uint
-      }, vk::ImageTiling::eOptimal,
-      vk::FormatFeatureFlagBits::eDepthStencilAttachment);
-  }
+      vertex_staging.RecordCopy(
+        command_buffer, data.first_vertex * sizeof(Vertex),
+        geometry_pool_->GetVertexBuffer(full_vertex_stream_),
+        geometry_pool_->GetVertexDataOffset(handle, full_vertex_stream_),
+        data.vertex_count * sizeof(Vertex));
+      position_staging.RecordCopy(
+        command_buffer, data.first_vertex * sizeof(glm::vec3),
+        geometry_pool_->GetVertexBuffer(position_stream_),
+        geometry_pool_->GetVertexDataOffset(handle, position_stream_),
+        data.vertex_count * sizeof(glm::vec3));
+      index_staging.RecordCopy(
+        command_buffer, data.first_index * sizeof(std::uint32_t),
+        geometry_pool_->GetIndexBuffer(),
+        geometry_pool_->GetIndexDataOffset(handle),
+        data.index_count * sizeof(std::uint32_t));
+
+      meshes_.emplace_back(Mesh{handle, data.bounds_min, data.bounds_max});
+    }
 
-  auto CreateDepthResources() -> void {
-    auto const depth_format{FindDepthFormat()};
-    CreateImage(swap_chain_extent_.width, swap_chain_extent_.height, 1,
-                msaa_samples_, depth_format, vk::ImageTiling::eOptimal,
-                vk::ImageUsageFlagBits::eDepthStencilAttachment,
-                vk::MemoryPropertyFlagBits::eDeviceLocal, depth_image_,
-                depth_image_memory_);
-    depth_image_view_ = CreateImageView(depth_image_, depth_format,
-                                        vk::ImageAspectFlagBits::eDepth, 1);
-  }
+    EndSingleTimeCommands(command_buffer);
 
-  auto CreateFramebuffers() -> void {
-    swap_chain_framebuffers_.clear();
-    swap_chain_framebuffers_.reserve(swap_chain_image_views_.size());
-    for (auto const& view : swap_chain_image_views_) {
-      std::array const attachments{color_image_view_, depth_image_view_, view};
-      swap_chain_framebuffers_.emplace_back(device_.createFramebuffer(
-        vk::FramebufferCreateInfo{
-          {}, render_pass_, attachments, swap_chain_extent_.width,
-          swap_chain_extent_.height, 1
-        }));
+    if (vertex_pulling_supported_) {
+      vertex_buffer_address_ = device_.getBufferAddress(
+        vk::BufferDeviceAddressInfo{
+          geometry_pool_->GetVertexBuffer(full_vertex_stream_)
+        });
     }
+
+    auto const [mesh_count, pool_vertex_count, vertex_capacity,
+      pool_index_count, index_capacity, vertex_free_range_count,
+      index_free_range_count]{geometry_pool_->GetStats()};
+
+    std::cout << "Geometry pool: " << mesh_count << " meshes, " <<
+      pool_vertex_count << " of " << vertex_capacity << " vertices and " <<
+      pool_index_count << " of " << index_capacity << " indices used, " <<
+      (vertex_staging.GetAllocatedSize() + position_staging.GetAllocatedSize()
+        + index_staging.GetAllocatedSize()) / 1024 <<
+      " KiB of staging memory released.\n";
   }
 
   [[nodiscard]] auto BeginSingleTimeCommands() const -> vk::CommandBuffer {
@@ -1265,38 +3510,20 @@ private:
                              std::uint32_t const mip_levels) const -> void {
     auto const command_buffer{BeginSingleTimeCommands()};
 
-    vk::AccessFlags src_access_mask;
-    vk::AccessFlags dst_access_mask;
-    vk::PipelineStageFlags src_stage_mask;
-    vk::PipelineStageFlags dst_stage_mask;
-
-    if (old_layout == vk::ImageLayout::eUndefined && new_layout ==
-      vk::ImageLayout::eTransferDstOptimal) {
-      src_access_mask = {};
-      dst_access_mask = vk::AccessFlagBits::eTransferWrite;
-      src_stage_mask = vk::PipelineStageFlagBits::eTopOfPipe;
-      dst_stage_mask = vk::PipelineStageFlagBits::eTransfer;
-    } else if (old_layout == vk::ImageLayout::eTransferDstOptimal && new_layout
-      == vk::ImageLayout::eShaderReadOnlyOptimal) {
-      src_access_mask = vk::AccessFlagBits::eTransferWrite;
-      dst_access_mask = vk::AccessFlagBits::eShaderRead;
-      src_stage_mask = vk::PipelineStageFlagBits::eTransfer;
-      dst_stage_mask = vk::PipelineStageFlagBits::eFragmentShader;
-    } else {
-      throw std::runtime_error{"Unsupported layout transition."};
-    }
-
-    command_buffer.pipelineBarrier(src_stage_mask, dst_stage_mask, {}, {}, {},
-                                   vk::ImageMemoryBarrier{
-                                     src_access_mask, dst_access_mask,
-                                     old_layout, new_layout,
-                                     vk::QueueFamilyIgnored,
-                                     vk::QueueFamilyIgnored, image,
-                                     {
-                                       vk::ImageAspectFlagBits::eColor, 0,
-                                       mip_levels, 0, 1
-                                     }
-                                   });
+    auto const [src_stages, src_access, src_layout]{
+      GetImageLayoutSyncState(old_layout)
+    };
+    auto const [dst_stages, dst_access, dst_layout]{
+      GetImageLayoutSyncState(new_layout)
+    };
+
+    vk::ImageMemoryBarrier2 const barrier{
+      src_stages, GetWriteAccess(src_access), dst_stages, dst_access,
+      old_layout, new_layout, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored,
+      image, {vk::ImageAspectFlagBits::eColor, 0, mip_levels, 0, 1}
+    };
+
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, {}, {}, barrier});
     EndSingleTimeCommands(command_buffer);
   }
 
@@ -1334,21 +3561,22 @@ private:
     auto mip_width{width};
     auto mip_height{height};
 
+    // Each level has to be complete before it is used as a blit source, but
+    // the transitions to the shader read layout are batched into one barrier
+    // at the end.
     for (std::uint32_t i{1}; i < mip_levels; i++) {
-      command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
-                                     vk::PipelineStageFlagBits::eTransfer, {},
-                                     {}, {}, vk::ImageMemoryBarrier{
-                                       vk::AccessFlagBits::eTransferWrite,
-                                       vk::AccessFlagBits::eTransferRead,
-                                       vk::ImageLayout::eTransferDstOptimal,
-                                       vk::ImageLayout::eTransferSrcOptimal,
-                                       vk::QueueFamilyIgnored,
-                                       vk::QueueFamilyIgnored, image,
-                                       {
-                                         vk::ImageAspectFlagBits::eColor, i - 1,
-                                         1, 0, 1
-                                       }
-                                     });
+      vk::ImageMemoryBarrier2 const src_level_barrier{
+        vk::PipelineStageFlagBits2::eBlit, vk::AccessFlagBits2::eTransferWrite,
+        vk::PipelineStageFlagBits2::eBlit, vk::AccessFlagBits2::eTransferRead,
+        vk::ImageLayout::eTransferDstOptimal,
+        vk::ImageLayout::eTransferSrcOptimal, vk::QueueFamilyIgnored,
+        vk::QueueFamilyIgnored, image,
+        {vk::ImageAspectFlagBits::eColor, i - 1, 1, 0, 1}
+      };
+
+      command_buffer.pipelineBarrier2(vk::DependencyInfo{
+        {}, {}, {}, src_level_barrier
+      });
 
       command_buffer.blitImage(image, vk::ImageLayout::eTransferSrcOptimal,
                                image, vk::ImageLayout::eTransferDstOptimal,
@@ -1371,21 +3599,6 @@ private:
                                  }
                                }, vk::Filter::eLinear);
 
-      command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
-                                     vk::PipelineStageFlagBits::eFragmentShader,
-                                     {}, {}, {}, vk::ImageMemoryBarrier{
-                                       vk::AccessFlagBits::eTransferRead,
-                                       vk::AccessFlagBits::eShaderRead,
-                                       vk::ImageLayout::eTransferSrcOptimal,
-                                       vk::ImageLayout::eShaderReadOnlyOptimal,
-                                       vk::QueueFamilyIgnored,
-                                       vk::QueueFamilyIgnored, image,
-                                       {
-                                         vk::ImageAspectFlagBits::eColor, i - 1,
-                                         1, 0, 1
-                                       }
-                                     });
-
       if (mip_width > 1) {
         mip_width /= 2;
       }
@@ -1395,20 +3608,36 @@ private:
       }
     }
 
-    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
-                                   vk::PipelineStageFlagBits::eFragmentShader,
-                                   {}, {}, {}, vk::ImageMemoryBarrier{
-                                     vk::AccessFlagBits::eTransferWrite,
-                                     vk::AccessFlagBits::eShaderRead,
-                                     vk::ImageLayout::eTransferDstOptimal,
-                                     vk::ImageLayout::eShaderReadOnlyOptimal,
-                                     vk::QueueFamilyIgnored,
-                                     vk::QueueFamilyIgnored, image,
-                                     {
-                                       vk::ImageAspectFlagBits::eColor,
-                                       mip_levels - 1, 1, 0, 1
-                                     }
-                                   });
+    std::array const shader_read_barriers{
+      vk::ImageMemoryBarrier2{
+        vk::PipelineStageFlagBits2::eBlit, vk::AccessFlagBits2::eNone,
+        vk::PipelineStageFlagBits2::eFragmentShader,
+        vk::AccessFlagBits2::eShaderSampledRead,
+        vk::ImageLayout::eTransferSrcOptimal,
+        vk::ImageLayout::eShaderReadOnlyOptimal, vk::QueueFamilyIgnored,
+        vk::QueueFamilyIgnored, image,
+        {vk::ImageAspectFlagBits::eColor, 0, mip_levels - 1, 0, 1}
+      },
+      vk::ImageMemoryBarrier2{
+        vk::PipelineStageFlagBits2::eBlit, vk::AccessFlagBits2::eTransferWrite,
+        vk::PipelineStageFlagBits2::eFragmentShader,
+        vk::AccessFlagBits2::eShaderSampledRead,
+        vk::ImageLayout::eTransferDstOptimal,
+        vk::ImageLayout::eShaderReadOnlyOptimal, vk::QueueFamilyIgnored,
+        vk::QueueFamilyIgnored, image,
+        {vk::ImageAspectFlagBits::eColor, mip_levels - 1, 1, 0, 1}
+      }
+    };
+
+    // A single level texture has nothing in the transfer source layout.
+    auto const first_barrier_idx{mip_levels > 1 ? 0u : 1u};
+
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{
+      {}, 0, nullptr, 0, nullptr,
+      static_cast<std::uint32_t>(shader_read_barriers.size()) -
+      first_barrier_idx,
+      shader_read_barriers.data() + first_barrier_idx
+    });
 
     EndSingleTimeCommands(command_buffer);
   }
@@ -1436,8 +3665,18 @@ private:
       {}, size, usage, vk::SharingMode::eExclusive
     });
     auto const mem_req{device_.getBufferMemoryRequirements(buffer)};
+
+    // Buffers used through their device address need memory allocated with
+    // the matching flag
+    vk::MemoryAllocateFlagsInfo const memory_allocate_flags_info{
+      usage & vk::BufferUsageFlagBits::eShaderDeviceAddress
+        ? vk::MemoryAllocateFlagBits::eDeviceAddress
+        : vk::MemoryAllocateFlags{}
+    };
+
     buffer_memory = device_.allocateMemory(vk::MemoryAllocateInfo{
-      mem_req.size, FindMemoryType(mem_req.memoryTypeBits, memory_properties)
+      mem_req.size, FindMemoryType(mem_req.memoryTypeBits, memory_properties),
+      &memory_allocate_flags_info
     });
     device_.bindBufferMemory(buffer, buffer_memory, 0);
   }
@@ -1468,6 +3707,49 @@ private:
       return 0;
     }
 
+    if (msg == WM_KEYDOWN) {
+      if (auto const app{
+        std::bit_cast<Application*>(GetWindowLongPtrW(hwnd, GWLP_USERDATA))
+      }) {
+        app->frame_invalidated_ = true;
+
+        switch (wparam) {
+        case '1':
+          app->requested_anti_aliasing_ = AntiAliasing::kMsaa;
+          return 0;
+        case '2':
+          app->requested_anti_aliasing_ = AntiAliasing::kFxaa;
+          return 0;
+        case '3':
+          app->requested_anti_aliasing_ = AntiAliasing::kFxaaSharpen;
+          return 0;
+        case 'D':
+          app->dynamic_resolution_toggle_requested_ = true;
+          return 0;
+        case 'R':
+          app->prerecord_toggle_requested_ = true;
+          return 0;
+        case 'Z':
+          app->depth_prepass_toggle_requested_ = true;
+          return 0;
+        case 'V':
+          app->vertex_pulling_toggle_requested_ = true;
+          return 0;
+        case 'M':
+          app->multiview_toggle_requested_ = true;
+          return 0;
+        case 'O':
+          app->on_demand_toggle_requested_ = true;
+          return 0;
+        case 'P':
+          app->pause_toggle_requested_ = true;
+          return 0;
+        default:
+          break;
+        }
+      }
+    }
+
     if (msg == WM_SIZE) {
       if (auto const app{
         std::bit_cast<Application*>(GetWindowLongPtrW(hwnd, GWLP_USERDATA))
@@ -1477,6 +3759,16 @@ private:
       }
     }
 
+    // The contents are drawn again by the next frame, painting is left to the
+    // default handler so the window gets validated
+    if (msg == WM_PAINT) {
+      if (auto const app{
+        std::bit_cast<Application*>(GetWindowLongPtrW(hwnd, GWLP_USERDATA))
+      }) {
+        app->frame_invalidated_ = true;
+      }
+    }
+
     return DefWindowProcW(hwnd, msg, wparam, lparam);
   }
 
@@ -1487,8 +3779,27 @@ private:
   }
 
   static auto constexpr max_frames_in_flight_{2};
+  static std::uint32_t constexpr max_post_process_passes_{3};
+  static auto constexpr sharpness_{0.5f};
+  static auto constexpr min_render_scale_{0.5f};
+  // Fraction of the target frame time below which the scale is raised again
+  static auto constexpr render_scale_headroom_{0.9};
+  static auto constexpr render_scale_increase_rate_{0.05f};
+  // Vertex streams of the geometry pool
+  static std::size_t constexpr full_vertex_stream_{0};
+  static std::size_t constexpr position_stream_{1};
+  static std::uint32_t constexpr geometry_pool_vertex_capacity_{1 << 20};
+  static std::uint32_t constexpr geometry_pool_index_capacity_{1 << 22};
+  static vk::DeviceSize constexpr staging_chunk_size_{16 << 20};
   static std::string_view constexpr model_path_{"models/viking_room.obj"};
   static std::string_view constexpr texture_path_{"textures/viking_room.png"};
+  // Depth range of the main view, the light clusters are sliced within it
+  static auto constexpr z_near_{0.1f};
+  static auto constexpr z_far_{10.0f};
+#ifdef TEXTURE_UPLOAD_BENCHMARK
+  static std::uint32_t constexpr texture_upload_benchmark_size_{8192};
+  static auto constexpr texture_upload_benchmark_iterations_{4};
+#endif
 
   std::unique_ptr<std::remove_pointer_t<HWND>, decltype([](HWND const hwnd) {
     if (hwnd) { DestroyWindow(hwnd); }
@@ -1513,47 +3824,132 @@ private:
   vk::Format swap_chain_image_format_;
   vk::Extent2D swap_chain_extent_;
 
-  vk::RenderPass render_pass_;
   vk::DescriptorSetLayout descriptor_set_layout_;
   vk::PipelineLayout pipeline_layout_;
-  vk::Pipeline pipeline_;
-
-  std::vector<vk::Framebuffer> swap_chain_framebuffers_;
+  vk::PipelineCache pipeline_cache_;
+  std::map<ScenePipelineKey, vk::Pipeline> scene_pipelines_;
+  // Features of the loaded material the scene shaders are specialized for
+  SceneShaderVariant material_variant_;
 
   vk::CommandPool command_pool_;
 
-  vk::Image color_image_;
-  vk::DeviceMemory color_image_memory_;
-  vk::ImageView color_image_view_;
-
-  vk::Image depth_image_;
-  vk::DeviceMemory depth_image_memory_;
-  vk::ImageView depth_image_view_;
+  std::unique_ptr<RenderGraph> render_graph_;
+  RenderGraph::ResourceHandle swap_chain_resource_{};
+  std::optional<RenderGraph::ResourceHandle> color_resource_;
+  RenderGraph::ResourceHandle depth_resource_{};
+
+  vk::DescriptorSetLayout post_process_descriptor_set_layout_;
+  vk::PipelineLayout post_process_pipeline_layout_;
+  vk::DescriptorPool post_process_descriptor_pool_;
+  vk::Sampler post_process_sampler_;
+  vk::Pipeline tonemap_pipeline_;
+  vk::Pipeline fxaa_pipeline_;
+  vk::Pipeline sharpen_pipeline_;
+  std::vector<PostProcessPass> post_process_passes_;
+  bool post_processing_supported_{false};
+  bool swap_chain_blit_supported_{false};
+  std::optional<RenderGraph::ResourceHandle> scene_output_resource_;
+
+  vk::QueryPool timestamp_query_pool_;
+  bool timestamps_supported_{false};
+  float timestamp_period_{};
+  std::array<bool, max_frames_in_flight_> timestamps_written_{};
+  double gpu_frame_time_ms_{};
+
+  bool dynamic_resolution_{true};
+  bool dynamic_resolution_toggle_requested_{false};
+  float render_scale_{1.0f};
 
   std::uint32_t mip_levels_{};
   vk::Image texture_image_;
   vk::DeviceMemory texture_image_memory_;
   vk::ImageView texture_image_view_;
   vk::Sampler texture_sampler_;
+  // Layout the texture is sampled in
+  vk::ImageLayout texture_image_layout_{
+    vk::ImageLayout::eShaderReadOnlyOptimal
+  };
+  bool host_image_copy_supported_{false};
 
-  std::vector<Vertex> vertices_;
-  std::vector<std::uint32_t> indices_;
+  std::unique_ptr<GeometryPool> geometry_pool_;
 
-  vk::Buffer vertex_buffer_;
-  vk::DeviceMemory vertex_buffer_memory_;
+  struct Mesh {
+    GeometryPool::MeshHandle handle;
+    // Object space bounding box
+    glm::vec3 bounds_min;
+    glm::vec3 bounds_max;
+  };
 
-  vk::Buffer index_buffer_;
-  vk::DeviceMemory index_buffer_memory_;
+  std::vector<Mesh> meshes_;
+  vk::DeviceAddress vertex_buffer_address_{};
 
   std::vector<vk::Buffer> uniform_buffers_;
   std::vector<vk::DeviceMemory> uniform_buffer_memories_;
   std::vector<void*> uniform_buffers_mapped_;
 
+  std::vector<LightOrbit> light_orbits_{GenerateLightOrbits()};
+  std::vector<vk::Buffer> light_buffers_;
+  std::vector<vk::DeviceMemory> light_buffer_memories_;
+  std::vector<PointLight*> light_buffers_mapped_;
+  std::vector<vk::Buffer> cluster_buffers_;
+  std::vector<vk::DeviceMemory> cluster_buffer_memories_;
+  vk::PipelineLayout light_culling_pipeline_layout_;
+  vk::Pipeline light_culling_pipeline_;
+
   vk::DescriptorPool descriptor_pool_;
   std::vector<vk::DescriptorSet> descriptor_sets_;
 
   std::vector<vk::CommandBuffer> command_buffers_;
 
+  struct PrerecordedCommandBuffer {
+    vk::CommandBuffer command_buffer;
+    // Empty if the command buffer has to be recorded again
+    std::optional<vk::Extent2D> recorded_extent;
+  };
+
+  // Indexed by swap chain image index * max_frames_in_flight_ + frame slot
+  std::vector<PrerecordedCommandBuffer> prerecorded_command_buffers_;
+  bool prerecord_command_buffers_{false};
+  bool prerecord_toggle_requested_{false};
+
+  bool depth_prepass_{false};
+  bool depth_prepass_toggle_requested_{false};
+
+  bool vertex_pulling_supported_{false};
+  bool vertex_pulling_{false};
+  bool vertex_pulling_toggle_requested_{false};
+
+  static std::uint32_t constexpr multiview_view_count_{MULTIVIEW_VIEW_COUNT};
+  static bool constexpr multiview_cube_faces_{multiview_view_count_ == 6};
+  // Distance between neighboring eyes in world units
+  static float constexpr multiview_eye_separation_{0.2f};
+  bool multiview_{false};
+  bool multiview_toggle_requested_{false};
+
+  struct FrameStageStats {
+    double simulation_seconds;
+    double wait_seconds;
+    double record_seconds;
+    double submit_seconds;
+    std::uint32_t rerecord_count;
+  };
+
+  FrameStageStats stage_window_{};
+
+  // Animation time only advances while the animation is not paused
+  std::chrono::high_resolution_clock::time_point last_update_time_;
+  float animation_time_{0};
+  std::atomic<bool> animation_paused_{false};
+  bool pause_toggle_requested_{false};
+
+  TripleBuffer<SceneSnapshot> scene_snapshots_;
+  // Frame index of the snapshot last taken by the render thread
+  std::atomic<std::uint64_t> consumed_snapshot_{0};
+
+#ifndef NO_SIMULATION_THREAD
+  std::jthread simulation_thread_;
+#endif
+
   std::vector<vk::Semaphore> image_available_semaphores_;
   std::vector<vk::Semaphore> render_finished_semaphores_;
   std::vector<vk::Fence> in_flight_fences_;
@@ -1562,6 +3958,74 @@ private:
   bool framebuffer_resized_{false};
 
   vk::SampleCountFlagBits msaa_samples_{vk::SampleCountFlagBits::e1};
+  vk::SampleCountFlagBits max_msaa_samples_{vk::SampleCountFlagBits::e1};
+
+  AntiAliasing anti_aliasing_{AntiAliasing::kMsaa};
+  std::optional<AntiAliasing> requested_anti_aliasing_;
+
+  struct FrameTimeStats {
+    double total_seconds;
+    std::uint32_t frame_count;
+  };
+
+  std::array<FrameTimeStats, 3> frame_time_stats_{};
+  FrameTimeStats frame_time_window_{};
+  std::optional<std::chrono::high_resolution_clock::time_point>
+  last_frame_time_;
+
+  struct OnDemandStats {
+    std::uint32_t active_frame_count;
+    std::uint32_t idle_frame_count;
+    // Frames drawn right after waking up from an idle wait and the time from
+    // waking up to presenting them
+    std::uint32_t wakeup_count;
+    double total_wakeup_latency_seconds;
+    double max_wakeup_latency_seconds;
+  };
+
+  static auto MergeOnDemandStats(OnDemandStats& dst,
+                                 OnDemandStats const& src) -> void {
+    dst.active_frame_count += src.active_frame_count;
+    dst.idle_frame_count += src.idle_frame_count;
+    dst.wakeup_count += src.wakeup_count;
+    dst.total_wakeup_latency_seconds += src.total_wakeup_latency_seconds;
+    dst.max_wakeup_latency_seconds = std::max(dst.max_wakeup_latency_seconds,
+                                              src.max_wakeup_latency_seconds);
+  }
+
+  static auto PrintOnDemandStats(OnDemandStats const& stats) -> void {
+    std::cout << stats.active_frame_count << " frames drawn, " << stats.
+      idle_frame_count << " idle frames, wakeup latency " << (stats.wakeup_count
+        ? stats.total_wakeup_latency_seconds * 1000.0 / stats.wakeup_count
+        : 0.0) << " ms avg, " << stats.max_wakeup_latency_seconds * 1000.0 <<
+      " ms max";
+  }
+
+  static DWORD constexpr on_demand_idle_timeout_ms_{250};
+  bool on_demand_rendering_{false};
+  bool on_demand_toggle_requested_{false};
+  // Set by everything that changes the frame without changing the scene
+  // snapshot, like input, resizing and settings changes
+  bool frame_invalidated_{true};
+  float drawn_scene_time_{0};
+  glm::mat4 drawn_view_{1};
+  OnDemandStats on_demand_window_{};
+  OnDemandStats on_demand_totals_{};
+  std::chrono::high_resolution_clock::time_point on_demand_window_start_;
+  // When the loop last woke up from an idle wait
+  std::optional<std::chrono::high_resolution_clock::time_point> wakeup_time_;
+
+#if defined(MSAA_SAMPLE_COUNT)
+  SampleCountPolicy sample_count_policy_{
+    static_cast<vk::SampleCountFlagBits>(MSAA_SAMPLE_COUNT), true
+  };
+#elif defined(MSAA_MAX_SAMPLE_COUNT)
+  SampleCountPolicy sample_count_policy_{
+    static_cast<vk::SampleCountFlagBits>(MSAA_MAX_SAMPLE_COUNT), false
+  };
+#else
+  SampleCountPolicy sample_count_policy_{vk::SampleCountFlagBits::e64, false};
+#endif
 };
 
 auto main() -> int {
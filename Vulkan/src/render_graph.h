@@ -0,0 +1,733 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The ways a pass can access an image. Each one maps to a fixed synchronization
+// scope and layout, the graph derives every barrier from these.
+enum class ResourceUsage : std::uint8_t {
+  kColorAttachment,
+  kDepthStencilAttachment,
+  kDepthStencilReadOnly,
+  kFragmentShaderSampled,
+  kComputeShaderSampled,
+  kComputeShaderStorage,
+  kTransferSrc,
+  kTransferDst,
+  kPresent,
+};
+
+struct ImageSyncState {
+  vk::PipelineStageFlags2 stages;
+  vk::AccessFlags2 access;
+  vk::ImageLayout layout{vk::ImageLayout::eUndefined};
+};
+
+struct ResourceUsageInfo {
+  ImageSyncState state;
+  vk::ImageUsageFlags image_usage;
+  bool reads;
+  bool writes;
+};
+
+[[nodiscard]] inline auto GetResourceUsageInfo(
+  ResourceUsage const usage) -> ResourceUsageInfo {
+  switch (usage) {
+  case ResourceUsage::kColorAttachment:
+    return ResourceUsageInfo{
+      {
+        vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+        vk::AccessFlagBits2::eColorAttachmentRead |
+        vk::AccessFlagBits2::eColorAttachmentWrite,
+        vk::ImageLayout::eColorAttachmentOptimal
+      },
+      vk::ImageUsageFlagBits::eColorAttachment, false, true
+    };
+  case ResourceUsage::kDepthStencilAttachment:
+    return ResourceUsageInfo{
+      {
+        vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+        vk::PipelineStageFlagBits2::eLateFragmentTests,
+        vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+        vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+        vk::ImageLayout::eDepthStencilAttachmentOptimal
+      },
+      vk::ImageUsageFlagBits::eDepthStencilAttachment, false, true
+    };
+  case ResourceUsage::kDepthStencilReadOnly:
+    return ResourceUsageInfo{
+      {
+        vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+        vk::PipelineStageFlagBits2::eLateFragmentTests,
+        vk::AccessFlagBits2::eDepthStencilAttachmentRead,
+        vk::ImageLayout::eDepthStencilReadOnlyOptimal
+      },
+      vk::ImageUsageFlagBits::eDepthStencilAttachment, true, false
+    };
+  case ResourceUsage::kFragmentShaderSampled:
+    return ResourceUsageInfo{
+      {
+        vk::PipelineStageFlagBits2::eFragmentShader,
+        vk::AccessFlagBits2::eShaderSampledRead,
+        vk::ImageLayout::eShaderReadOnlyOptimal
+      },
+      vk::ImageUsageFlagBits::eSampled, true, false
+    };
+  case ResourceUsage::kComputeShaderSampled:
+    return ResourceUsageInfo{
+      {
+        vk::PipelineStageFlagBits2::eComputeShader,
+        vk::AccessFlagBits2::eShaderSampledRead,
+        vk::ImageLayout::eShaderReadOnlyOptimal
+      },
+      vk::ImageUsageFlagBits::eSampled, true, false
+    };
+  case ResourceUsage::kComputeShaderStorage:
+    return ResourceUsageInfo{
+      {
+        vk::PipelineStageFlagBits2::eComputeShader,
+        vk::AccessFlagBits2::eShaderStorageRead |
+        vk::AccessFlagBits2::eShaderStorageWrite,
+        vk::ImageLayout::eGeneral
+      },
+      vk::ImageUsageFlagBits::eStorage, false, true
+    };
+  case ResourceUsage::kTransferSrc:
+    return ResourceUsageInfo{
+      {
+        vk::PipelineStageFlagBits2::eTransfer,
+        vk::AccessFlagBits2::eTransferRead,
+        vk::ImageLayout::eTransferSrcOptimal
+      },
+      vk::ImageUsageFlagBits::eTransferSrc, true, false
+    };
+  case ResourceUsage::kTransferDst:
+    return ResourceUsageInfo{
+      {
+        vk::PipelineStageFlagBits2::eTransfer,
+        vk::AccessFlagBits2::eTransferWrite,
+        vk::ImageLayout::eTransferDstOptimal
+      },
+      vk::ImageUsageFlagBits::eTransferDst, false, true
+    };
+  case ResourceUsage::kPresent:
+    return ResourceUsageInfo{
+      {{}, {}, vk::ImageLayout::ePresentSrcKHR}, {}, true, false
+    };
+  }
+
+  throw std::runtime_error{"Unknown resource usage."};
+}
+
+// Synchronization scope of the accesses an image in the given layout is
+// expected to see. Used for one-off transitions outside the graph.
+[[nodiscard]] inline auto GetImageLayoutSyncState(
+  vk::ImageLayout const layout) -> ImageSyncState {
+  switch (layout) {
+  case vk::ImageLayout::eUndefined:
+  case vk::ImageLayout::ePresentSrcKHR:
+    return ImageSyncState{{}, {}, layout};
+  case vk::ImageLayout::ePreinitialized:
+    return ImageSyncState{
+      vk::PipelineStageFlagBits2::eHost, vk::AccessFlagBits2::eHostWrite,
+      layout
+    };
+  case vk::ImageLayout::eGeneral:
+    return ImageSyncState{
+      vk::PipelineStageFlagBits2::eAllCommands,
+      vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite,
+      layout
+    };
+  case vk::ImageLayout::eTransferSrcOptimal:
+    return GetResourceUsageInfo(ResourceUsage::kTransferSrc).state;
+  case vk::ImageLayout::eTransferDstOptimal:
+    return GetResourceUsageInfo(ResourceUsage::kTransferDst).state;
+  case vk::ImageLayout::eColorAttachmentOptimal:
+    return GetResourceUsageInfo(ResourceUsage::kColorAttachment).state;
+  case vk::ImageLayout::eDepthStencilAttachmentOptimal:
+    return GetResourceUsageInfo(ResourceUsage::kDepthStencilAttachment).state;
+  case vk::ImageLayout::eDepthStencilReadOnlyOptimal:
+    return GetResourceUsageInfo(ResourceUsage::kDepthStencilReadOnly).state;
+  case vk::ImageLayout::eShaderReadOnlyOptimal:
+    return ImageSyncState{
+      vk::PipelineStageFlagBits2::eFragmentShader |
+      vk::PipelineStageFlagBits2::eComputeShader,
+      vk::AccessFlagBits2::eShaderSampledRead, layout
+    };
+  default:
+    throw std::runtime_error{"Unsupported image layout."};
+  }
+}
+
+[[nodiscard]] inline auto GetWriteAccess(
+  vk::AccessFlags2 const access) -> vk::AccessFlags2 {
+  return access & (vk::AccessFlagBits2::eShaderWrite |
+    vk::AccessFlagBits2::eShaderStorageWrite |
+    vk::AccessFlagBits2::eColorAttachmentWrite |
+    vk::AccessFlagBits2::eDepthStencilAttachmentWrite |
+    vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eHostWrite |
+    vk::AccessFlagBits2::eMemoryWrite);
+}
+
+[[nodiscard]] inline auto HasStencilComponent(vk::Format const format) -> bool {
+  return format == vk::Format::eD32SfloatS8Uint || format ==
+    vk::Format::eD24UnormS8Uint || format == vk::Format::eD16UnormS8Uint ||
+    format == vk::Format::eS8Uint;
+}
+
+// Frame graph of passes that declare the images they read and write. Compile
+// culls passes that contribute nothing to an imported output, computes the
+// barriers each pass needs and places transient images with disjoint lifetimes
+// into shared memory. Images only ever used as attachments are created as
+// transient attachments and, where the device offers it, backed by lazily
+// allocated memory that may never leave tile memory. Execute replays the result
+// into a command buffer.
+class RenderGraph {
+public:
+  using ResourceHandle = std::uint32_t;
+  using RecordCallback = std::function<void(
+    vk::CommandBuffer, RenderGraph const&)>;
+
+  struct ImageDesc {
+    vk::Format format{vk::Format::eUndefined};
+    vk::Extent2D extent;
+    vk::SampleCountFlagBits samples{vk::SampleCountFlagBits::e1};
+    vk::ImageAspectFlags aspect{vk::ImageAspectFlagBits::eColor};
+    vk::ImageUsageFlags extra_usage;
+    // More than one layer makes the image an array, e.g. for multiview
+    std::uint32_t layers{1};
+  };
+
+  struct ResourceUse {
+    ResourceHandle resource;
+    ResourceUsage usage;
+  };
+
+  struct MemoryStats {
+    vk::DeviceSize unaliased_size;
+    vk::DeviceSize allocated_size;
+    // Part of allocated_size in lazily allocated memory, and how much of that
+    // the implementation actually had to commit.
+    vk::DeviceSize lazily_allocated_size;
+    vk::DeviceSize lazily_committed_size;
+    std::size_t transient_image_count;
+    std::size_t memory_block_count;
+    std::size_t culled_pass_count;
+  };
+
+  RenderGraph(vk::Device const device,
+              vk::PhysicalDeviceMemoryProperties const& memory_properties) :
+    device_{device}, memory_properties_{memory_properties} {}
+
+  RenderGraph(RenderGraph const& other) = delete;
+  RenderGraph(RenderGraph&& other) = delete;
+
+  ~RenderGraph() {
+    for (auto const& resource : resources_) {
+      if (!resource.imported) {
+        device_.destroyImageView(resource.view);
+        device_.destroyImage(resource.image);
+      }
+    }
+
+    for (auto const& block : memory_blocks_) {
+      device_.freeMemory(block.memory);
+    }
+  }
+
+  auto operator=(RenderGraph const& other) -> void = delete;
+  auto operator=(RenderGraph&& other) -> void = delete;
+
+  // Images owned outside of the graph, e.g. swap chain images. The graph
+  // expects them in initial_state at the start of the frame and leaves them
+  // ready for final_usage at the end. Imported images are the graph outputs.
+  [[nodiscard]] auto ImportImage(ImageDesc const& desc,
+                                 ImageSyncState const& initial_state,
+                                 ResourceUsage const final_usage) ->
+    ResourceHandle {
+    auto& resource{resources_.emplace_back()};
+    resource.desc = desc;
+    resource.imported = true;
+    resource.initial_state = initial_state;
+    resource.final_usage = final_usage;
+    return static_cast<ResourceHandle>(resources_.size() - 1);
+  }
+
+  // Images whose contents only live within a frame. The graph creates them
+  // during Compile and may alias their memory.
+  [[nodiscard]] auto CreateImage(ImageDesc const& desc) -> ResourceHandle {
+    auto& resource{resources_.emplace_back()};
+    resource.desc = desc;
+    return static_cast<ResourceHandle>(resources_.size() - 1);
+  }
+
+  auto SetImportedImage(ResourceHandle const handle, vk::Image const image,
+                        vk::ImageView const view) -> void {
+    resources_[handle].image = image;
+    resources_[handle].view = view;
+  }
+
+  auto AddPass(std::string name, std::vector<ResourceUse> uses,
+               RecordCallback record) -> void {
+    passes_.emplace_back(Pass{std::move(name), std::move(uses),
+                              std::move(record)});
+  }
+
+  auto Compile() -> void {
+    CullPasses();
+    CalculateLifetimes();
+    CreateTransientImages();
+    AliasTransientMemory();
+    CalculateBarriers();
+  }
+
+  auto Execute(vk::CommandBuffer const command_buffer) const -> void {
+    std::vector<vk::ImageMemoryBarrier2> image_barriers;
+
+    for (auto const& pass : passes_) {
+      if (pass.culled) {
+        continue;
+      }
+
+      RecordBarriers(command_buffer, pass.barriers, image_barriers);
+      pass.record(command_buffer, *this);
+    }
+
+    RecordBarriers(command_buffer, final_barriers_, image_barriers);
+  }
+
+  [[nodiscard]] auto GetImage(ResourceHandle const handle) const -> vk::Image {
+    return resources_[handle].image;
+  }
+
+  [[nodiscard]] auto GetImageView(
+    ResourceHandle const handle) const -> vk::ImageView {
+    return resources_[handle].view;
+  }
+
+  [[nodiscard]] auto GetImageDesc(
+    ResourceHandle const handle) const -> ImageDesc const& {
+    return resources_[handle].desc;
+  }
+
+  // The committed size of lazily allocated memory is queried on every call, as
+  // it only becomes meaningful once the graph has been executed.
+  [[nodiscard]] auto GetMemoryStats() const -> MemoryStats {
+    auto stats{memory_stats_};
+    stats.lazily_committed_size = 0;
+
+    for (auto const& block : memory_blocks_) {
+      if (block.lazy) {
+        stats.lazily_committed_size += device_.getMemoryCommitment(
+          block.memory);
+      }
+    }
+
+    return stats;
+  }
+
+private:
+  struct Barrier {
+    ResourceHandle resource;
+    ImageSyncState src;
+    ImageSyncState dst;
+  };
+
+  struct Pass {
+    std::string name;
+    std::vector<ResourceUse> uses;
+    RecordCallback record;
+    bool culled{false};
+    std::vector<Barrier> barriers;
+  };
+
+  struct Resource {
+    ImageDesc desc;
+    bool imported{false};
+    ImageSyncState initial_state;
+    std::optional<ResourceUsage> final_usage;
+    vk::Image image;
+    vk::ImageView view;
+    vk::MemoryRequirements memory_requirements;
+    std::optional<std::size_t> first_pass;
+    std::size_t last_pass{0};
+    std::optional<std::size_t> memory_block;
+  };
+
+  struct MemoryBlock {
+    vk::DeviceMemory memory;
+    vk::DeviceSize size;
+    vk::DeviceSize alignment;
+    std::uint32_t memory_type_bits;
+    bool lazy;
+    // Occupants in the order they are used within the frame.
+    std::vector<ResourceHandle> resources;
+  };
+
+  auto CullPasses() -> void {
+    std::vector<bool> needed(resources_.size(), false);
+
+    for (std::size_t i{0}; i < resources_.size(); i++) {
+      needed[i] = resources_[i].final_usage.has_value();
+    }
+
+    memory_stats_.culled_pass_count = 0;
+
+    for (auto it{passes_.rbegin()}; it != passes_.rend(); ++it) {
+      it->culled = std::ranges::none_of(it->uses, [&needed](auto const& use) {
+        return GetResourceUsageInfo(use.usage).writes && needed[use.resource];
+      });
+
+      if (it->culled) {
+        ++memory_stats_.culled_pass_count;
+        continue;
+      }
+
+      for (auto const& [resource, usage] : it->uses) {
+        if (GetResourceUsageInfo(usage).reads) {
+          needed[resource] = true;
+        }
+      }
+    }
+  }
+
+  auto CalculateLifetimes() -> void {
+    for (std::size_t i{0}; i < passes_.size(); i++) {
+      if (passes_[i].culled) {
+        continue;
+      }
+
+      for (auto const& [handle, usage] : passes_[i].uses) {
+        auto& resource{resources_[handle]};
+
+        if (!resource.first_pass) {
+          resource.first_pass = i;
+        }
+
+        resource.last_pass = i;
+        resource.desc.extra_usage |= GetResourceUsageInfo(usage).image_usage;
+      }
+    }
+  }
+
+  auto CreateTransientImages() -> void {
+    for (auto& resource : resources_) {
+      if (resource.imported || !resource.first_pass) {
+        continue;
+      }
+
+      if (!(resource.desc.extra_usage & ~(
+        vk::ImageUsageFlagBits::eColorAttachment |
+        vk::ImageUsageFlagBits::eDepthStencilAttachment |
+        vk::ImageUsageFlagBits::eInputAttachment |
+        vk::ImageUsageFlagBits::eTransientAttachment))) {
+        resource.desc.extra_usage |= vk::ImageUsageFlagBits::eTransientAttachment;
+      }
+
+      resource.image = device_.createImage(vk::ImageCreateInfo{
+        {}, vk::ImageType::e2D, resource.desc.format,
+        vk::Extent3D{resource.desc.extent, 1}, 1, resource.desc.layers,
+        resource.desc.samples,
+        vk::ImageTiling::eOptimal, resource.desc.extra_usage,
+        vk::SharingMode::eExclusive
+      });
+      resource.memory_requirements = device_.getImageMemoryRequirements(
+        resource.image);
+    }
+  }
+
+  // Greedy first-fit of the largest images first into blocks whose occupants
+  // are never alive during the same pass.
+  auto AliasTransientMemory() -> void {
+    std::vector<ResourceHandle> transients;
+
+    for (ResourceHandle i{0}; i < resources_.size(); i++) {
+      if (!resources_[i].imported && resources_[i].first_pass) {
+        transients.emplace_back(i);
+      }
+    }
+
+    std::ranges::sort(transients, [this](auto const lhs, auto const rhs) {
+      return resources_[lhs].memory_requirements.size > resources_[rhs].
+             memory_requirements.size;
+    });
+
+    memory_stats_.unaliased_size = 0;
+    memory_stats_.transient_image_count = transients.size();
+
+    for (auto const handle : transients) {
+      auto& resource{resources_[handle]};
+      auto const& mem_req{resource.memory_requirements};
+      memory_stats_.unaliased_size += mem_req.size;
+
+      auto const lazy{
+        (resource.desc.extra_usage &
+          vk::ImageUsageFlagBits::eTransientAttachment) && FindMemoryTypeIndex(
+          mem_req.memoryTypeBits, lazy_memory_properties_).has_value()
+      };
+
+      for (std::size_t i{0}; i < memory_blocks_.size(); i++) {
+        auto& block{memory_blocks_[i]};
+
+        // The shared memory types must still include one with the properties
+        // the block is allocated with, overlapping bits alone are not enough
+        if (auto const shared_type_bits{
+            block.memory_type_bits & mem_req.memoryTypeBits
+          }; block.lazy != lazy || !FindMemoryTypeIndex(
+            shared_type_bits,
+            block.lazy
+              ? lazy_memory_properties_
+              : vk::MemoryPropertyFlagBits::eDeviceLocal).has_value()) {
+          continue;
+        }
+
+        if (std::ranges::any_of(block.resources, [this, &resource](
+                                auto const other) {
+                                  return LifetimesOverlap(
+                                    resource, resources_[other]);
+                                })) {
+          continue;
+        }
+
+        block.size = std::max(block.size, mem_req.size);
+        block.alignment = std::max(block.alignment, mem_req.alignment);
+        block.memory_type_bits &= mem_req.memoryTypeBits;
+        block.resources.emplace_back(handle);
+        resource.memory_block = i;
+        break;
+      }
+
+      if (!resource.memory_block) {
+        resource.memory_block = memory_blocks_.size();
+        memory_blocks_.emplace_back(MemoryBlock{
+          {}, mem_req.size, mem_req.alignment, mem_req.memoryTypeBits, lazy,
+          {handle}
+        });
+      }
+    }
+
+    memory_stats_.allocated_size = 0;
+    memory_stats_.lazily_allocated_size = 0;
+    memory_stats_.memory_block_count = memory_blocks_.size();
+
+    for (auto& block : memory_blocks_) {
+      std::ranges::sort(block.resources, [this](auto const lhs, auto const rhs) {
+        return *resources_[lhs].first_pass < *resources_[rhs].first_pass;
+      });
+
+      block.memory = device_.allocateMemory(vk::MemoryAllocateInfo{
+        block.size,
+        FindMemoryType(block.memory_type_bits,
+                       block.lazy
+                         ? lazy_memory_properties_
+                         : vk::MemoryPropertyFlagBits::eDeviceLocal)
+      });
+      memory_stats_.allocated_size += block.size;
+
+      if (block.lazy) {
+        memory_stats_.lazily_allocated_size += block.size;
+      }
+
+      for (auto const handle : block.resources) {
+        auto& resource{resources_[handle]};
+        device_.bindImageMemory(resource.image, block.memory, 0);
+        resource.view = device_.createImageView(vk::ImageViewCreateInfo{
+          {}, resource.image,
+          resource.desc.layers > 1
+            ? vk::ImageViewType::e2DArray
+            : vk::ImageViewType::e2D,
+          resource.desc.format, {},
+          vk::ImageSubresourceRange{
+            resource.desc.aspect, 0, 1, 0, resource.desc.layers
+          }
+        });
+      }
+    }
+  }
+
+  auto CalculateBarriers() -> void {
+    struct TrackedState {
+      ImageSyncState state;
+      bool written{false};
+      // The barrier that last made the resource visible, widened in place when
+      // further readers of the same layout show up.
+      std::optional<std::pair<std::size_t, std::size_t>> last_barrier;
+    };
+
+    std::vector<TrackedState> tracked(resources_.size());
+    // Transient first-use barriers whose source scope is only known once the
+    // previous occupant of the memory block has been walked.
+    std::vector<std::pair<std::size_t, std::size_t>> first_use_barriers(
+      resources_.size());
+
+    for (std::size_t i{0}; i < resources_.size(); i++) {
+      if (resources_[i].imported) {
+        tracked[i].state = resources_[i].initial_state;
+      }
+    }
+
+    for (std::size_t pass_idx{0}; pass_idx < passes_.size(); pass_idx++) {
+      auto& pass{passes_[pass_idx]};
+      pass.barriers.clear();
+
+      if (pass.culled) {
+        continue;
+      }
+
+      for (auto const& [handle, usage] : pass.uses) {
+        auto const& resource{resources_[handle]};
+        auto& [state, written, last_barrier]{tracked[handle]};
+        auto const info{GetResourceUsageInfo(usage)};
+
+        if (!resource.imported && resource.first_pass == pass_idx) {
+          first_use_barriers[handle] = {pass_idx, pass.barriers.size()};
+          pass.barriers.emplace_back(Barrier{handle, {}, info.state});
+        } else if (state.layout == info.state.layout && !written && !info.
+          writes) {
+          state.stages |= info.state.stages;
+          state.access |= info.state.access;
+
+          if (last_barrier) {
+            auto& barrier{
+              passes_[last_barrier->first].barriers[last_barrier->second]
+            };
+            barrier.dst.stages |= info.state.stages;
+            barrier.dst.access |= info.state.access;
+          }
+
+          continue;
+        } else {
+          pass.barriers.emplace_back(Barrier{
+            handle, {state.stages, GetWriteAccess(state.access), state.layout},
+            info.state
+          });
+        }
+
+        state = info.state;
+        written = info.writes;
+        last_barrier = std::pair{pass_idx, pass.barriers.size() - 1};
+      }
+    }
+
+    for (auto const& block : memory_blocks_) {
+      for (std::size_t i{0}; i < block.resources.size(); i++) {
+        auto const previous{
+          block.resources[(i + block.resources.size() - 1) % block.resources.
+            size()]
+        };
+        auto const [pass_idx, barrier_idx]{first_use_barriers[block.resources[i]]};
+        auto const& previous_state{tracked[previous].state};
+        passes_[pass_idx].barriers[barrier_idx].src = ImageSyncState{
+          previous_state.stages, GetWriteAccess(previous_state.access),
+          vk::ImageLayout::eUndefined
+        };
+      }
+    }
+
+    final_barriers_.clear();
+
+    for (ResourceHandle i{0}; i < resources_.size(); i++) {
+      if (!resources_[i].final_usage) {
+        continue;
+      }
+
+      auto const& state{tracked[i].state};
+      auto const info{GetResourceUsageInfo(*resources_[i].final_usage)};
+
+      if (state.layout != info.state.layout || tracked[i].written) {
+        final_barriers_.emplace_back(Barrier{
+          i, {state.stages, GetWriteAccess(state.access), state.layout},
+          info.state
+        });
+      }
+    }
+  }
+
+  auto RecordBarriers(vk::CommandBuffer const command_buffer,
+                      std::vector<Barrier> const& barriers,
+                      std::vector<vk::ImageMemoryBarrier2>& image_barriers)
+  const -> void {
+    if (barriers.empty()) {
+      return;
+    }
+
+    image_barriers.clear();
+
+    for (auto const& [handle, src, dst] : barriers) {
+      auto const& resource{resources_[handle]};
+      auto aspect{resource.desc.aspect};
+
+      if (HasStencilComponent(resource.desc.format)) {
+        aspect |= vk::ImageAspectFlagBits::eStencil;
+      }
+
+      image_barriers.emplace_back(
+        src.stages, src.access, dst.stages, dst.access, src.layout, dst.layout,
+        vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, resource.image,
+        vk::ImageSubresourceRange{
+          aspect, 0, vk::RemainingMipLevels, 0, vk::RemainingArrayLayers
+        });
+    }
+
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{
+      {}, {}, {}, image_barriers
+    });
+  }
+
+  [[nodiscard]] static auto LifetimesOverlap(Resource const& lhs,
+                                             Resource const& rhs) -> bool {
+    return *lhs.first_pass <= rhs.last_pass && *rhs.first_pass <= lhs.
+           last_pass;
+  }
+
+  [[nodiscard]] auto FindMemoryTypeIndex(std::uint32_t const type_filter,
+                                         vk::MemoryPropertyFlags const
+                                         properties) const -> std::optional<
+    std::uint32_t> {
+    for (std::uint32_t i{0}; i < memory_properties_.memoryTypeCount; i++) {
+      if ((type_filter & (1 << i)) && (memory_properties_.memoryTypes[i].
+        propertyFlags & properties) == properties) {
+        return i;
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  [[nodiscard]] auto FindMemoryType(std::uint32_t const type_filter,
+                                    vk::MemoryPropertyFlags const properties)
+  const -> std::uint32_t {
+    if (auto const idx{FindMemoryTypeIndex(type_filter, properties)}) {
+      return *idx;
+    }
+
+    throw std::runtime_error{"Failed to find suitable memory type."};
+  }
+
+  static vk::MemoryPropertyFlags constexpr lazy_memory_properties_{
+    vk::MemoryPropertyFlagBits::eDeviceLocal |
+    vk::MemoryPropertyFlagBits::eLazilyAllocated
+  };
+
+  vk::Device device_;
+  vk::PhysicalDeviceMemoryProperties memory_properties_;
+
+  std::vector<Resource> resources_;
+  std::vector<Pass> passes_;
+  std::vector<Barrier> final_barriers_;
+  std::vector<MemoryBlock> memory_blocks_;
+
+  MemoryStats memory_stats_{};
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include "interop.h"
+
+// The light culling pass writes the clusters, everything else only reads them
+#ifndef CLUSTER_BUFFER_ACCESS
+#define CLUSTER_BUFFER_ACCESS readonly
+#endif
+
+layout(std430, set = 0, binding = 3) readonly buffer LightBuffer {
+    PointLight lights[];
+} kLights;
+
+layout(std430, set = 0, binding = 4) CLUSTER_BUFFER_ACCESS buffer ClusterBuffer {
+    Cluster clusters[];
+} kClusters;
+
+// View space depth where a slice of the cluster grid starts
+float GetSliceDepth(uint slice) {
+    return kUbo.z_near * pow(kUbo.z_far / kUbo.z_near, float(slice) / CLUSTER_GRID_Z);
+}
+
+uint GetClusterIndex(uvec3 cell) {
+    return cell.x + (cell.y + cell.z * CLUSTER_GRID_Y) * CLUSTER_GRID_X;
+}
+
+// Cluster containing a view space position, positions outside the frustum go
+// to the nearest cluster
+uint GetClusterIndex(vec3 position) {
+    vec4 clip = kUbo.proj * vec4(position, 1);
+    vec2 ndc = clip.xy / clip.w;
+    uvec2 tile = uvec2(clamp((ndc * 0.5 + 0.5) * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y), vec2(0), vec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1)));
+    float slice = log(-position.z / kUbo.z_near) / log(kUbo.z_far / kUbo.z_near) * CLUSTER_GRID_Z;
+    return GetClusterIndex(uvec3(tile, uint(clamp(slice, 0, CLUSTER_GRID_Z - 1))));
+}
+
+#endif
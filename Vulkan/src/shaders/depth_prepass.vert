@@ -0,0 +1,13 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "interop.h"
+
+layout(location = 0) in vec3 inPosition;
+
+// Has to match vertex.vert bit for bit for the equal depth test of the main pass
+invariant gl_Position;
+
+void main() {
+    gl_Position = kUbo.proj * kUbo.view * kUbo.model * vec4(inPosition, 1);
+}
@@ -1,13 +1,56 @@
 #version 450
+#extension GL_GOOGLE_include_directive : enable
+
+#include "clustered_lighting.h"
+
+layout(constant_id = SCENE_CONSTANT_TEXTURE) const bool kTexture = true;
+layout(constant_id = SCENE_CONSTANT_CLUSTERED_LIGHTING) const bool kClusteredLighting = true;
+
+const vec3 kAmbientLight = vec3(0.3);
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 uv;
+layout(location = 2) in vec3 viewPosition;
 
 layout(location = 0) out vec4 outColor;
 
 layout(set = 0, binding = 1) uniform texture2D tex;
 layout(set = 0, binding = 2) uniform sampler texSampler;
 
+// Only the lights binned into the fragment's cluster are visited
+vec3 GetClusteredLighting() {
+	// The mesh has no normals, the face normal is turned towards the camera
+	vec3 normal = normalize(cross(dFdx(viewPosition), dFdy(viewPosition)));
+
+	if (dot(normal, viewPosition) > 0) {
+		normal = -normal;
+	}
+
+	uint clusterIdx = GetClusterIndex(viewPosition);
+	uint lightCount = kClusters.clusters[clusterIdx].light_count;
+	vec3 lighting = kAmbientLight;
+
+	for (uint i = 0; i < lightCount; i++) {
+		PointLight light = kLights.lights[kClusters.clusters[clusterIdx].light_indices[i]];
+		vec3 toLight = light.position - viewPosition;
+		float lightDistance = length(toLight);
+		float falloff = clamp(1 - lightDistance / light.radius, 0, 1);
+		lighting += light.color * max(dot(normal, toLight / lightDistance), 0) * falloff * falloff;
+	}
+
+	return lighting;
+}
+
 void main() {
-	outColor = vec4(fragColor * texture(sampler2D(tex, texSampler), uv).rgb, 1);
+	vec3 color = fragColor;
+
+	if (kTexture) {
+		color *= texture(sampler2D(tex, texSampler), uv).rgb;
+	}
+
+	if (kClusteredLighting) {
+		color *= GetClusteredLighting();
+	}
+
+	outColor = vec4(color, 1);
 }
@@ -4,15 +4,23 @@
 #ifdef __cplusplus
 #include <glm/glm.hpp>
 
+#include <cstdint>
+
 #define VEC2 glm::vec2
 #define VEC3 glm::vec3
 #define VEC4 glm::vec4
 #define MAT2 glm::mat2
 #define MAT3 glm::mat3
 #define MAT4 glm::mat4
+#define UINT std::uint32_t
 
 #define UBO_BEGIN(TYPENAME, SET, BINDING) struct TYPENAME {
 #define UBO_END(NAME) };
+
+#define PUSH_CONSTANTS_BEGIN(TYPENAME) struct TYPENAME {
+#define PUSH_CONSTANTS_END(NAME) };
+
+#define BUFFER_ADDRESS(TYPENAME) std::uint64_t
 #else
 #define VEC2 vec2
 #define VEC3 vec3
@@ -20,15 +28,85 @@
 #define MAT2 mat2
 #define MAT3 mat3
 #define MAT4 mat4
+#define UINT uint
 
 #define UBO_BEGIN(TYPENAME, SET, BINDING) layout(set = SET, binding = BINDING) uniform TYPENAME {
 #define UBO_END(NAME) } NAME;
+
+#define PUSH_CONSTANTS_BEGIN(TYPENAME) layout(push_constant) uniform TYPENAME {
+#define PUSH_CONSTANTS_END(NAME) } NAME;
+
+#define BUFFER_ADDRESS(TYPENAME) TYPENAME
 #endif
 
+// Six views cover the faces of a cube map
+#define MULTIVIEW_MAX_VIEW_COUNT 6
+
 UBO_BEGIN(UniformBufferObject, 0, 0)
   MAT4 model;
   MAT4 view;
   MAT4 proj;
+  // Per view projection * view matrices of the multiview pass, indexed by
+  // gl_ViewIndex
+  MAT4 view_projs[MULTIVIEW_MAX_VIEW_COUNT];
+  MAT4 inv_proj;
+  UINT light_count;
+  float z_near;
+  float z_far;
 UBO_END(kUbo)
 
+// The view frustum is split into a grid of clusters, exponentially along the
+// depth. The light culling pass lists the lights touching each cluster, so
+// fragments only loop over the lights of their own cluster.
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+// Lights beyond this in a single cluster are dropped
+#define CLUSTER_MAX_LIGHTS 127
+#define LIGHT_CULLING_GROUP_SIZE 128
+
+// View space, lights have no effect beyond their radius
+struct PointLight {
+  VEC3 position;
+  float radius;
+  VEC3 color;
+  float padding;
+};
+
+struct Cluster {
+  UINT light_count;
+  UINT light_indices[CLUSTER_MAX_LIGHTS];
+};
+
+// Specialization constant ids of the scene shaders, see SceneShaderVariant
+#define SCENE_CONSTANT_VERTEX_COLOR 0
+#define SCENE_CONSTANT_TEXTURE 1
+#define SCENE_CONSTANT_MULTIVIEW 2
+#define SCENE_CONSTANT_CLUSTERED_LIGHTING 3
+
+#define POST_PROCESS_FLAG_SWIZZLE_BGRA 1
+#define POST_PROCESS_GROUP_SIZE 8
+
+// Push constant blocks are only declared in the shaders that use them, every
+// declared block has to be covered by the pipeline layout.
+#if defined(__cplusplus) || defined(POST_PROCESS_SHADER)
+PUSH_CONSTANTS_BEGIN(PostProcessPushConstants)
+  VEC2 inv_extent;
+  float sharpness;
+  int flags;
+  // Fraction of the input image holding valid data when rendering at a
+  // dynamic resolution
+  VEC2 input_scale;
+PUSH_CONSTANTS_END(kPostProcess)
+#endif
+
+// The shader has to declare VertexBuffer as a buffer reference before
+// including this file
+#if defined(__cplusplus) || defined(VERTEX_PULLING_SHADER)
+PUSH_CONSTANTS_BEGIN(VertexPullingPushConstants)
+  BUFFER_ADDRESS(VertexBuffer) vertices;
+PUSH_CONSTANTS_END(kVertexPulling)
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,36 @@
+#ifndef POST_PROCESSING_H
+#define POST_PROCESSING_H
+
+#define POST_PROCESS_SHADER
+#include "interop.h"
+
+layout(local_size_x = POST_PROCESS_GROUP_SIZE, local_size_y = POST_PROCESS_GROUP_SIZE) in;
+
+layout(set = 0, binding = 0) uniform sampler2D inputImage;
+layout(set = 0, binding = 1, rgba8) uniform writeonly image2D outputImage;
+
+float Luma(vec3 color) {
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+vec3 EncodeSrgb(vec3 linear) {
+    vec3 low = linear * 12.92;
+    vec3 high = 1.055 * pow(linear, vec3(1.0 / 2.4)) - 0.055;
+    return mix(high, low, lessThanEqual(linear, vec3(0.0031308)));
+}
+
+// Returns false for the threads of the edge groups that fall outside the image
+bool GetPixel(out ivec2 pixel, out vec2 uv) {
+    pixel = ivec2(gl_GlobalInvocationID.xy);
+    uv = (vec2(pixel) + 0.5) * kPostProcess.inv_extent;
+    return all(lessThan(pixel, imageSize(outputImage)));
+}
+
+void StoreColor(ivec2 pixel, vec4 color) {
+    if ((kPostProcess.flags & POST_PROCESS_FLAG_SWIZZLE_BGRA) != 0) {
+        color = color.bgra;
+    }
+    imageStore(outputImage, pixel, color);
+}
+
+#endif
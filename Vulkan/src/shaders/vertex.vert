@@ -1,5 +1,6 @@
 #version 450
 #extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_multiview : require
 
 #include "interop.h"
 
@@ -7,11 +8,26 @@ layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inUv;
 
+layout(constant_id = SCENE_CONSTANT_VERTEX_COLOR) const bool kVertexColor = true;
+layout(constant_id = SCENE_CONSTANT_MULTIVIEW) const bool kMultiview = false;
+
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 outUv;
+layout(location = 2) out vec3 viewPosition;
+
+// Has to match depth_prepass.vert bit for bit for the equal depth test
+invariant gl_Position;
 
 void main() {
-    gl_Position = kUbo.proj * kUbo.view * kUbo.model * vec4(inPosition, 1);
-    fragColor = inColor;
+    // One draw renders every view, each picks its own matrices
+    if (kMultiview) {
+        gl_Position = kUbo.view_projs[gl_ViewIndex] * kUbo.model * vec4(inPosition, 1);
+    } else {
+        gl_Position = kUbo.proj * kUbo.view * kUbo.model * vec4(inPosition, 1);
+    }
+
+    // The light clusters are built for the main view only
+    viewPosition = (kUbo.view * kUbo.model * vec4(inPosition, 1)).xyz;
+    fragColor = kVertexColor ? inColor : vec3(1);
     outUv = inUv;
 }
@@ -0,0 +1,47 @@
+#version 450
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_multiview : require
+#extension GL_EXT_buffer_reference : require
+
+// The vertices are read as raw floats so the layout is decoded here and not
+// by the input assembler. Currently it is the C++ Vertex struct: position,
+// color and uv tightly packed.
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer VertexBuffer {
+    float data[];
+};
+
+#define VERTEX_PULLING_SHADER
+#include "interop.h"
+
+const uint kVertexStride = 8;
+
+layout(constant_id = SCENE_CONSTANT_VERTEX_COLOR) const bool kVertexColor = true;
+layout(constant_id = SCENE_CONSTANT_MULTIVIEW) const bool kMultiview = false;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 outUv;
+layout(location = 2) out vec3 viewPosition;
+
+// Has to match depth_prepass.vert bit for bit for the equal depth test
+invariant gl_Position;
+
+void main() {
+    VertexBuffer vertices = kVertexPulling.vertices;
+    uint base = uint(gl_VertexIndex) * kVertexStride;
+
+    vec3 position = vec3(vertices.data[base + 0], vertices.data[base + 1], vertices.data[base + 2]);
+    vec2 uv = vec2(vertices.data[base + 6], vertices.data[base + 7]);
+
+    // One draw renders every view, each picks its own matrices
+    if (kMultiview) {
+        gl_Position = kUbo.view_projs[gl_ViewIndex] * kUbo.model * vec4(position, 1);
+    } else {
+        gl_Position = kUbo.proj * kUbo.view * kUbo.model * vec4(position, 1);
+    }
+
+    // The light clusters are built for the main view only
+    viewPosition = (kUbo.view * kUbo.model * vec4(position, 1)).xyz;
+    // Without vertex colors their loads are not even emitted
+    fragColor = kVertexColor ? vec3(vertices.data[base + 3], vertices.data[base + 4], vertices.data[base + 5]) : vec3(1);
+    outUv = uv;
+}
@@ -0,0 +1,135 @@
+#ifndef STAGING_STREAM_H
+#define STAGING_STREAM_H
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// Append-only host visible memory for data on its way to the device. It grows
+// in fixed size chunks that stay mapped for their whole lifetime, so data can
+// be produced straight into memory the device copies from instead of being
+// built up in host memory first. Offsets are continuous across chunks.
+class StagingStream {
+public:
+  StagingStream(vk::Device const device,
+                vk::PhysicalDeviceMemoryProperties const& memory_properties,
+                vk::DeviceSize const chunk_size) :
+    device_{device}, memory_properties_{memory_properties},
+    chunk_size_{chunk_size} {}
+
+  StagingStream(StagingStream const& other) = delete;
+  StagingStream(StagingStream&& other) = delete;
+
+  ~StagingStream() {
+    for (auto const& chunk : chunks_) {
+      device_.unmapMemory(chunk.memory);
+      device_.destroyBuffer(chunk.buffer);
+      device_.freeMemory(chunk.memory);
+    }
+  }
+
+  auto operator=(StagingStream const& other) -> void = delete;
+  auto operator=(StagingStream&& other) -> void = delete;
+
+  auto WriteBytes(void const* const data, vk::DeviceSize size) -> void {
+    auto src{static_cast<std::byte const*>(data)};
+
+    while (size > 0) {
+      auto const chunk_idx{size_ / chunk_size_};
+      auto const chunk_offset{size_ % chunk_size_};
+
+      if (chunk_idx == chunks_.size()) {
+        AddChunk();
+      }
+
+      auto const write_size{std::min(size, chunk_size_ - chunk_offset)};
+      std::memcpy(chunks_[chunk_idx].mapped + chunk_offset, src, write_size);
+      src += write_size;
+      size -= write_size;
+      size_ += write_size;
+    }
+  }
+
+  template <typename T> requires std::is_trivially_copyable_v<T>
+  auto Write(T const& value) -> void {
+    WriteBytes(&value, sizeof(T));
+  }
+
+  // Records the copies of a range of the stream into dst, one per chunk the
+  // range touches
+  auto RecordCopy(vk::CommandBuffer const command_buffer,
+                  vk::DeviceSize src_offset, vk::Buffer const dst,
+                  vk::DeviceSize dst_offset, vk::DeviceSize size) const -> void {
+    while (size > 0) {
+      auto const& chunk{chunks_[src_offset / chunk_size_]};
+      auto const chunk_offset{src_offset % chunk_size_};
+      auto const copy_size{std::min(size, chunk_size_ - chunk_offset)};
+      command_buffer.copyBuffer(chunk.buffer, dst, vk::BufferCopy{
+                                  chunk_offset, dst_offset, copy_size
+                                });
+      src_offset += copy_size;
+      dst_offset += copy_size;
+      size -= copy_size;
+    }
+  }
+
+  [[nodiscard]] auto GetSize() const -> vk::DeviceSize {
+    return size_;
+  }
+
+  [[nodiscard]] auto GetAllocatedSize() const -> vk::DeviceSize {
+    return chunks_.size() * chunk_size_;
+  }
+
+private:
+  struct Chunk {
+    vk::Buffer buffer;
+    vk::DeviceMemory memory;
+    std::byte* mapped;
+  };
+
+  auto AddChunk() -> void {
+    auto& chunk{chunks_.emplace_back()};
+    chunk.buffer = device_.createBuffer(vk::BufferCreateInfo{
+      {}, chunk_size_, vk::BufferUsageFlagBits::eTransferSrc,
+      vk::SharingMode::eExclusive
+    });
+    auto const mem_req{device_.getBufferMemoryRequirements(chunk.buffer)};
+    chunk.memory = device_.allocateMemory(vk::MemoryAllocateInfo{
+      mem_req.size,
+      FindMemoryType(mem_req.memoryTypeBits,
+                     vk::MemoryPropertyFlagBits::eHostVisible |
+                     vk::MemoryPropertyFlagBits::eHostCoherent)
+    });
+    device_.bindBufferMemory(chunk.buffer, chunk.memory, 0);
+    chunk.mapped = static_cast<std::byte*>(device_.mapMemory(
+      chunk.memory, 0, chunk_size_));
+  }
+
+  [[nodiscard]] auto FindMemoryType(std::uint32_t const type_filter,
+                                    vk::MemoryPropertyFlags const properties)
+  const -> std::uint32_t {
+    for (std::uint32_t i{0}; i < memory_properties_.memoryTypeCount; i++) {
+      if ((type_filter & (1 << i)) && (memory_properties_.memoryTypes[i].
+        propertyFlags & properties) == properties) {
+        return i;
+      }
+    }
+
+    throw std::runtime_error{"Failed to find suitable memory type."};
+  }
+
+  vk::Device device_;
+  vk::PhysicalDeviceMemoryProperties memory_properties_;
+  vk::DeviceSize chunk_size_;
+  vk::DeviceSize size_{0};
+  std::vector<Chunk> chunks_;
+};
+
+#endif
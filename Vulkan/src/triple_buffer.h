@@ -0,0 +1,58 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff between a single producer and a single consumer thread.
+// The producer always owns a slot to write the next value into and the
+// consumer always owns the latest published one, so neither side ever waits
+// on the other. Values that are published but not acquired in time are
+// overwritten by the next one.
+template <typename T>
+class TripleBuffer {
+public:
+  // Slot owned by the producer, only valid until the next Publish
+  [[nodiscard]] auto GetWriteSlot() -> T& {
+    return slots_[back_idx_];
+  }
+
+  // Makes the write slot the latest value and takes over the previous one
+  auto Publish() -> void {
+    back_idx_ = static_cast<std::uint8_t>(
+      middle_.exchange(back_idx_ | fresh_bit_, std::memory_order_acq_rel) &
+      idx_mask_);
+  }
+
+  // Takes over the latest published value, returns false if there is no value
+  // newer than the current read slot
+  auto Acquire() -> bool {
+    if (!(middle_.load(std::memory_order_relaxed) & fresh_bit_)) {
+      return false;
+    }
+
+    front_idx_ = static_cast<std::uint8_t>(
+      middle_.exchange(front_idx_, std::memory_order_acq_rel) & idx_mask_);
+    return true;
+  }
+
+  // Slot owned by the consumer, only valid until the next successful Acquire
+  [[nodiscard]] auto GetReadSlot() const -> T const& {
+    return slots_[front_idx_];
+  }
+
+private:
+  static std::uint8_t constexpr idx_mask_{0b011};
+  static std::uint8_t constexpr fresh_bit_{0b100};
+
+  std::array<T, 3> slots_{};
+
+  // Index of the slot in between the two sides and whether it holds a value
+  // the consumer has not seen yet
+  std::atomic<std::uint8_t> middle_{1};
+  std::uint8_t front_idx_{0};
+  std::uint8_t back_idx_{2};
+};
+
+#endif